@@ -0,0 +1,229 @@
+/*
+* AES-GCM with CTR and GHASH stitched into one pass
+*
+* Botan is released under the Simplified BSD License (see license.txt)
+*/
+/// IMCONEE
+
+#include <botan/internal/aes_gcm.h>
+
+#include <botan/internal/aes.h>
+#include <botan/internal/cpuid.h>
+#include <botan/internal/ct_utils.h>
+#include <botan/internal/fmt.h>
+#include <botan/internal/loadstor.h>
+
+namespace Botan {
+
+namespace {
+
+template <typename AES>
+void expand_key(std::span<const uint8_t> key, secure_vector<uint32_t>& EK) {
+   AES aes;
+   aes.set_key(key);
+   const auto rk = aes.encryption_round_keys();
+   EK.assign(rk.begin(), rk.end());
+}
+
+}  // namespace
+
+//static
+bool AES_GCM_Mode::available() {
+   return CPUID::has_aes_ni() && CPUID::has_clmul();
+}
+
+AES_GCM_Mode::AES_GCM_Mode(size_t key_len) : m_key_len(key_len), m_rounds(6 + key_len / 4) {
+   if(key_len != 16 && key_len != 24 && key_len != 32) {
+      throw Invalid_Argument(fmt("AES-GCM cannot use a key of {} bytes", key_len));
+   }
+}
+
+void AES_GCM_Mode::clear() {
+   zap(m_EK);
+   zap(m_H_pow);
+   secure_scrub_memory(m_EJ0, sizeof(m_EJ0));
+   reset();
+}
+
+void AES_GCM_Mode::reset() {
+   zap(m_ad);
+   secure_scrub_memory(m_ctr, sizeof(m_ctr));
+   secure_scrub_memory(m_S, sizeof(m_S));
+   m_text_len = 0;
+}
+
+std::string AES_GCM_Mode::name() const {
+   return fmt("AES-{}/GCM({})", m_key_len * 8, tag_size());
+}
+
+std::string AES_GCM_Mode::provider() const {
+#if defined(BOTAN_HAS_AEAD_AES_GCM_VAES)
+   if(CPUID::has_avx512_aes() && CPUID::has_avx512_clmul()) {
+      return "vaes";
+   }
+#endif
+   return "aesni";
+}
+
+void AES_GCM_Mode::key_schedule(std::span<const uint8_t> key) {
+   BOTAN_STATE_CHECK(available());
+
+   // AES_* expand keys with AES-NI whenever it is present, which available() demands
+   if(m_key_len == 16) {
+      expand_key<AES_128>(key, m_EK);
+   } else if(m_key_len == 24) {
+      expand_key<AES_192>(key, m_EK);
+   } else {
+      expand_key<AES_256>(key, m_EK);
+   }
+
+   m_H_pow.resize(2 * 16);
+   aesni_precompute(m_EK.data(), m_rounds, m_H_pow.data());
+}
+
+void AES_GCM_Mode::set_associated_data_n(size_t idx, std::span<const uint8_t> ad) {
+   BOTAN_ARG_CHECK(idx == 0, "AES-GCM: cannot handle non-zero index in set_associated_data_n");
+   m_ad.assign(ad.begin(), ad.end());
+}
+
+void AES_GCM_Mode::start_msg(const uint8_t nonce[], size_t nonce_len) {
+   if(!valid_nonce_length(nonce_len)) {
+      throw Invalid_IV_Length(name(), nonce_len);
+   }
+
+   assert_key_material_set();
+
+   // J0 = nonce || 1; text starts at inc32(J0)
+   copy_mem(m_EJ0, nonce, nonce_len);
+   store_be(static_cast<uint32_t>(1), m_EJ0 + 12);
+   copy_mem(m_ctr, m_EJ0, GCM_BS);
+   store_be(static_cast<uint32_t>(2), m_ctr + 12);
+   aesni_encrypt_block(m_EK.data(), m_rounds, m_EJ0);
+
+   clear_mem(m_S, GCM_BS);
+   m_text_len = 0;
+
+   const size_t ad_blocks = m_ad.size() / GCM_BS;
+   const size_t ad_final = m_ad.size() % GCM_BS;
+
+   if(ad_blocks) {
+      aesni_ghash(m_H_pow.data(), m_S, m_ad.data(), ad_blocks);
+   }
+   if(ad_final) {
+      uint8_t last_block[GCM_BS] = {0};
+      copy_mem(last_block, m_ad.data() + ad_blocks * GCM_BS, ad_final);
+      aesni_ghash(m_H_pow.data(), m_S, last_block, 1);
+      secure_scrub_memory(last_block, ad_final);
+   }
+}
+
+void AES_GCM_Mode::crypt_blocks(uint8_t buf[], size_t blocks, bool enc) {
+#if defined(BOTAN_HAS_AEAD_AES_GCM_VAES)
+   if(blocks >= 16 && CPUID::has_avx512_aes() && CPUID::has_avx512_clmul()) {
+      const size_t wide = blocks - blocks % 16;
+      vaes_crypt(m_EK.data(), m_rounds, m_H_pow.data(), m_ctr, m_S, buf, wide, enc);
+      buf += wide * GCM_BS;
+      blocks -= wide;
+   }
+#endif
+
+   if(blocks) {
+      aesni_crypt(m_EK.data(), m_rounds, m_H_pow.data(), m_ctr, m_S, buf, blocks, enc);
+   }
+}
+
+void AES_GCM_Mode::crypt_tail(uint8_t buf[], size_t len, bool enc) {
+   uint8_t ks[GCM_BS];
+   copy_mem(ks, m_ctr, GCM_BS);
+   aesni_encrypt_block(m_EK.data(), m_rounds, ks);
+
+   uint8_t last_block[GCM_BS] = {0};
+   if(enc) {
+      xor_buf(buf, ks, len);
+      copy_mem(last_block, buf, len);
+   } else {
+      copy_mem(last_block, buf, len);
+      xor_buf(buf, ks, len);
+   }
+   aesni_ghash(m_H_pow.data(), m_S, last_block, 1);
+
+   secure_scrub_memory(ks, sizeof(ks));
+   secure_scrub_memory(last_block, sizeof(last_block));
+}
+
+void AES_GCM_Mode::final_tag(uint8_t tag[GCM_BS]) {
+   uint8_t len_block[GCM_BS];
+   store_be(static_cast<uint64_t>(m_ad.size()) * 8, len_block);
+   store_be(static_cast<uint64_t>(m_text_len) * 8, len_block + 8);
+   aesni_ghash(m_H_pow.data(), m_S, len_block, 1);
+
+   xor_buf(tag, m_S, m_EJ0, GCM_BS);
+
+   clear_mem(m_S, GCM_BS);
+   m_text_len = 0;
+}
+
+size_t AES_GCM_Encryption::process_msg(uint8_t buf[], size_t sz) {
+   BOTAN_ARG_CHECK(sz % update_granularity() == 0, "Invalid buffer size");
+   crypt_blocks(buf, sz / GCM_BS, true);
+   m_text_len += sz;
+   return sz;
+}
+
+void AES_GCM_Encryption::finish_msg(secure_vector<uint8_t>& buffer, size_t offset) {
+   BOTAN_ARG_CHECK(offset <= buffer.size(), "Invalid offset");
+   const size_t sz = buffer.size() - offset;
+   uint8_t* buf = buffer.data() + offset;
+
+   const size_t full = sz - sz % GCM_BS;
+   if(full) {
+      crypt_blocks(buf, full / GCM_BS, true);
+   }
+   if(sz > full) {
+      crypt_tail(buf + full, sz - full, true);
+   }
+   m_text_len += sz;
+
+   uint8_t mac[GCM_BS];
+   final_tag(mac);
+   buffer += std::make_pair(mac, tag_size());
+}
+
+size_t AES_GCM_Decryption::process_msg(uint8_t buf[], size_t sz) {
+   BOTAN_ARG_CHECK(sz % update_granularity() == 0, "Invalid buffer size");
+   crypt_blocks(buf, sz / GCM_BS, false);
+   m_text_len += sz;
+   return sz;
+}
+
+void AES_GCM_Decryption::finish_msg(secure_vector<uint8_t>& buffer, size_t offset) {
+   BOTAN_ARG_CHECK(offset <= buffer.size(), "Invalid offset");
+   const size_t sz = buffer.size() - offset;
+   uint8_t* buf = buffer.data() + offset;
+
+   BOTAN_ARG_CHECK(sz >= tag_size(), "input did not include the tag");
+
+   const size_t remaining = sz - tag_size();
+
+   const size_t full = remaining - remaining % GCM_BS;
+   if(full) {
+      crypt_blocks(buf, full / GCM_BS, false);
+   }
+   if(remaining > full) {
+      crypt_tail(buf + full, remaining - full, false);
+   }
+   m_text_len += remaining;
+
+   uint8_t mac[GCM_BS];
+   final_tag(mac);
+
+   const uint8_t* included_tag = &buffer[remaining + offset];
+
+   if(!CT::is_equal(mac, included_tag, tag_size()).as_bool()) {
+      throw Invalid_Authentication_Tag("GCM tag check failed");
+   }
+
+   buffer.resize(offset + remaining);
+}
+
+}  // namespace Botan
@@ -0,0 +1,265 @@
+/*
+* AES-GCM using AES-NI and CLMUL: eight blocks per step
+*
+* Botan is released under the Simplified BSD License (see license.txt)
+*/
+/// IMCONEE
+
+#include <botan/internal/aes_gcm.h>
+
+#include <botan/internal/simd_32.h>
+#include <immintrin.h>
+#include <wmmintrin.h>
+
+namespace Botan {
+
+namespace {
+
+BOTAN_FUNC_ISA_INLINE(BOTAN_VPERM_ISA) SIMD_4x32 reverse_vector(const SIMD_4x32& in) {
+   const __m128i BSWAP_MASK = _mm_set_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+   return SIMD_4x32(_mm_shuffle_epi8(in.raw(), BSWAP_MASK));
+}
+
+template <int M>
+BOTAN_FORCE_INLINE SIMD_4x32 BOTAN_FUNC_ISA(BOTAN_CLMUL_ISA) clmul(const SIMD_4x32& H, const SIMD_4x32& x) {
+   return SIMD_4x32(_mm_clmulepi64_si128(x.raw(), H.raw(), M));
+}
+
+inline SIMD_4x32 gcm_reduce(const SIMD_4x32& B0, const SIMD_4x32& B1) {
+   SIMD_4x32 X0 = B1.shr<31>();
+   SIMD_4x32 X1 = B1.shl<1>();
+   SIMD_4x32 X2 = B0.shr<31>();
+   SIMD_4x32 X3 = B0.shl<1>();
+
+   X3 |= X0.shift_elems_right<3>();
+   X3 |= X2.shift_elems_left<1>();
+   X1 |= X0.shift_elems_left<1>();
+
+   X0 = X1.shl<31>() ^ X1.shl<30>() ^ X1.shl<25>();
+
+   X1 ^= X0.shift_elems_left<3>();
+
+   X0 = X1 ^ X3 ^ X0.shift_elems_right<1>();
+   X0 ^= X1.shr<7>() ^ X1.shr<2>() ^ X1.shr<1>();
+   return X0;
+}
+
+inline SIMD_4x32 BOTAN_FUNC_ISA(BOTAN_CLMUL_ISA) gcm_multiply(const SIMD_4x32& H, const SIMD_4x32& x) {
+   SIMD_4x32 T0 = clmul<0x11>(H, x);
+   SIMD_4x32 T1 = clmul<0x10>(H, x);
+   SIMD_4x32 T2 = clmul<0x01>(H, x);
+   SIMD_4x32 T3 = clmul<0x00>(H, x);
+
+   T1 ^= T2;
+   T0 ^= T1.shift_elems_right<2>();
+   T3 ^= T1.shift_elems_left<2>();
+
+   return gcm_reduce(T0, T3);
+}
+
+/*
+* Karatsuba products of several blocks summed before a single reduction
+* (delayed reduction of Jankowski and Laurent)
+*/
+struct ghash_sum {
+      SIMD_4x32 lo, hi, mid;
+};
+
+BOTAN_FORCE_INLINE BOTAN_FUNC_ISA(BOTAN_CLMUL_ISA) void ghash_add(ghash_sum& s, const SIMD_4x32& H, const SIMD_4x32& X) {
+   s.lo ^= clmul<0x00>(H, X);
+   s.hi ^= clmul<0x11>(H, X);
+   s.mid ^= clmul<0x00>(H ^ H.shift_elems_right<2>(), X ^ X.shift_elems_right<2>());
+}
+
+BOTAN_FORCE_INLINE SIMD_4x32 ghash_reduce(const ghash_sum& s) {
+   const SIMD_4x32 T = s.mid ^ s.lo ^ s.hi;
+   return gcm_reduce(s.hi ^ T.shift_elems_right<2>(), s.lo ^ T.shift_elems_left<2>());
+}
+
+/*
+* a = (a ^ X[0]) * H^n ^ X[1] * H^(n-1) ^ ... ^ X[n-1] * H, 0 < n <= 8
+*/
+BOTAN_FUNC_ISA_INLINE("ssse3,pclmul")
+SIMD_4x32 ghash_n(const SIMD_4x32& a, const SIMD_4x32 H[8], const uint8_t in[], size_t n) {
+   ghash_sum s;
+   for(size_t j = 0; j != n; ++j) {
+      SIMD_4x32 X = reverse_vector(SIMD_4x32::load_le(in + 16 * j));
+      if(j == 0) {
+         X ^= a;
+      }
+      ghash_add(s, H[n - 1 - j], X);
+   }
+   return ghash_reduce(s);
+}
+
+BOTAN_FUNC_ISA_INLINE("aes") void aesenc(const SIMD_4x32& K, SIMD_4x32 B[8]) {
+   for(size_t j = 0; j != 8; ++j) {
+      B[j] = SIMD_4x32(_mm_aesenc_si128(B[j].raw(), K.raw()));
+   }
+}
+
+BOTAN_FUNC_ISA_INLINE("aes") void aesenclast(const SIMD_4x32& K, SIMD_4x32 B[8]) {
+   for(size_t j = 0; j != 8; ++j) {
+      B[j] = SIMD_4x32(_mm_aesenclast_si128(B[j].raw(), K.raw()));
+   }
+}
+
+BOTAN_FUNC_ISA_INLINE("ssse3,aes") SIMD_4x32 aes_block(const SIMD_4x32 K[15], size_t rounds, SIMD_4x32 B) {
+   B ^= K[0];
+   for(size_t r = 1; r != rounds; ++r) {
+      B = SIMD_4x32(_mm_aesenc_si128(B.raw(), K[r].raw()));
+   }
+   return SIMD_4x32(_mm_aesenclast_si128(B.raw(), K[rounds].raw()));
+}
+
+BOTAN_FUNC_ISA_INLINE("ssse3") void load_round_keys(SIMD_4x32 K[15], const uint32_t rk[], size_t rounds) {
+   for(size_t r = 0; r <= rounds; ++r) {
+      K[r] = SIMD_4x32::load_le(&rk[4 * r]);
+   }
+}
+
+}  // namespace
+
+//static
+BOTAN_FUNC_ISA("ssse3,aes,pclmul")
+void AES_GCM_Mode::aesni_precompute(const uint32_t rk[], size_t rounds, uint64_t H_pow[2 * 16]) {
+   SIMD_4x32 K[15];
+   load_round_keys(K, rk, rounds);
+
+   // H = E(0)
+   const SIMD_4x32 H1 = reverse_vector(aes_block(K, rounds, SIMD_4x32()));
+
+   SIMD_4x32 Hi = H1;
+   Hi.store_le(H_pow);
+   for(size_t i = 1; i != 16; ++i) {
+      Hi = gcm_multiply(H1, Hi);
+      Hi.store_le(H_pow + 2 * i);
+   }
+}
+
+//static
+BOTAN_FUNC_ISA("ssse3,aes")
+void AES_GCM_Mode::aesni_encrypt_block(const uint32_t rk[], size_t rounds, uint8_t block[16]) {
+   SIMD_4x32 K[15];
+   load_round_keys(K, rk, rounds);
+   aes_block(K, rounds, SIMD_4x32::load_le(block)).store_le(block);
+}
+
+//static
+BOTAN_FUNC_ISA("ssse3,pclmul")
+void AES_GCM_Mode::aesni_ghash(const uint64_t H_pow[2 * 8], uint8_t S[16], const uint8_t in[], size_t blocks) {
+   SIMD_4x32 H[8];
+   for(size_t i = 0; i != 8; ++i) {
+      H[i] = SIMD_4x32::load_le(H_pow + 2 * i);
+   }
+
+   SIMD_4x32 a = reverse_vector(SIMD_4x32::load_le(S));
+
+   while(blocks) {
+      const size_t n = std::min<size_t>(blocks, 8);
+      a = ghash_n(a, H, in, n);
+      in += 16 * n;
+      blocks -= n;
+   }
+
+   reverse_vector(a).store_le(S);
+}
+
+/*
+* CTR of eight blocks per step with GHASH of eight ciphertext blocks spread over
+* the first AES rounds. Decryption hashes the blocks it is about to decrypt,
+* encryption hashes the blocks produced by the previous step.
+*/
+//static
+BOTAN_FUNC_ISA("ssse3,aes,pclmul")
+void AES_GCM_Mode::aesni_crypt(const uint32_t rk[],
+                               size_t rounds,
+                               const uint64_t H_pow[2 * 8],
+                               uint8_t ctr[16],
+                               uint8_t S[16],
+                               uint8_t buf[],
+                               size_t blocks,
+                               bool enc) {
+   SIMD_4x32 K[15];
+   load_round_keys(K, rk, rounds);
+
+   SIMD_4x32 H[8];
+   for(size_t i = 0; i != 8; ++i) {
+      H[i] = SIMD_4x32::load_le(H_pow + 2 * i);
+   }
+
+   SIMD_4x32 a = reverse_vector(SIMD_4x32::load_le(S));
+
+   // counter word as a native integer in element 0; inc32 wraps within it
+   SIMD_4x32 c = reverse_vector(SIMD_4x32::load_le(ctr));
+   const SIMD_4x32 one(1, 0, 0, 0);
+
+   const uint8_t* unhashed = buf;  // encryption: ciphertext of previous step
+
+   while(blocks >= 8) {
+      const uint8_t* in = enc ? unhashed : buf;
+      const bool stitch = !enc || unhashed != buf;
+
+      SIMD_4x32 B[8], X[8];
+      for(size_t j = 0; j != 8; ++j) {
+         B[j] = reverse_vector(c) ^ K[0];
+         c += one;
+      }
+
+      ghash_sum s;
+      for(size_t r = 1; r != 5; ++r) {
+         aesenc(K[r], B);
+         if(stitch) {
+            const size_t j = 2 * (r - 1);
+            X[j] = reverse_vector(SIMD_4x32::load_le(in + 16 * j));
+            X[j + 1] = reverse_vector(SIMD_4x32::load_le(in + 16 * (j + 1)));
+            if(j == 0) {
+               X[0] ^= a;
+            }
+            ghash_add(s, H[7 - j], X[j]);
+            ghash_add(s, H[6 - j], X[j + 1]);
+         }
+      }
+      aesenc(K[5], B);
+      if(stitch) {
+         a = ghash_reduce(s);
+      }
+      for(size_t r = 6; r != rounds; ++r) {
+         aesenc(K[r], B);
+      }
+      aesenclast(K[rounds], B);
+
+      for(size_t j = 0; j != 8; ++j) {
+         (B[j] ^ SIMD_4x32::load_le(buf + 16 * j)).store_le(buf + 16 * j);
+      }
+
+      unhashed = buf;
+      buf += 16 * 8;
+      blocks -= 8;
+   }
+
+   if(enc && unhashed != buf) {
+      a = ghash_n(a, H, unhashed, 8);
+   }
+
+   if(blocks) {
+      if(!enc) {
+         a = ghash_n(a, H, buf, blocks);
+      }
+
+      for(size_t j = 0; j != blocks; ++j) {
+         const SIMD_4x32 B = aes_block(K, rounds, reverse_vector(c));
+         c += one;
+         (B ^ SIMD_4x32::load_le(buf + 16 * j)).store_le(buf + 16 * j);
+      }
+
+      if(enc) {
+         a = ghash_n(a, H, buf, blocks);
+      }
+   }
+
+   reverse_vector(c).store_le(ctr);
+   reverse_vector(a).store_le(S);
+}
+
+}  // namespace Botan
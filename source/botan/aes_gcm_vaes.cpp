@@ -0,0 +1,172 @@
+/*
+* AES-GCM using VAES and VPCLMULQDQ: sixteen blocks per step, four per register
+*
+* Botan is released under the Simplified BSD License (see license.txt)
+*/
+/// IMCONEE
+
+#include <botan/internal/aes_gcm.h>
+
+#include <botan/internal/simd_32.h>
+#include <immintrin.h>
+
+namespace Botan {
+
+namespace {
+
+#define BOTAN_VAES_FN BOTAN_FUNC_ISA("avx512f,avx512dq,avx512bw,vaes,vpclmulqdq")
+
+inline SIMD_4x32 gcm_reduce(const SIMD_4x32& B0, const SIMD_4x32& B1) {
+   SIMD_4x32 X0 = B1.shr<31>();
+   SIMD_4x32 X1 = B1.shl<1>();
+   SIMD_4x32 X2 = B0.shr<31>();
+   SIMD_4x32 X3 = B0.shl<1>();
+
+   X3 |= X0.shift_elems_right<3>();
+   X3 |= X2.shift_elems_left<1>();
+   X1 |= X0.shift_elems_left<1>();
+
+   X0 = X1.shl<31>() ^ X1.shl<30>() ^ X1.shl<25>();
+
+   X1 ^= X0.shift_elems_left<3>();
+
+   X0 = X1 ^ X3 ^ X0.shift_elems_right<1>();
+   X0 ^= X1.shr<7>() ^ X1.shr<2>() ^ X1.shr<1>();
+   return X0;
+}
+
+BOTAN_VAES_FN BOTAN_FORCE_INLINE __m128i xor_lanes(__m512i v) {
+   const __m256i t = _mm256_xor_si256(_mm512_castsi512_si256(v), _mm512_extracti64x4_epi64(v, 1));
+   return _mm_xor_si128(_mm256_castsi256_si128(t), _mm256_extracti128_si256(t, 1));
+}
+
+/*
+* Karatsuba products of four blocks per register, summed across registers
+* and lanes before a single reduction
+*/
+struct ghash_sum {
+      __m512i lo, hi, mid;
+};
+
+BOTAN_VAES_FN BOTAN_FORCE_INLINE ghash_sum ghash_zero() {
+   return {_mm512_setzero_si512(), _mm512_setzero_si512(), _mm512_setzero_si512()};
+}
+
+BOTAN_VAES_FN BOTAN_FORCE_INLINE void ghash_add(ghash_sum& s, __m512i H, __m512i Hm, __m512i X) {
+   s.lo = _mm512_xor_si512(s.lo, _mm512_clmulepi64_epi128(X, H, 0x00));
+   s.hi = _mm512_xor_si512(s.hi, _mm512_clmulepi64_epi128(X, H, 0x11));
+   s.mid = _mm512_xor_si512(s.mid, _mm512_clmulepi64_epi128(_mm512_xor_si512(X, _mm512_bsrli_epi128(X, 8)), Hm, 0x00));
+}
+
+BOTAN_VAES_FN BOTAN_FORCE_INLINE __m128i ghash_reduce(const ghash_sum& s) {
+   const SIMD_4x32 lo(xor_lanes(s.lo));
+   const SIMD_4x32 hi(xor_lanes(s.hi));
+   const SIMD_4x32 T = SIMD_4x32(xor_lanes(s.mid)) ^ lo ^ hi;
+   return gcm_reduce(hi ^ T.shift_elems_right<2>(), lo ^ T.shift_elems_left<2>()).raw();
+}
+
+/*
+* Blocks 4g..4g+3 of in, bit reflected; the GHASH state a goes into the first
+*/
+BOTAN_VAES_FN BOTAN_FORCE_INLINE __m512i load_block4(const uint8_t in[], size_t g, __m128i a, __m512i bswap) {
+   const __m512i X = _mm512_shuffle_epi8(_mm512_loadu_si512(in + 64 * g), bswap);
+   return g == 0 ? _mm512_xor_si512(X, _mm512_zextsi128_si512(a)) : X;
+}
+
+BOTAN_VAES_FN BOTAN_FORCE_INLINE void aesenc(__m512i K, __m512i B[4]) {
+   for(size_t g = 0; g != 4; ++g) {
+      B[g] = _mm512_aesenc_epi128(B[g], K);
+   }
+}
+
+}  // namespace
+
+/*
+* Same schedule as aesni_crypt with each step twice as long: GHASH of one
+* register of ciphertext per AES round in the first four rounds
+*/
+//static
+BOTAN_VAES_FN
+void AES_GCM_Mode::vaes_crypt(const uint32_t rk[],
+                              size_t rounds,
+                              const uint64_t H_pow[2 * 16],
+                              uint8_t ctr[16],
+                              uint8_t S[16],
+                              uint8_t buf[],
+                              size_t blocks,
+                              bool enc) {
+   const __m512i bswap =
+      _mm512_broadcast_i32x4(_mm_set_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15));
+
+   __m512i K[15];
+   for(size_t r = 0; r <= rounds; ++r) {
+      K[r] = _mm512_broadcast_i32x4(_mm_loadu_si128(reinterpret_cast<const __m128i*>(&rk[4 * r])));
+   }
+
+   // register g of a step holds blocks 4g..4g+3, which take H^(16-4g)..H^(13-4g)
+   __m512i H[4], Hm[4];
+   for(size_t g = 0; g != 4; ++g) {
+      const __m512i P = _mm512_loadu_si512(&H_pow[2 * (12 - 4 * g)]);
+      H[g] = _mm512_shuffle_i64x2(P, P, _MM_SHUFFLE(0, 1, 2, 3));
+      Hm[g] = _mm512_xor_si512(H[g], _mm512_bsrli_epi128(H[g], 8));
+   }
+
+   __m128i a = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(S)), _mm512_castsi512_si128(bswap));
+
+   // counter word as a native integer in element 0 of each lane; inc32 wraps within it
+   __m512i c = _mm512_broadcast_i32x4(
+      _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(ctr)), _mm512_castsi512_si128(bswap)));
+   c = _mm512_add_epi32(c, _mm512_set_epi32(0, 0, 0, 3, 0, 0, 0, 2, 0, 0, 0, 1, 0, 0, 0, 0));
+   const __m512i four = _mm512_set_epi32(0, 0, 0, 4, 0, 0, 0, 4, 0, 0, 0, 4, 0, 0, 0, 4);
+
+   const uint8_t* unhashed = buf;  // encryption: ciphertext of previous step
+
+   while(blocks) {
+      const uint8_t* in = enc ? unhashed : buf;
+      const bool stitch = !enc || unhashed != buf;
+
+      __m512i B[4];
+      for(size_t g = 0; g != 4; ++g) {
+         B[g] = _mm512_xor_si512(_mm512_shuffle_epi8(c, bswap), K[0]);
+         c = _mm512_add_epi32(c, four);
+      }
+
+      ghash_sum s = ghash_zero();
+      for(size_t r = 1; r != 5; ++r) {
+         aesenc(K[r], B);
+         if(stitch) {
+            const size_t g = r - 1;
+            ghash_add(s, H[g], Hm[g], load_block4(in, g, a, bswap));
+         }
+      }
+      aesenc(K[5], B);
+      if(stitch) {
+         a = ghash_reduce(s);
+      }
+      for(size_t r = 6; r != rounds; ++r) {
+         aesenc(K[r], B);
+      }
+      for(size_t g = 0; g != 4; ++g) {
+         B[g] = _mm512_aesenclast_epi128(B[g], K[rounds]);
+         _mm512_storeu_si512(buf + 64 * g, _mm512_xor_si512(B[g], _mm512_loadu_si512(buf + 64 * g)));
+      }
+
+      unhashed = buf;
+      buf += 16 * 16;
+      blocks -= 16;
+   }
+
+   if(enc && unhashed != buf) {
+      ghash_sum s = ghash_zero();
+      for(size_t g = 0; g != 4; ++g) {
+         ghash_add(s, H[g], Hm[g], load_block4(unhashed, g, a, bswap));
+      }
+      a = ghash_reduce(s);
+   }
+
+   _mm_storeu_si128(reinterpret_cast<__m128i*>(ctr), _mm_shuffle_epi8(_mm512_castsi512_si128(c), _mm512_castsi512_si128(bswap)));
+   _mm_storeu_si128(reinterpret_cast<__m128i*>(S), _mm_shuffle_epi8(a, _mm512_castsi512_si128(bswap)));
+   _mm256_zeroupper();
+}
+
+}  // namespace Botan
@@ -54,10 +54,14 @@
 #define BOTAN_HAS_CHACHA_AVX512
 
 #define BOTAN_HAS_POLY1305
+#define BOTAN_HAS_POLY1305_AVX2
+#define BOTAN_HAS_POLY1305_AVX512
 #define BOTAN_HAS_BLOCK_CIPHER
 
 #define BOTAN_HAS_AEAD_CHACHA20_POLY1305
 #define BOTAN_HAS_AEAD_GCM
+#define BOTAN_HAS_AEAD_AES_GCM
+#define BOTAN_HAS_AEAD_AES_GCM_VAES
 #define BOTAN_HAS_AEAD_MODES
 
 #define BOTAN_DEFAULT_BUFFER_SIZE 4096
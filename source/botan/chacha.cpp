@@ -368,6 +368,53 @@ void ChaCha::set_iv_bytes(const uint8_t iv[], size_t length) {
    m_position = 0;
 }
 
+/// IMCONEE
+void ChaCha::keystream_lanes(uint8_t output[], const uint32_t lanes[], size_t n) {
+   assert_key_material_set();
+   initialize_state();  // words 0..11 must be the key (XChaCha IV replaces them)
+
+#if defined(BOTAN_HAS_CHACHA_AVX512)
+   if(CPUID::has_avx512()) {
+      while(n >= 16) {
+         ChaCha::chacha_avx512_x16_lanes(output, m_state.data(), lanes, m_rounds);
+         output += 16 * 64;
+         lanes += 16 * 4;
+         n -= 16;
+      }
+   }
+#endif
+
+#if defined(BOTAN_HAS_CHACHA_AVX2)
+   if(CPUID::has_avx2()) {
+      while(n >= 8) {
+         ChaCha::chacha_avx2_x8_lanes(output, m_state.data(), lanes, m_rounds);
+         output += 8 * 64;
+         lanes += 8 * 4;
+         n -= 8;
+      }
+
+      if(n > 2) {
+         // pad to full kernel width: still cheaper than one scalar block per lane
+         uint32_t padded[8 * 4] = {0};
+         uint8_t block[8 * 64];
+         copy_mem(padded, lanes, 4 * n);
+         ChaCha::chacha_avx2_x8_lanes(block, m_state.data(), padded, m_rounds);
+         copy_mem(output, block, 64 * n);
+         secure_scrub_memory(block, sizeof(block));
+         n = 0;
+      }
+   }
+#endif
+
+   uint32_t state[16];
+   copy_mem(state, m_state.data(), 12);
+   for(size_t i = 0; i != n; ++i) {
+      copy_mem(state + 12, lanes + 4 * i, 4);
+      chacha(output + 64 * i, 1, state, m_rounds);
+   }
+   secure_scrub_memory(state, sizeof(state));
+}
+
 void ChaCha::clear() {
    zap(m_key);
    zap(m_state);
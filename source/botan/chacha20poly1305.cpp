@@ -102,6 +102,102 @@ void ChaCha20Poly1305_Mode::start_msg(const uint8_t nonce[], size_t nonce_len) {
    }
 }
 
+/// IMCONEE
+void ChaCha20Poly1305_Mode::record_tag(const uint8_t key[32], const uint8_t ctext[], size_t len, uint8_t tag[16]) {
+   const uint8_t zeros[16] = {0};
+
+   m_poly1305->set_key(key, 32);
+   m_poly1305->update(m_ad);
+   if(m_ad.size() % 16) {
+      m_poly1305->update(zeros, 16 - m_ad.size() % 16);
+   }
+   m_poly1305->update(ctext, len);
+   if(len % 16) {
+      m_poly1305->update(zeros, 16 - len % 16);
+   }
+   update_len(m_ad.size());
+   update_len(len);
+   m_poly1305->final(tag);
+}
+
+/// IMCONEE
+bool ChaCha20Poly1305_Mode::crypt_records(std::span<const Record> records, bool encrypt) {
+   BOTAN_STATE_CHECK(m_nonce_len == 0);  // not inside of regular message
+
+   ChaCha& chacha = static_cast<ChaCha&>(*m_chacha);
+   constexpr size_t lanes_per_call = 16;
+
+   uint32_t lanes[lanes_per_call * 4];
+   uint8_t keystream[lanes_per_call * 64];
+
+   // block 0 of each record is its poly1305 key
+   auto set_lane = [&lanes](size_t lane, uint32_t counter, const uint8_t nonce[12]) {
+      lanes[4 * lane] = counter;
+      load_le<uint32_t>(&lanes[4 * lane + 1], nonce, 3);
+   };
+
+   for(size_t first = 0; first < records.size(); first += lanes_per_call) {
+      const std::span<const Record> part = records.subspan(first, std::min(lanes_per_call, records.size() - first));
+
+      for(size_t i = 0; i != part.size(); ++i) {
+         set_lane(i, 0, part[i].nonce);
+      }
+      uint8_t poly_keys[lanes_per_call * 64];
+      chacha.keystream_lanes(poly_keys, lanes, part.size());
+
+      if(!encrypt) {
+         for(size_t i = 0; i != part.size(); ++i) {
+            uint8_t mac[16];
+            record_tag(poly_keys + 64 * i, part[i].buf, part[i].size, mac);
+            if(!CT::is_equal(mac, part[i].buf + part[i].size, tag_size()).as_bool()) {
+               secure_scrub_memory(poly_keys, sizeof(poly_keys));
+               return false;
+            }
+         }
+      }
+
+      // remaining blocks of all records in full-width kernel calls
+      struct {
+            uint8_t* buf;
+            size_t len;
+      } dest[lanes_per_call];
+
+      size_t used = 0;
+      auto flush = [&]() {
+         chacha.keystream_lanes(keystream, lanes, used);
+         for(size_t l = 0; l != used; ++l) {
+            xor_buf(dest[l].buf, keystream + 64 * l, dest[l].len);
+         }
+         used = 0;
+      };
+
+      for(const Record& r : part) {
+         for(size_t offset = 0, block = 1; offset < r.size; offset += 64, ++block) {
+            set_lane(used, static_cast<uint32_t>(block), r.nonce);
+            dest[used].buf = r.buf + offset;
+            dest[used].len = std::min<size_t>(64, r.size - offset);
+            if(++used == lanes_per_call) {
+               flush();
+            }
+         }
+      }
+      if(used > 0) {
+         flush();
+      }
+
+      if(encrypt) {
+         for(size_t i = 0; i != part.size(); ++i) {
+            record_tag(poly_keys + 64 * i, part[i].buf, part[i].size, part[i].buf + part[i].size);
+         }
+      }
+
+      secure_scrub_memory(poly_keys, sizeof(poly_keys));
+   }
+
+   secure_scrub_memory(keystream, sizeof(keystream));
+   return true;
+}
+
 size_t ChaCha20Poly1305_Encryption::process_msg(uint8_t buf[], size_t sz) {
    m_chacha->cipher1(buf, sz);
    m_poly1305->update(buf, sz);  // poly1305 of ciphertext
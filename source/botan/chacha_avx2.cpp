@@ -10,17 +10,15 @@
 
 namespace Botan {
 
-//static
+namespace {
+
+/// IMCONEE: rounds shared by counter and lanes kernels; I12..I15 are initial rows of state words 12..15
 BOTAN_AVX2_FN
-void ChaCha::chacha_avx2_x8(uint8_t output[64 * 8], uint32_t state[16], size_t rounds) {
+BOTAN_FORCE_INLINE void chacha_avx2_x8_rounds(uint8_t output[64 * 8],
+      const uint32_t state[16], SIMD_8x32 I12, SIMD_8x32 I13, SIMD_8x32 I14, SIMD_8x32 I15, size_t rounds) {
    SIMD_8x32::reset_registers();
 
    BOTAN_ASSERT(rounds % 2 == 0, "Valid rounds");
-   const SIMD_8x32 CTR0 = SIMD_8x32(0, 1, 2, 3, 4, 5, 6, 7);
-
-   const uint32_t C = 0xFFFFFFFF - state[12];
-   const SIMD_8x32 CTR1 = SIMD_8x32(0, C < 1, C < 2, C < 3, C < 4, C < 5, C < 6, C < 7);
-
    SIMD_8x32 R00 = SIMD_8x32::splat(state[0]);
    SIMD_8x32 R01 = SIMD_8x32::splat(state[1]);
    SIMD_8x32 R02 = SIMD_8x32::splat(state[2]);
@@ -33,10 +31,10 @@ void ChaCha::chacha_avx2_x8(uint8_t output[64 * 8], uint32_t state[16], size_t r
    SIMD_8x32 R09 = SIMD_8x32::splat(state[9]);
    SIMD_8x32 R10 = SIMD_8x32::splat(state[10]);
    SIMD_8x32 R11 = SIMD_8x32::splat(state[11]);
-   SIMD_8x32 R12 = SIMD_8x32::splat(state[12]) + CTR0;
-   SIMD_8x32 R13 = SIMD_8x32::splat(state[13]) + CTR1;
-   SIMD_8x32 R14 = SIMD_8x32::splat(state[14]);
-   SIMD_8x32 R15 = SIMD_8x32::splat(state[15]);
+   SIMD_8x32 R12 = I12;
+   SIMD_8x32 R13 = I13;
+   SIMD_8x32 R14 = I14;
+   SIMD_8x32 R15 = I15;
 
    for(size_t r = 0; r != rounds / 2; ++r) {
       R00 += R04;
@@ -172,10 +170,10 @@ void ChaCha::chacha_avx2_x8(uint8_t output[64 * 8], uint32_t state[16], size_t r
    R09 += SIMD_8x32::splat(state[9]);
    R10 += SIMD_8x32::splat(state[10]);
    R11 += SIMD_8x32::splat(state[11]);
-   R12 += SIMD_8x32::splat(state[12]) + CTR0;
-   R13 += SIMD_8x32::splat(state[13]) + CTR1;
-   R14 += SIMD_8x32::splat(state[14]);
-   R15 += SIMD_8x32::splat(state[15]);
+   R12 += I12;
+   R13 += I13;
+   R14 += I14;
+   R15 += I15;
 
    SIMD_8x32::transpose(R00, R01, R02, R03, R04, R05, R06, R07);
    SIMD_8x32::transpose(R08, R09, R10, R11, R12, R13, R14, R15);
@@ -198,10 +196,44 @@ void ChaCha::chacha_avx2_x8(uint8_t output[64 * 8], uint32_t state[16], size_t r
    R15.store_le(output + 32 * 15);
 
    SIMD_8x32::zero_registers();
+}
+
+}  // namespace
+
+//static
+BOTAN_AVX2_FN
+void ChaCha::chacha_avx2_x8(uint8_t output[64 * 8], uint32_t state[16], size_t rounds) {
+   const SIMD_8x32 CTR0 = SIMD_8x32(0, 1, 2, 3, 4, 5, 6, 7);
+
+   const uint32_t C = 0xFFFFFFFF - state[12];
+   const SIMD_8x32 CTR1 = SIMD_8x32(0, C < 1, C < 2, C < 3, C < 4, C < 5, C < 6, C < 7);
+
+   chacha_avx2_x8_rounds(output,
+      state,
+      SIMD_8x32::splat(state[12]) + CTR0,
+      SIMD_8x32::splat(state[13]) + CTR1,
+      SIMD_8x32::splat(state[14]),
+      SIMD_8x32::splat(state[15]),
+      rounds);
 
    state[12] += 8;
    if(state[12] < 8) {
       state[13]++;
    }
 }
+
+/// IMCONEE
+//static
+BOTAN_AVX2_FN
+void ChaCha::chacha_avx2_x8_lanes(uint8_t output[64 * 8],
+      const uint32_t state[16], const uint32_t lanes[4 * 8], size_t rounds) {
+   uint32_t rows[4][8];
+   for(size_t i = 0; i != 8; ++i) {
+      for(size_t j = 0; j != 4; ++j) {
+         rows[j][i] = lanes[4 * i + j];
+      }
+   }
+
+   chacha_avx2_x8_rounds(output, state, SIMD_8x32(rows[0]), SIMD_8x32(rows[1]), SIMD_8x32(rows[2]), SIMD_8x32(rows[3]), rounds);
+}
 }  // namespace Botan
@@ -9,16 +9,13 @@
 
 namespace Botan {
 
-//static
+namespace {
+
+/// IMCONEE: rounds shared by counter and lanes kernels; I12..I15 are initial rows of state words 12..15
 BOTAN_AVX512_FN
-void ChaCha::chacha_avx512_x16(uint8_t output[64 * 16], uint32_t state[16], size_t rounds) {
+BOTAN_FORCE_INLINE void chacha_avx512_x16_rounds(uint8_t output[64 * 16],
+      const uint32_t state[16], SIMD_16x32 I12, SIMD_16x32 I13, SIMD_16x32 I14, SIMD_16x32 I15, size_t rounds) {
    BOTAN_ASSERT(rounds % 2 == 0, "Valid rounds");
-   const SIMD_16x32 CTR0 = SIMD_16x32(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
-
-   const uint32_t C = 0xFFFFFFFF - state[12];
-   const SIMD_16x32 CTR1 = SIMD_16x32(
-      0, C < 1, C < 2, C < 3, C < 4, C < 5, C < 6, C < 7, C < 8, C < 9, C < 10, C < 11, C < 12, C < 13, C < 14, C < 15);
-
    SIMD_16x32 R00 = SIMD_16x32::splat(state[0]);
    SIMD_16x32 R01 = SIMD_16x32::splat(state[1]);
    SIMD_16x32 R02 = SIMD_16x32::splat(state[2]);
@@ -31,10 +28,10 @@ void ChaCha::chacha_avx512_x16(uint8_t output[64 * 16], uint32_t state[16], size
    SIMD_16x32 R09 = SIMD_16x32::splat(state[9]);
    SIMD_16x32 R10 = SIMD_16x32::splat(state[10]);
    SIMD_16x32 R11 = SIMD_16x32::splat(state[11]);
-   SIMD_16x32 R12 = SIMD_16x32::splat(state[12]) + CTR0;
-   SIMD_16x32 R13 = SIMD_16x32::splat(state[13]) + CTR1;
-   SIMD_16x32 R14 = SIMD_16x32::splat(state[14]);
-   SIMD_16x32 R15 = SIMD_16x32::splat(state[15]);
+   SIMD_16x32 R12 = I12;
+   SIMD_16x32 R13 = I13;
+   SIMD_16x32 R14 = I14;
+   SIMD_16x32 R15 = I15;
 
    for(size_t r = 0; r != rounds / 2; ++r) {
       R00 += R04;
@@ -170,10 +167,10 @@ void ChaCha::chacha_avx512_x16(uint8_t output[64 * 16], uint32_t state[16], size
    R09 += SIMD_16x32::splat(state[9]);
    R10 += SIMD_16x32::splat(state[10]);
    R11 += SIMD_16x32::splat(state[11]);
-   R12 += SIMD_16x32::splat(state[12]) + CTR0;
-   R13 += SIMD_16x32::splat(state[13]) + CTR1;
-   R14 += SIMD_16x32::splat(state[14]);
-   R15 += SIMD_16x32::splat(state[15]);
+   R12 += I12;
+   R13 += I13;
+   R14 += I14;
+   R15 += I15;
 
    SIMD_16x32::transpose(R00, R01, R02, R03, R04, R05, R06, R07, R08, R09, R10, R11, R12, R13, R14, R15);
 
@@ -195,10 +192,45 @@ void ChaCha::chacha_avx512_x16(uint8_t output[64 * 16], uint32_t state[16], size
    R15.store_le(output + 64 * 15);
 
    SIMD_16x32::zero_registers();
+}
+
+}  // namespace
+
+//static
+BOTAN_AVX512_FN
+void ChaCha::chacha_avx512_x16(uint8_t output[64 * 16], uint32_t state[16], size_t rounds) {
+   const SIMD_16x32 CTR0 = SIMD_16x32(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+
+   const uint32_t C = 0xFFFFFFFF - state[12];
+   const SIMD_16x32 CTR1 = SIMD_16x32(
+      0, C < 1, C < 2, C < 3, C < 4, C < 5, C < 6, C < 7, C < 8, C < 9, C < 10, C < 11, C < 12, C < 13, C < 14, C < 15);
+
+   chacha_avx512_x16_rounds(output,
+      state,
+      SIMD_16x32::splat(state[12]) + CTR0,
+      SIMD_16x32::splat(state[13]) + CTR1,
+      SIMD_16x32::splat(state[14]),
+      SIMD_16x32::splat(state[15]),
+      rounds);
 
    state[12] += 16;
    if(state[12] < 16) {
       state[13]++;
    }
 }
+
+/// IMCONEE
+//static
+BOTAN_AVX512_FN
+void ChaCha::chacha_avx512_x16_lanes(uint8_t output[64 * 16],
+      const uint32_t state[16], const uint32_t lanes[4 * 16], size_t rounds) {
+   uint32_t rows[4][16];
+   for(size_t i = 0; i != 16; ++i) {
+      for(size_t j = 0; j != 4; ++j) {
+         rows[j][i] = lanes[4 * i + j];
+      }
+   }
+
+   chacha_avx512_x16_rounds(output, state, SIMD_16x32(rows[0]), SIMD_16x32(rows[1]), SIMD_16x32(rows[2]), SIMD_16x32(rows[3]), rounds);
+}
 }  // namespace Botan
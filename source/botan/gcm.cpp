@@ -85,6 +85,7 @@ void GCM_Mode::key_schedule(std::span<const uint8_t> key) {
    m_ctr->set_iv(zeros.data(), zeros.size());
 
    secure_vector<uint8_t> H(GCM_BS);
+   clear_mem(H.data(), H.size());  /// IMCONEE: size constructor does not zero
    m_ctr->encipher(H);
    m_ghash->set_key(H);
 }
@@ -110,6 +110,7 @@ bool GHASH::has_keying_material() const {
 void GHASH::key_schedule(std::span<const uint8_t> key) {
    m_H.assign(key.begin(), key.end());  // TODO: C++23 - std::vector<>::assign_range()
    m_H_ad.resize(GCM_BS);
+   zeroise(m_H_ad);  /// IMCONEE: resize does not zero
    m_ad_len = 0;
    m_text_len = 0;
 
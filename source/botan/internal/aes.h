@@ -32,6 +32,13 @@ class AES_128 final : public Block_Cipher_Fixed_Params<16, 16> {
 
       bool has_keying_material() const override;
 
+      /// IMCONEE
+      /**
+      * Encryption round keys; stored as AES-NI round key registers when
+      * CPUID::has_aes_ni() held at set_key
+      */
+      std::span<const uint32_t> encryption_round_keys() const { return m_EK; }
+
    private:
       void key_schedule(std::span<const uint8_t> key) override;
 
@@ -72,6 +79,13 @@ class AES_192 final : public Block_Cipher_Fixed_Params<16, 24> {
       size_t parallelism() const override;
       bool has_keying_material() const override;
 
+      /// IMCONEE
+      /**
+      * Encryption round keys; stored as AES-NI round key registers when
+      * CPUID::has_aes_ni() held at set_key
+      */
+      std::span<const uint32_t> encryption_round_keys() const { return m_EK; }
+
    private:
 #if defined(BOTAN_HAS_AES_VPERM)
       void vperm_encrypt_n(const uint8_t in[], uint8_t out[], size_t blocks) const;
@@ -112,6 +126,13 @@ class AES_256 final : public Block_Cipher_Fixed_Params<16, 32> {
       size_t parallelism() const override;
       bool has_keying_material() const override;
 
+      /// IMCONEE
+      /**
+      * Encryption round keys; stored as AES-NI round key registers when
+      * CPUID::has_aes_ni() held at set_key
+      */
+      std::span<const uint32_t> encryption_round_keys() const { return m_EK; }
+
    private:
 #if defined(BOTAN_HAS_AES_VPERM)
       void vperm_encrypt_n(const uint8_t in[], uint8_t out[], size_t blocks) const;
@@ -0,0 +1,143 @@
+/*
+* AES-GCM with CTR and GHASH stitched into one pass
+*
+* Botan is released under the Simplified BSD License (see license.txt)
+*/
+/// IMCONEE
+
+#ifndef BOTAN_AEAD_AES_GCM_H_
+#define BOTAN_AEAD_AES_GCM_H_
+
+#include <botan/aead.h>
+
+namespace Botan {
+
+/**
+* GCM over AES with 96 bit nonces and 128 bit tags. Each step encrypts a group
+* of counter blocks while the carry-less multiplies of GHASH for the neighbour
+* group run between the AES rounds, so text is touched once. Needs AES-NI and
+* CLMUL (see available()); VAES and VPCLMULQDQ are used for long inputs if present.
+*/
+class AES_GCM_Mode : public AEAD_Mode {
+   public:
+      static bool available();
+
+      void set_associated_data_n(size_t idx, std::span<const uint8_t> ad) override final;
+
+      std::string name() const override final;
+
+      size_t update_granularity() const override final { return GCM_BS; }
+
+      size_t ideal_granularity() const override final { return GCM_BS * 16; }
+
+      Key_Length_Specification key_spec() const override final { return Key_Length_Specification(m_key_len); }
+
+      bool valid_nonce_length(size_t len) const override final { return len == 12; }
+
+      size_t tag_size() const override final { return GCM_BS; }
+
+      void clear() override final;
+
+      void reset() override final;
+
+      std::string provider() const override final;
+
+      bool has_keying_material() const override final { return !m_EK.empty(); }
+
+   protected:
+      /**
+      * @param key_len 16, 24 or 32 for AES-128/192/256
+      */
+      explicit AES_GCM_Mode(size_t key_len);
+
+      static const size_t GCM_BS = 16;
+
+      void crypt_blocks(uint8_t buf[], size_t blocks, bool enc);
+
+      void crypt_tail(uint8_t buf[], size_t len, bool enc);
+
+      void final_tag(uint8_t tag[GCM_BS]);
+
+      size_t m_text_len = 0;
+
+   private:
+      void start_msg(const uint8_t nonce[], size_t nonce_len) override;
+
+      void key_schedule(std::span<const uint8_t> key) override;
+
+      static void aesni_precompute(const uint32_t rk[], size_t rounds, uint64_t H_pow[2 * 16]);
+
+      static void aesni_encrypt_block(const uint32_t rk[], size_t rounds, uint8_t block[16]);
+
+      static void aesni_ghash(const uint64_t H_pow[2 * 8], uint8_t S[16], const uint8_t in[], size_t blocks);
+
+      static void aesni_crypt(const uint32_t rk[],
+                              size_t rounds,
+                              const uint64_t H_pow[2 * 8],
+                              uint8_t ctr[16],
+                              uint8_t S[16],
+                              uint8_t buf[],
+                              size_t blocks,
+                              bool enc);
+
+#if defined(BOTAN_HAS_AEAD_AES_GCM_VAES)
+      static void vaes_crypt(const uint32_t rk[],
+                             size_t rounds,
+                             const uint64_t H_pow[2 * 16],
+                             uint8_t ctr[16],
+                             uint8_t S[16],
+                             uint8_t buf[],
+                             size_t blocks,
+                             bool enc);
+#endif
+
+      const size_t m_key_len;
+      const size_t m_rounds;
+
+      secure_vector<uint32_t> m_EK;     // AES-NI layout round keys
+      secure_vector<uint64_t> m_H_pow;  // H^1..H^16, bit reflected
+      secure_vector<uint8_t> m_ad;
+
+      uint8_t m_ctr[GCM_BS] = {};  // counter block of next text block
+      uint8_t m_S[GCM_BS] = {};    // GHASH state
+      uint8_t m_EJ0[GCM_BS] = {};  // E(J0), masks the tag
+};
+
+/**
+* AES-GCM Encryption
+*/
+class AES_GCM_Encryption final : public AES_GCM_Mode {
+   public:
+      explicit AES_GCM_Encryption(size_t key_len) : AES_GCM_Mode(key_len) {}
+
+      size_t output_length(size_t input_length) const override { return input_length + tag_size(); }
+
+      size_t minimum_final_size() const override { return 0; }
+
+   private:
+      size_t process_msg(uint8_t buf[], size_t size) override;
+      void finish_msg(secure_vector<uint8_t>& final_block, size_t offset = 0) override;
+};
+
+/**
+* AES-GCM Decryption
+*/
+class AES_GCM_Decryption final : public AES_GCM_Mode {
+   public:
+      explicit AES_GCM_Decryption(size_t key_len) : AES_GCM_Mode(key_len) {}
+
+      size_t output_length(size_t input_length) const override {
+         BOTAN_ARG_CHECK(input_length >= tag_size(), "Sufficient input");
+         return input_length - tag_size();
+      }
+
+      size_t minimum_final_size() const override { return tag_size(); }
+
+   private:
+      size_t process_msg(uint8_t buf[], size_t size) override;
+      void finish_msg(secure_vector<uint8_t>& final_block, size_t offset = 0) override;
+};
+
+}  // namespace Botan
+
+#endif
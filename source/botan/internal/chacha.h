@@ -50,6 +50,17 @@ class ChaCha final : public StreamCipher {
 
       size_t buffer_size() const override;
 
+      /// IMCONEE
+      /**
+      * Generate one keystream block per lane; lanes share the key and
+      * set their own state words 12..15 (counter and nonce), so blocks of
+      * independent messages are computed by one wide kernel call
+      * @param output receives n * 64 bytes
+      * @param lanes n * 4 words
+      * @note resets the IV
+      */
+      void keystream_lanes(uint8_t output[], const uint32_t lanes[], size_t n);
+
    private:
       void key_schedule(std::span<const uint8_t> key) override;
 
@@ -71,10 +82,18 @@ class ChaCha final : public StreamCipher {
 
 #if defined(BOTAN_HAS_CHACHA_AVX2)
       static void chacha_avx2_x8(uint8_t output[64 * 8], uint32_t state[16], size_t rounds);
+      static void chacha_avx2_x8_lanes(uint8_t output[64 * 8],
+                                       const uint32_t state[16],
+                                       const uint32_t lanes[4 * 8],
+                                       size_t rounds);  /// IMCONEE
 #endif
 
 #if defined(BOTAN_HAS_CHACHA_AVX512)
       static void chacha_avx512_x16(uint8_t output[64 * 16], uint32_t state[16], size_t rounds);
+      static void chacha_avx512_x16_lanes(uint8_t output[64 * 16],
+                                          const uint32_t state[16],
+                                          const uint32_t lanes[4 * 16],
+                                          size_t rounds);  /// IMCONEE
 #endif
 
       size_t m_rounds;
@@ -46,6 +46,26 @@ class ChaCha20Poly1305_Mode : public AEAD_Mode {
 
       bool has_keying_material() const final;
 
+      /// IMCONEE
+      /**
+      * Independent message with 12 byte nonce; tag_size() bytes of tag
+      * follow size bytes of buf (written on encryption, checked on decryption)
+      */
+      struct Record {
+            uint8_t* buf;
+            size_t size;
+            const uint8_t* nonce;
+      };
+
+      /**
+      * Encrypt or decrypt several records in place. Keystream blocks of all
+      * records go through the wide ChaCha kernels together, so short records
+      * do not waste lanes. Associated data set for this mode applies to each record.
+      * @return false if tag of any record does not match (decryption);
+      * contents of records are undefined then
+      */
+      virtual bool process_records(std::span<const Record> records) = 0;
+
    protected:
       std::unique_ptr<StreamCipher> m_chacha;
       std::unique_ptr<MessageAuthenticationCode> m_poly1305;
@@ -60,7 +80,11 @@ class ChaCha20Poly1305_Mode : public AEAD_Mode {
 
       void update_len(size_t len);
 
+      bool crypt_records(std::span<const Record> records, bool encrypt);  /// IMCONEE
+
    private:
+      void record_tag(const uint8_t key[32], const uint8_t ctext[], size_t len, uint8_t tag[16]);  /// IMCONEE
+
       void start_msg(const uint8_t nonce[], size_t nonce_len) override;
 
       void key_schedule(std::span<const uint8_t> key) override;
@@ -75,6 +99,10 @@ class ChaCha20Poly1305_Encryption final : public ChaCha20Poly1305_Mode {
 
       size_t minimum_final_size() const override { return 0; }
 
+      bool process_records(std::span<const Record> records) override {
+         return crypt_records(records, true);
+      }  /// IMCONEE
+
    private:
       size_t process_msg(uint8_t buf[], size_t size) override;
       void finish_msg(secure_vector<uint8_t>& final_block, size_t offset = 0) override;
@@ -92,6 +120,10 @@ class ChaCha20Poly1305_Decryption final : public ChaCha20Poly1305_Mode {
 
       size_t minimum_final_size() const override { return tag_size(); }
 
+      bool process_records(std::span<const Record> records) override {
+         return crypt_records(records, false);
+      }  /// IMCONEE
+
    private:
       size_t process_msg(uint8_t buf[], size_t size) override;
       void finish_msg(secure_vector<uint8_t>& final_block, size_t offset = 0) override;
@@ -34,12 +34,30 @@ class Poly1305 final : public MessageAuthenticationCode {
 
       bool has_keying_material() const override;
 
+      std::string provider() const override;  /// IMCONEE
+
    private:
       void add_data(std::span<const uint8_t>) override;
       void final_result(std::span<uint8_t>) override;
       void key_schedule(std::span<const uint8_t>) override;
 
+      /// IMCONEE
+      // Vectorized paths: each lane accumulates every n-th block multiplied by r^n,
+      // at the end lanes are multiplied by r^n..r^1 and summed. h is in 44 bit limbs
+      // (as in m_poly), powers are r^1..r^n in 44 bit limbs; blocks is a multiple of n
+      void process_blocks(const uint8_t m[], size_t blocks);
+      const uint64_t* powers(size_t n);
+
+#if defined(BOTAN_HAS_POLY1305_AVX2)
+      static void poly1305_avx2_x4(uint64_t h[3], const uint64_t powers[3 * 4], const uint8_t m[], size_t blocks);
+#endif
+
+#if defined(BOTAN_HAS_POLY1305_AVX512)
+      static void poly1305_avx512_x8(uint64_t h[3], const uint64_t powers[3 * 8], const uint8_t m[], size_t blocks);
+#endif
+
       secure_vector<uint64_t> m_poly;
+      secure_vector<uint64_t> m_powers;  /// IMCONEE
       AlignmentBuffer<uint8_t, 16> m_buffer;
 };
 
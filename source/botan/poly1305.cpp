@@ -10,6 +10,7 @@
 
 #include <botan/internal/poly1305.h>
 
+#include <botan/internal/cpuid.h>
 #include <botan/internal/ct_utils.h>
 #include <botan/internal/donna128.h>
 #include <botan/internal/loadstor.h>
@@ -39,7 +40,7 @@ void poly1305_init(secure_vector<uint64_t>& X, const uint8_t key[32]) {
    X[7] = load_le<uint64_t>(key, 3);
 }
 
-void poly1305_blocks(secure_vector<uint64_t>& X, const uint8_t* m, size_t blocks, bool is_final = false) {
+void poly1305_blocks(uint64_t X[], const uint8_t* m, size_t blocks, bool is_final = false) {  /// IMCONEE: X is raw state
 #if !defined(BOTAN_TARGET_HAS_NATIVE_UINT128)
    typedef donna128 uint128_t;
 #endif
@@ -164,9 +165,74 @@ void poly1305_finish(secure_vector<uint64_t>& X, uint8_t mac[16]) {
 
 void Poly1305::clear() {
    zap(m_poly);
+   zap(m_powers);
    m_buffer.clear();
 }
 
+/// IMCONEE
+std::string Poly1305::provider() const {
+#if defined(BOTAN_HAS_POLY1305_AVX512)
+   if(CPUID::has_avx512()) {
+      return "avx512ifma";
+   }
+#endif
+
+#if defined(BOTAN_HAS_POLY1305_AVX2)
+   if(CPUID::has_avx2()) {
+      return "avx2";
+   }
+#endif
+
+   return "base";
+}
+
+/// IMCONEE
+const uint64_t* Poly1305::powers(size_t n) {
+   if(m_powers.size() < 3 * n) {
+      // r^k = r^(k-1) * r: block of zeros without hibit just multiplies h by r
+      uint64_t X[8];
+      const uint8_t zeros[16] = {0};
+      copy_mem(X, m_poly.data(), 8);
+
+      m_powers.resize(3 * n);
+      for(size_t k = 0; k != n; ++k) {
+         if(k == 0) {
+            copy_mem(&X[3], &X[0], 3);
+         } else {
+            poly1305_blocks(X, zeros, 1, true);
+         }
+         copy_mem(&m_powers[3 * k], &X[3], 3);
+      }
+      secure_scrub_memory(X, sizeof(X));
+   }
+   return m_powers.data();
+}
+
+/// IMCONEE
+void Poly1305::process_blocks(const uint8_t m[], size_t blocks) {
+#if defined(BOTAN_HAS_POLY1305_AVX512)
+   if(blocks >= 32 && CPUID::has_avx512()) {
+      const size_t wide = blocks - blocks % 8;
+      poly1305_avx512_x8(&m_poly[3], powers(8), m, wide);
+      m += 16 * wide;
+      blocks -= wide;
+   }
+#endif
+
+#if defined(BOTAN_HAS_POLY1305_AVX2)
+   if(blocks >= 16 && CPUID::has_avx2()) {
+      const size_t wide = blocks - blocks % 4;
+      poly1305_avx2_x4(&m_poly[3], powers(4), m, wide);
+      m += 16 * wide;
+      blocks -= wide;
+   }
+#endif
+
+   if(blocks > 0) {
+      poly1305_blocks(m_poly.data(), m, blocks);
+   }
+}
+
 bool Poly1305::has_keying_material() const {
    return m_poly.size() == 8;
 }
@@ -174,6 +240,7 @@ bool Poly1305::has_keying_material() const {
 void Poly1305::key_schedule(std::span<const uint8_t> key) {
    m_buffer.clear();
    m_poly.resize(8);
+   m_powers.clear();  /// IMCONEE
 
    poly1305_init(m_poly, key.data());
 }
@@ -185,13 +252,13 @@ void Poly1305::add_data(std::span<const uint8_t> input) {
 
    while(!in.empty()) {
       if(const auto one_block = m_buffer.handle_unaligned_data(in)) {
-         poly1305_blocks(m_poly, one_block->data(), 1);
+         poly1305_blocks(m_poly.data(), one_block->data(), 1);
       }
 
       if(m_buffer.in_alignment()) {
          const auto [aligned_data, full_blocks] = m_buffer.aligned_data_to_process(in);
          if(full_blocks > 0) {
-            poly1305_blocks(m_poly, aligned_data.data(), full_blocks);
+            process_blocks(aligned_data.data(), full_blocks);  /// IMCONEE
          }
       }
    }
@@ -204,7 +271,7 @@ void Poly1305::final_result(std::span<uint8_t> out) {
       const uint8_t final_byte = 0x01;
       m_buffer.append({&final_byte, 1});
       m_buffer.fill_up_with_zeros();
-      poly1305_blocks(m_poly, m_buffer.consume().data(), 1, true);
+      poly1305_blocks(m_poly.data(), m_buffer.consume().data(), 1, true);
    }
 
    poly1305_finish(m_poly, out.data());
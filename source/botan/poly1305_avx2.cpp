@@ -0,0 +1,200 @@
+/*
+* Poly1305 using AVX2: four blocks per step in radix 2^26
+*
+* Botan is released under the Simplified BSD License (see license.txt)
+*/
+/// IMCONEE
+
+#include <botan/internal/poly1305.h>
+
+#include <immintrin.h>
+
+namespace Botan {
+
+namespace {
+
+const uint64_t M26 = 0x3FFFFFF;
+const uint64_t M44 = 0xFFFFFFFFFFF;
+
+void limbs44_to_26(uint64_t out[5], const uint64_t x[3]) {
+   uint64_t t = x[0];
+   out[0] = t & M26;
+   t = (t >> 26) + (x[1] << 18);
+   out[1] = t & M26;
+   t >>= 26;
+   out[2] = t & M26;
+   t = (t >> 26) + (x[2] << 10);
+   out[3] = t & M26;
+   out[4] = t >> 26;
+}
+
+void limbs26_to_44(uint64_t out[3], uint64_t l[5]) {
+   uint64_t c;
+   c = l[0] >> 26;
+   l[0] &= M26;
+   l[1] += c;
+   c = l[1] >> 26;
+   l[1] &= M26;
+   l[2] += c;
+   c = l[2] >> 26;
+   l[2] &= M26;
+   l[3] += c;
+   c = l[3] >> 26;
+   l[3] &= M26;
+   l[4] += c;
+   c = l[4] >> 26;
+   l[4] &= M26;
+   l[0] += c * 5;
+   c = l[0] >> 26;
+   l[0] &= M26;
+   l[1] += c;
+
+   uint64_t t = l[0] + (l[1] << 26);
+   out[0] = t & M44;
+   t = (t >> 44) + (l[2] << 8) + (l[3] << 34);
+   out[1] = t & M44;
+   out[2] = (t >> 44) + (l[4] << 16);
+}
+
+/*
+* h = h * r mod 2^130-5, four independent lanes; s = 5 * r
+*/
+BOTAN_FUNC_ISA("avx2")
+BOTAN_FORCE_INLINE void mul_4x26(__m256i h[5], const __m256i r[5], const __m256i s[5]) {
+   const __m256i mask = _mm256_set1_epi64x(M26);
+
+   __m256i d0 = _mm256_mul_epu32(h[0], r[0]);
+   __m256i d1 = _mm256_mul_epu32(h[0], r[1]);
+   __m256i d2 = _mm256_mul_epu32(h[0], r[2]);
+   __m256i d3 = _mm256_mul_epu32(h[0], r[3]);
+   __m256i d4 = _mm256_mul_epu32(h[0], r[4]);
+
+   d0 = _mm256_add_epi64(d0, _mm256_mul_epu32(h[1], s[4]));
+   d1 = _mm256_add_epi64(d1, _mm256_mul_epu32(h[1], r[0]));
+   d2 = _mm256_add_epi64(d2, _mm256_mul_epu32(h[1], r[1]));
+   d3 = _mm256_add_epi64(d3, _mm256_mul_epu32(h[1], r[2]));
+   d4 = _mm256_add_epi64(d4, _mm256_mul_epu32(h[1], r[3]));
+
+   d0 = _mm256_add_epi64(d0, _mm256_mul_epu32(h[2], s[3]));
+   d1 = _mm256_add_epi64(d1, _mm256_mul_epu32(h[2], s[4]));
+   d2 = _mm256_add_epi64(d2, _mm256_mul_epu32(h[2], r[0]));
+   d3 = _mm256_add_epi64(d3, _mm256_mul_epu32(h[2], r[1]));
+   d4 = _mm256_add_epi64(d4, _mm256_mul_epu32(h[2], r[2]));
+
+   d0 = _mm256_add_epi64(d0, _mm256_mul_epu32(h[3], s[2]));
+   d1 = _mm256_add_epi64(d1, _mm256_mul_epu32(h[3], s[3]));
+   d2 = _mm256_add_epi64(d2, _mm256_mul_epu32(h[3], s[4]));
+   d3 = _mm256_add_epi64(d3, _mm256_mul_epu32(h[3], r[0]));
+   d4 = _mm256_add_epi64(d4, _mm256_mul_epu32(h[3], r[1]));
+
+   d0 = _mm256_add_epi64(d0, _mm256_mul_epu32(h[4], s[1]));
+   d1 = _mm256_add_epi64(d1, _mm256_mul_epu32(h[4], s[2]));
+   d2 = _mm256_add_epi64(d2, _mm256_mul_epu32(h[4], s[3]));
+   d3 = _mm256_add_epi64(d3, _mm256_mul_epu32(h[4], s[4]));
+   d4 = _mm256_add_epi64(d4, _mm256_mul_epu32(h[4], r[0]));
+
+   // two interleaved carry chains: d0->d1->d2->d3 and d3->d4->d0->d1
+   __m256i c0 = _mm256_srli_epi64(d0, 26);
+   __m256i c3 = _mm256_srli_epi64(d3, 26);
+   d0 = _mm256_and_si256(d0, mask);
+   d3 = _mm256_and_si256(d3, mask);
+   d1 = _mm256_add_epi64(d1, c0);
+   d4 = _mm256_add_epi64(d4, c3);
+
+   __m256i c1 = _mm256_srli_epi64(d1, 26);
+   __m256i c4 = _mm256_srli_epi64(d4, 26);
+   d1 = _mm256_and_si256(d1, mask);
+   d4 = _mm256_and_si256(d4, mask);
+   d2 = _mm256_add_epi64(d2, c1);
+   d0 = _mm256_add_epi64(d0, _mm256_add_epi64(c4, _mm256_slli_epi64(c4, 2)));
+
+   __m256i c2 = _mm256_srli_epi64(d2, 26);
+   c0 = _mm256_srli_epi64(d0, 26);
+   d2 = _mm256_and_si256(d2, mask);
+   d0 = _mm256_and_si256(d0, mask);
+   d3 = _mm256_add_epi64(d3, c2);
+   d1 = _mm256_add_epi64(d1, c0);
+
+   c3 = _mm256_srli_epi64(d3, 26);
+   d3 = _mm256_and_si256(d3, mask);
+   d4 = _mm256_add_epi64(d4, c3);
+
+   h[0] = d0;
+   h[1] = d1;
+   h[2] = d2;
+   h[3] = d3;
+   h[4] = d4;
+}
+
+/*
+* Four consecutive blocks, one per lane, with 2^128 bit set
+*/
+BOTAN_FUNC_ISA("avx2")
+BOTAN_FORCE_INLINE void load_4x26(__m256i m[5], const uint8_t in[64]) {
+   const __m256i mask = _mm256_set1_epi64x(M26);
+
+   const __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(in));
+   const __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(in + 32));
+
+   // unpack gives lanes in order 0, 2, 1, 3
+   const __m256i lo = _mm256_permute4x64_epi64(_mm256_unpacklo_epi64(a, b), _MM_SHUFFLE(3, 1, 2, 0));
+   const __m256i hi = _mm256_permute4x64_epi64(_mm256_unpackhi_epi64(a, b), _MM_SHUFFLE(3, 1, 2, 0));
+
+   m[0] = _mm256_and_si256(lo, mask);
+   m[1] = _mm256_and_si256(_mm256_srli_epi64(lo, 26), mask);
+   m[2] = _mm256_and_si256(_mm256_or_si256(_mm256_srli_epi64(lo, 52), _mm256_slli_epi64(hi, 12)), mask);
+   m[3] = _mm256_and_si256(_mm256_srli_epi64(hi, 14), mask);
+   m[4] = _mm256_or_si256(_mm256_srli_epi64(hi, 40), _mm256_set1_epi64x(1 << 24));
+}
+
+}  // namespace
+
+//static
+BOTAN_FUNC_ISA("avx2")
+void Poly1305::poly1305_avx2_x4(uint64_t h[3], const uint64_t powers[3 * 4], const uint8_t m[], size_t blocks) {
+   uint64_t p[4][5];  // r^1..r^4
+   for(size_t i = 0; i != 4; ++i) {
+      limbs44_to_26(p[i], &powers[3 * i]);
+   }
+
+   uint64_t h26[5];
+   limbs44_to_26(h26, h);
+
+   __m256i r4[5], s4[5], rl[5], sl[5], acc[5], msg[5];
+   for(size_t i = 0; i != 5; ++i) {
+      r4[i] = _mm256_set1_epi64x(p[3][i]);
+      s4[i] = _mm256_add_epi64(r4[i], _mm256_slli_epi64(r4[i], 2));
+
+      // lane 0 holds the oldest block of the last step
+      rl[i] = _mm256_set_epi64x(p[0][i], p[1][i], p[2][i], p[3][i]);
+      sl[i] = _mm256_add_epi64(rl[i], _mm256_slli_epi64(rl[i], 2));
+   }
+
+   load_4x26(acc, m);
+   for(size_t i = 0; i != 5; ++i) {
+      acc[i] = _mm256_add_epi64(acc[i], _mm256_set_epi64x(0, 0, 0, h26[i]));
+   }
+
+   for(size_t b = 4; b != blocks; b += 4) {
+      mul_4x26(acc, r4, s4);
+      load_4x26(msg, m + 16 * b);
+      for(size_t i = 0; i != 5; ++i) {
+         acc[i] = _mm256_add_epi64(acc[i], msg[i]);
+      }
+   }
+
+   mul_4x26(acc, rl, sl);
+
+   for(size_t i = 0; i != 5; ++i) {
+      uint64_t lanes[4];
+      _mm256_storeu_si256(reinterpret_cast<__m256i*>(lanes), acc[i]);
+      h26[i] = lanes[0] + lanes[1] + lanes[2] + lanes[3];
+   }
+
+   limbs26_to_44(h, h26);
+
+   _mm256_zeroall();
+   secure_scrub_memory(p, sizeof(p));
+}
+
+}  // namespace Botan
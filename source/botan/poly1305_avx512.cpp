@@ -0,0 +1,158 @@
+/*
+* Poly1305 using AVX-512 IFMA: eight blocks per step in radix 2^44
+*
+* Botan is released under the Simplified BSD License (see license.txt)
+*/
+/// IMCONEE
+
+#include <botan/internal/poly1305.h>
+
+#include <immintrin.h>
+
+namespace Botan {
+
+namespace {
+
+#define BOTAN_AVX512_IFMA_FN BOTAN_FUNC_ISA("avx512f,avx512ifma")
+
+const uint64_t M44 = 0xFFFFFFFFFFF;
+const uint64_t M42 = 0x3FFFFFFFFFF;
+
+/*
+* h = h * r mod 2^130-5, eight independent lanes; s = 20 * r (2^132 = 20 mod p)
+* 52 bit multipliers give low and high halves of each product separately:
+* high half of limb i is 2^8 of limb i+1, high half of limb 2 is 2^140 = 5 * 2^10
+*/
+BOTAN_AVX512_IFMA_FN
+BOTAN_FORCE_INLINE void mul_8x44(__m512i h[3], const __m512i r[3], const __m512i s[3]) {
+   const __m512i zero = _mm512_setzero_si512();
+
+   __m512i d0 = _mm512_madd52lo_epu64(zero, h[0], r[0]);
+   __m512i d1 = _mm512_madd52lo_epu64(zero, h[0], r[1]);
+   __m512i d2 = _mm512_madd52lo_epu64(zero, h[0], r[2]);
+   __m512i g0 = _mm512_madd52hi_epu64(zero, h[0], r[0]);
+   __m512i g1 = _mm512_madd52hi_epu64(zero, h[0], r[1]);
+   __m512i g2 = _mm512_madd52hi_epu64(zero, h[0], r[2]);
+
+   d0 = _mm512_madd52lo_epu64(d0, h[1], s[2]);
+   d1 = _mm512_madd52lo_epu64(d1, h[1], r[0]);
+   d2 = _mm512_madd52lo_epu64(d2, h[1], r[1]);
+   g0 = _mm512_madd52hi_epu64(g0, h[1], s[2]);
+   g1 = _mm512_madd52hi_epu64(g1, h[1], r[0]);
+   g2 = _mm512_madd52hi_epu64(g2, h[1], r[1]);
+
+   d0 = _mm512_madd52lo_epu64(d0, h[2], s[1]);
+   d1 = _mm512_madd52lo_epu64(d1, h[2], s[2]);
+   d2 = _mm512_madd52lo_epu64(d2, h[2], r[0]);
+   g0 = _mm512_madd52hi_epu64(g0, h[2], s[1]);
+   g1 = _mm512_madd52hi_epu64(g1, h[2], s[2]);
+   g2 = _mm512_madd52hi_epu64(g2, h[2], r[0]);
+
+   d1 = _mm512_add_epi64(d1, _mm512_slli_epi64(g0, 8));
+   d2 = _mm512_add_epi64(d2, _mm512_slli_epi64(g1, 8));
+   d0 = _mm512_add_epi64(d0, _mm512_add_epi64(_mm512_slli_epi64(g2, 12), _mm512_slli_epi64(g2, 10)));
+
+   const __m512i mask44 = _mm512_set1_epi64(M44);
+   const __m512i mask42 = _mm512_set1_epi64(M42);
+
+   __m512i c = _mm512_srli_epi64(d0, 44);
+   d0 = _mm512_and_si512(d0, mask44);
+   d1 = _mm512_add_epi64(d1, c);
+   c = _mm512_srli_epi64(d1, 44);
+   d1 = _mm512_and_si512(d1, mask44);
+   d2 = _mm512_add_epi64(d2, c);
+   c = _mm512_srli_epi64(d2, 42);
+   d2 = _mm512_and_si512(d2, mask42);
+   d0 = _mm512_add_epi64(d0, _mm512_add_epi64(c, _mm512_slli_epi64(c, 2)));
+   c = _mm512_srli_epi64(d0, 44);
+   d0 = _mm512_and_si512(d0, mask44);
+   d1 = _mm512_add_epi64(d1, c);
+
+   h[0] = d0;
+   h[1] = d1;
+   h[2] = d2;
+}
+
+/*
+* Eight consecutive blocks, one per lane, with 2^128 bit set
+*/
+BOTAN_AVX512_IFMA_FN
+BOTAN_FORCE_INLINE void load_8x44(__m512i m[3], const uint8_t in[128]) {
+   const __m512i a = _mm512_loadu_si512(in);
+   const __m512i b = _mm512_loadu_si512(in + 64);
+
+   const __m512i lo = _mm512_permutex2var_epi64(a, _mm512_set_epi64(14, 12, 10, 8, 6, 4, 2, 0), b);
+   const __m512i hi = _mm512_permutex2var_epi64(a, _mm512_set_epi64(15, 13, 11, 9, 7, 5, 3, 1), b);
+
+   const __m512i mask44 = _mm512_set1_epi64(M44);
+
+   m[0] = _mm512_and_si512(lo, mask44);
+   m[1] = _mm512_and_si512(_mm512_or_si512(_mm512_srli_epi64(lo, 44), _mm512_slli_epi64(hi, 20)), mask44);
+   m[2] = _mm512_or_si512(_mm512_srli_epi64(hi, 24), _mm512_set1_epi64(static_cast<uint64_t>(1) << 40));
+}
+
+}  // namespace
+
+//static
+BOTAN_AVX512_IFMA_FN
+void Poly1305::poly1305_avx512_x8(uint64_t h[3], const uint64_t powers[3 * 8], const uint8_t m[], size_t blocks) {
+   const uint64_t* p = powers;  // r^1..r^8
+
+   __m512i r8[3], s8[3], rl[3], sl[3], acc[3], msg[3];
+   for(size_t i = 0; i != 3; ++i) {
+      r8[i] = _mm512_set1_epi64(p[3 * 7 + i]);
+      s8[i] = _mm512_add_epi64(_mm512_slli_epi64(r8[i], 4), _mm512_slli_epi64(r8[i], 2));
+
+      // lane 0 holds the oldest block of the last step
+      rl[i] = _mm512_set_epi64(p[3 * 0 + i],
+                               p[3 * 1 + i],
+                               p[3 * 2 + i],
+                               p[3 * 3 + i],
+                               p[3 * 4 + i],
+                               p[3 * 5 + i],
+                               p[3 * 6 + i],
+                               p[3 * 7 + i]);
+      sl[i] = _mm512_add_epi64(_mm512_slli_epi64(rl[i], 4), _mm512_slli_epi64(rl[i], 2));
+   }
+
+   load_8x44(acc, m);
+   for(size_t i = 0; i != 3; ++i) {
+      acc[i] = _mm512_add_epi64(acc[i], _mm512_set_epi64(0, 0, 0, 0, 0, 0, 0, h[i]));
+   }
+
+   for(size_t b = 8; b != blocks; b += 8) {
+      mul_8x44(acc, r8, s8);
+      load_8x44(msg, m + 16 * b);
+      for(size_t i = 0; i != 3; ++i) {
+         acc[i] = _mm512_add_epi64(acc[i], msg[i]);
+      }
+   }
+
+   mul_8x44(acc, rl, sl);
+
+   uint64_t h0 = _mm512_reduce_add_epi64(acc[0]);
+   uint64_t h1 = _mm512_reduce_add_epi64(acc[1]);
+   uint64_t h2 = _mm512_reduce_add_epi64(acc[2]);
+
+   uint64_t c;
+   c = h0 >> 44;
+   h0 &= M44;
+   h1 += c;
+   c = h1 >> 44;
+   h1 &= M44;
+   h2 += c;
+   c = h2 >> 42;
+   h2 &= M42;
+   h0 += c * 5;
+   c = h0 >> 44;
+   h0 &= M44;
+   h1 += c;
+
+   h[0] = h0;
+   h[1] = h1;
+   h[2] = h2;
+
+   _mm256_zeroall();
+}
+
+}  // namespace Botan
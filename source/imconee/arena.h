@@ -22,8 +22,10 @@ template<size_t elsz, signed_t arsz, typename fallback> struct arena
 	bool here(const void* p) const
 	{
 		const u8* pp = (u8*)p;
+		if (pp < buf)
+			return false;
 		signed_t index = (pp - buf) / elsz;
-		if (index < 0 || index >= arsz)
+		if (index >= arsz)
 			return false;
 		return true;
 	}
@@ -48,6 +50,13 @@ template<size_t elsz, signed_t arsz, typename fallback> struct arena
 				_mm_pause();
 			}
 
+			if (unlockff >= arsz)
+			{
+				// exhausted while waiting for lock
+				spinlock::atomic_replace(ff, lockff, unlockff);
+				return fallback::alloc(sz);
+			}
+
 			int* nf = (int*)(buf + (elsz * unlockff));
 
 #ifdef _DEBUG
@@ -76,8 +85,10 @@ template<size_t elsz, signed_t arsz, typename fallback> struct arena
 	bool free(void* p)
 	{
 		u8* pp = (u8*)p;
+		if (pp < buf)
+			return false;
 		signed_t index = (pp - buf) / elsz;
-		if (index < 0 || index >= arsz)
+		if (index >= arsz)
 			return false;
 
 		spinlock::long3264 unlockff;
@@ -1,7 +1,7 @@
 #include "pch.h"
-#include "botan/internal/chacha20poly1305.h"
 #include "botan/internal/gcm.h"
 #include "botan/internal/aes.h"
+#include "botan/internal/aes_gcm.h"
 
 std::unique_ptr<Botan::Cipher_Mode> ss::make_chachapoly(bool enc)
 {
@@ -12,8 +12,22 @@ std::unique_ptr<Botan::Cipher_Mode> ss::make_chachapoly(bool enc)
 		return std::make_unique<Botan::ChaCha20Poly1305_Decryption>();
 	}
 }
+static std::unique_ptr<Botan::Cipher_Mode> make_aesgcm_stitched(size_t keylen, bool enc)
+{
+	// one pass of aes-ni/vaes rounds interleaved with clmul ghash instead of separate ctr and ghash passes
+	if (enc) {
+		return std::make_unique<Botan::AES_GCM_Encryption>(keylen);
+	}
+	else {
+		return std::make_unique<Botan::AES_GCM_Decryption>(keylen);
+	}
+}
+
 std::unique_ptr<Botan::Cipher_Mode> ss::make_aesgcm_128(bool enc)
 {
+	if (Botan::AES_GCM_Mode::available())
+		return make_aesgcm_stitched(16, enc);
+
 	auto bc = std::make_unique<Botan::AES_128>();
 
 	if (enc) {
@@ -25,6 +39,9 @@ std::unique_ptr<Botan::Cipher_Mode> ss::make_aesgcm_128(bool enc)
 }
 std::unique_ptr<Botan::Cipher_Mode> ss::make_aesgcm_192(bool enc)
 {
+	if (Botan::AES_GCM_Mode::available())
+		return make_aesgcm_stitched(24, enc);
+
 	auto bc = std::make_unique<Botan::AES_192>();
 
 	if (enc) {
@@ -38,6 +55,9 @@ std::unique_ptr<Botan::Cipher_Mode> ss::make_aesgcm_192(bool enc)
 
 std::unique_ptr<Botan::Cipher_Mode> ss::make_aesgcm_256(bool enc)
 {
+	if (Botan::AES_GCM_Mode::available())
+		return make_aesgcm_stitched(32, enc);
+
 	auto bc = std::make_unique<Botan::AES_256>();
 
 	if (enc) {
@@ -76,109 +96,277 @@ str::astr evpBytesToKey(unsigned keyLen, const str::astr& password)
 
 void deriveAeadSubkey(buffer &skey, unsigned length, const str::astr& masterKey, const std::span<const u8>& salt)
 {
-	std::unique_ptr<Botan::KDF> kdf = std::make_unique<Botan::HKDF>(std::make_unique<Botan::HMAC>(std::make_unique<Botan::SHA_1>()));
-	skey = kdf->derive_key(length, str2span(masterKey), salt, str2span(ASTR("ss-subkey")));
+	// hkdf-sha1 (rfc 5869) by hand on per-thread hmac: no kdf/hmac/hash objects per pipe
+	// (hmac keys are salt and prk, both new per pipe, so there are no pad states to keep per masterKey)
+	static thread_local Botan::HMAC hmac(std::make_unique<Botan::SHA_1>());
+	const str::astr_view info = ASTR("ss-subkey");
+	u8 prk[20], t[20];
+
+	hmac.set_key(salt); // extract
+	hmac.update(str2span(masterKey));
+	hmac.final(prk);
+
+	hmac.set_key(prk, sizeof(prk)); // expand
+	skey.resize(length);
+	for (unsigned from = 0, i = 1; from < length; from += sizeof(t), ++i)
+	{
+		if (i > 1)
+			hmac.update(t, sizeof(t));
+		hmac.update(str2span(info));
+		hmac.update((u8)i);
+		hmac.final(t);
+		memcpy(skey.data() + from, t, math::minv(sizeof(t), length - from));
+	}
+
+	Botan::secure_scrub_memory(prk, sizeof(prk));
+	Botan::secure_scrub_memory(t, sizeof(t));
 }
 
-std::unique_ptr<ss::core::cryptor> ss::core::make_aead_crypto_chachapoly()
+std::unique_ptr<ss::core::cryptor> ss::core::make_aead_crypto()
 {
-	return std::move(std::make_unique<aead_cryptor>(cp, ss::make_chachapoly));
+	return std::move(std::make_unique<aead_cryptor>(cp, modes));
 }
-std::unique_ptr<ss::core::cryptor> ss::core::make_aead_crypto_aesgcm_128()
+std::unique_ptr<ss::core::cryptor> ss::core::makeuncrypted()
 {
-	return std::move(std::make_unique<aead_cryptor>(cp, ss::make_aesgcm_128));
+	return std::move(std::make_unique<none_cryptor>());
 }
-std::unique_ptr<ss::core::cryptor> ss::core::make_aead_crypto_aesgcm_192()
+
+
+
+std::unique_ptr<Botan::Cipher_Mode> ss::mode_pool::get(bool enc)
 {
-	return std::move(std::make_unique<aead_cryptor>(cp, ss::make_aesgcm_192));
+	{
+		auto f = free[enc].lock_write();
+		if (!f().empty())
+		{
+			std::unique_ptr<Botan::Cipher_Mode> m = std::move(f().back());
+			f().pop_back();
+			return m;
+		}
+	}
+	return cb(enc);
 }
-std::unique_ptr<ss::core::cryptor> ss::core::make_aead_crypto_aesgcm_256()
+
+void ss::mode_pool::put(bool enc, std::unique_ptr<Botan::Cipher_Mode>&& mode)
 {
-	return std::move(std::make_unique<aead_cryptor>(cp, ss::make_aesgcm_256));
+	auto f = free[enc].lock_write();
+	if (f().size() < max_free)
+		f().push_back(std::move(mode));
 }
-std::unique_ptr<ss::core::cryptor> ss::core::makeuncrypted()
+
+void ss::aead::setup(std::unique_ptr<Botan::Cipher_Mode>&& m, std::span<const u8> k, unsigned NonceSize)
 {
-	return std::move(std::make_unique<none_cryptor>());
+	ASSERT(m != nullptr && NonceSize <= sizeof(iv));
+	mode = std::move(m);
+	mode->set_key(k);
+	granularity = mode->update_granularity();
+	multi = NonceSize == 12 ? dynamic_cast<Botan::ChaCha20Poly1305_Mode*>(mode.get()) : nullptr;
+	memset(iv, 0, sizeof(iv));
+	ivsize = (u8)NonceSize;
 }
 
+std::unique_ptr<Botan::Cipher_Mode> ss::aead::release()
+{
+	if (mode)
+		mode->clear();
+	multi = nullptr;
+	ivsize = 0;
+	return std::move(mode);
+}
 
+bool ss::aead::process(std::span<const record> recs, bool enc)
+{
+	if (multi)
+		return multi->process_records(recs);
 
-void ss::keyed_filter::setup(std::unique_ptr<Botan::Cipher_Mode>&& m, std::span<const u8> k, unsigned NonceSize, ss::cipher *ciph)
+	for (const record& r : recs)
+	{
+		mode->start(r.nonce, ivsize);
+		size_t whole = r.size - r.size % granularity;
+		if (whole > 0)
+			mode->process(r.buf, whole);
+		tail.assign(r.buf + whole, r.buf + r.size + (enc ? 0 : AEAD_TAG_SIZE));
+		try
+		{
+			mode->finish(tail);
+		}
+		catch (...)
+		{
+			return false; // tag mismatch
+		}
+		memcpy(r.buf + whole, tail.data(), tail.size()); // rest of data (and tag)
+	}
+	return true;
+}
+
+void ss::aead::seal(u8* data, size_t size)
 {
-	mode = std::move(m);
-	mode->set_key(k);
-	iv.resize(NonceSize);
-	iv.zeroise();
+	record r = { data, size, iv };
+	process(std::span(&r, 1), true);
+	nonceIncrement(iv, ivsize);
+}
 
-	ASSERT(m_next.size() == 1);
-	m_next[0] = ciph;
+bool ss::aead::open(u8* data, size_t size)
+{
+	record r = { data, size, iv };
+	if (!process(std::span(&r, 1), false))
+		return false;
+	nonceIncrement(iv, ivsize);
+	return true;
+}
 
+void ss::aead::enqueue(u8* data, size_t size)
+{
+	queue.recs.push_back({ data, size, nullptr });
+	queue.nonces.insert(queue.nonces.end(), iv, iv + ivsize);
+	nonceIncrement(iv, ivsize);
 }
 
-/*virtual*/ void ss::keyed_filter::write(const uint8_t input[], size_t input_length)
+void ss::aead::take_queue(batch& b)
 {
-	size_t idealg = mode->ideal_granularity();
-	size_t mfz = idealg + mode->minimum_final_size();
+	b.clear();
+	std::swap(b, queue);
+}
 
-	while (input_length >= mfz) {
+bool ss::aead::process_batch(batch& b, bool enc)
+{
+	for (size_t i = 0; i < b.recs.size(); ++i)
+		b.recs[i].nonce = b.nonces.data() + i * ivsize;
+	bool ok = process(b.recs, enc);
+	b.clear();
+	return ok;
+}
 
-		buf.assign(input, input + idealg);
-		mode->update(buf);
-		send(buf.data(), buf.size());
+ss::aead_set::aead_set(std::shared_ptr<mode_pool> modes, bool enc, std::span<const u8> k, unsigned NonceSize) :modes(modes), key(k.begin(), k.end()), NonceSize(NonceSize), enc(enc)
+{
+}
+
+ss::aead_set::~aead_set()
+{
+	auto i = idle.lock_write();
+	for (std::unique_ptr<aead>& a : i())
+		if (std::unique_ptr<Botan::Cipher_Mode> m = a->release())
+			modes->put(enc, std::move(m));
+}
 
-		input += idealg;
-		input_length -= idealg;
+bool ss::aead_set::process(aead::batch& b)
+{
+	std::unique_ptr<aead> a;
+	{
+		auto i = idle.lock_write();
+		if (!i().empty())
+		{
+			a = std::move(i().back());
+			i().pop_back();
+		}
+	}
+	if (!a)
+	{
+		a = std::make_unique<aead>();
+		a->setup(modes->get(enc), key, NonceSize);
 	}
 
-	if (input_length > 0)
-		buf.assign(input, input + input_length);
-	else
-		buf.clear();
+	bool ok = a->process_batch(b, enc);
+	idle.lock_write()().push_back(std::move(a));
+	return ok;
+}
 
+bool ss::crypto_sink::bind(netkit::WAITABLE w)
+{
+	const std::shared_ptr<netkit::waker>& cur = netkit::pipe_waiter::current_waker();
+	if (!cur)
+		return false;
+	{
+		auto r = t.lock_read();
+		if (r().wk == cur && r().w == w)
+			return true;
+	}
+	auto x = t.lock_write();
+	if (x().wk)
+		x().wk->forget(x().w); // pipe moved to another bridge worker
+	x().wk = cur;
+	x().w = w;
+	return true;
 }
 
-/*virtual*/ void ss::keyed_filter::end_msg()
+void ss::crypto_sink::unbind()
 {
-	mode->finish(buf);
-	send(buf.data(), buf.size());
-	incnonce();
+	auto x = t.lock_write();
+	if (x().wk)
+		x().wk->forget(x().w);
+	x().wk = nullptr;
+	x().w = NULL_WAITABLE;
 }
 
-void ss::cipher_enc::setup(std::span<const u8> key, unsigned NonceSize, cipher_builder cb)
+void ss::crypto_sink::notify()
 {
-	auto mode = cb(true);
-	ASSERT(mode != nullptr);
-	recoder.setup(std::move(mode), key, NonceSize, this);
+	auto r = t.lock_read();
+	if (r().wk)
+		r().wk->wake(r().w);
 }
 
-bool ss::cipher_enc::process(std::span<const u8> input, buffer&output)
+ss::crypto_pool* ss::crypto_pool::get()
 {
-    current_output = &output;
-	output.reserve(output.size() + input.size() + AEAD_TAG_SIZE);
-    size_t offset = output.size();
-	recoder.start_msg();
-    recoder.write(input.data(), input.size());
-    recoder.end_msg();
-    return output.size() > offset;
+	static crypto_pool* p = glb.cfg.crypto_threads > 0 ? new crypto_pool(glb.cfg.crypto_threads) : nullptr; // never deleted, like bridge pool
+	return p;
 }
 
-void ss::cipher_dec::setup(std::span<const u8> key, unsigned NonceSize, cipher_builder cb)
+ss::crypto_pool::crypto_pool(signed_t n)
 {
-	auto mode = cb(false);
-	ASSERT(mode != nullptr);
-	recoder.setup(std::move(mode), key, NonceSize, this);
+	for (signed_t i = 0; i < n; ++i)
+	{
+		std::thread th(&crypto_pool::work, this);
+		th.detach();
+	}
 }
 
-bool ss::cipher_dec::process(std::span<const u8> input, data_acceptor &output)
+void ss::crypto_pool::add(crypto_job* j)
 {
-	handled = 0;
-	current_output = &output;
-	recoder.start_msg();
-	recoder.write(input.data(), input.size());
-	recoder.end_msg();
-	return handled + AEAD_TAG_SIZE == input.size();
+	{
+		std::unique_lock<std::mutex> m(mut);
+		q.emplace(j);
+	}
+	cv.notify_one();
 }
 
+static size_t gather_payloads(u8* d, size_t size) // opened records [size][tag][payload][tag] -> payloads at start of d
+{
+	size_t plain = 0;
+	for (size_t i = 0; i < size;)
+	{
+		size_t payloadsize = netkit::to_he(*(u16*)(d + i));
+		i += sizeof(u16) + AEAD_TAG_SIZE;
+		memmove(d + plain, d + i, payloadsize);
+		plain += payloadsize;
+		i += payloadsize + AEAD_TAG_SIZE;
+	}
+	return plain;
+}
+
+void ss::crypto_pool::work()
+{
+	std::unique_lock<std::mutex> m(mut);
+	for (;;)
+	{
+		crypto_job* j;
+		if (!q.get(j))
+		{
+			cv.wait(m);
+			continue;
+		}
+		m.unlock();
+
+		j->ok = j->keys->process(j->recs);
+		if (j->ok && !j->keys->encrypts())
+			j->plain = gather_payloads(j->data.data(), j->used);
+
+		std::shared_ptr<crypto_sink> sink = j->sink; // pipe can take job as soon as it is done
+		j->done.store(true, std::memory_order_release);
+		sink->notify();
+
+		m.lock();
+	}
+}
 
 
 str::astr ss::core::load(loader& ldr, const str::astr& name, const asts& bb)
@@ -214,27 +402,32 @@ str::astr ss::core::load(loader& ldr, const str::astr& name, const asts& bb)
 	if (method == ASTR("xchacha20-ietf-poly1305"))
 	{
 		cp = { 32,24 };
-		cb = std::bind(&core::make_aead_crypto_chachapoly, this);
+		modes = std::make_shared<mode_pool>(ss::make_chachapoly);
+		cb = std::bind(&core::make_aead_crypto, this);
 	}
 	else if (method == ASTR("chacha20-ietf-poly1305"))
 	{
 		cp = { 32, 12 };
-		cb = std::bind(&core::make_aead_crypto_chachapoly, this);
+		modes = std::make_shared<mode_pool>(ss::make_chachapoly);
+		cb = std::bind(&core::make_aead_crypto, this);
 	}
 	else if (method == ASTR("aes-256-gcm"))
 	{
 		cp = { 32, 12 };
-		cb = std::bind(&core::make_aead_crypto_aesgcm_256, this);
+		modes = std::make_shared<mode_pool>(ss::make_aesgcm_256);
+		cb = std::bind(&core::make_aead_crypto, this);
 	}
 	else if (method == ASTR("aes-192-gcm"))
 	{
 		cp = { 24, 12 };
-		cb = std::bind(&core::make_aead_crypto_aesgcm_192, this);
+		modes = std::make_shared<mode_pool>(ss::make_aesgcm_192);
+		cb = std::bind(&core::make_aead_crypto, this);
 	}
 	else if (method == ASTR("aes-128-gcm"))
 	{
 		cp = { 16, 12 };
-		cb = std::bind(&core::make_aead_crypto_aesgcm_128, this);
+		modes = std::make_shared<mode_pool>(ss::make_aesgcm_128);
+		cb = std::bind(&core::make_aead_crypto, this);
 	}
 	else if (method == ASTR("none"))
 	{
@@ -247,18 +440,19 @@ str::astr ss::core::load(loader& ldr, const str::astr& name, const asts& bb)
 		return str::astr();
 	}
 
+	coalesce = bb.get_int(ASTR("coalesce-delay"), 0);
 	masterKey = evpBytesToKey(cp.KeySize, password);
 	return addr;
 }
 
-ss::core::crypto_pipe::crypto_pipe(netkit::pipe_ptr pipe, std::unique_ptr<cryptor> c, str::astr masterKey, crypto_par cp) :pipe(pipe), masterKey(masterKey), cp(cp)
+ss::core::crypto_pipe::crypto_pipe(netkit::pipe_ptr pipe, std::unique_ptr<cryptor> c, str::astr masterKey, crypto_par cp, signed_t coalesce) :pipe(pipe), coalesce(coalesce), masterKey(masterKey), cp(cp)
 {
-	randomgen rng;
-	encrypted_data.resize(cp.KeySize);
-	rng.random_vec(encrypted_data); // make initial salt as starting sequence
+	sealed = new netkit::shared_data();
+	sealed->data.resize(cp.KeySize);
+	randompool::get().fill(sealed->data); // make initial salt as starting sequence
 
 	buffer skey;
-	deriveAeadSubkey(skey, cp.KeySize, masterKey, encrypted_data);
+	deriveAeadSubkey(skey, cp.KeySize, masterKey, sealed->data);
 	c->init_encryptor(skey);
 	crypto = std::move(c);
 }
@@ -266,6 +460,148 @@ ss::core::crypto_pipe::crypto_pipe(netkit::pipe_ptr pipe, std::unique_ptr<crypto
 /*virtual*/ ss::core::crypto_pipe::~crypto_pipe()
 {
 	close(true);
+	settle(false);
+}
+
+ss::core::crypto_pipe::flow::~flow()
+{
+	for (crypto_job* j = spare; j;)
+	{
+		crypto_job* n = j->next;
+		delete j;
+		j = n;
+	}
+}
+
+bool ss::core::crypto_pipe::flow::offload(size_t sz)
+{
+	signed_t ct = chrono::ms();
+	if (bytes == 0)
+		window = ct;
+	bytes += sz;
+
+	if (signed_t dt = ct - window; dt >= 250)
+	{
+		size_t rate = bytes * 1000 / 1024 / dt; // KB/s
+		size_t threshold = glb.cfg.crypto_offload;
+		fast = fast ? rate * 2 >= threshold : rate >= threshold; // once fast, stays fast until speed drops twice
+		bytes = 0;
+	}
+
+	return fast || first != nullptr; // records can't overtake ones in jobs
+}
+
+ss::crypto_job* ss::core::crypto_pipe::flow::get_job(const std::shared_ptr<crypto_sink>& sink)
+{
+	crypto_job* j = spare;
+	if (j)
+		spare = j->next;
+	else
+		j = new crypto_job();
+	j->sink = sink;
+	j->next = nullptr;
+	j->used = 0;
+	j->plain = 0;
+	j->ok = true;
+	j->done.store(false, std::memory_order_relaxed);
+	return j;
+}
+
+void ss::core::crypto_pipe::flow::push(crypto_job* j)
+{
+	if (last)
+		last->next = j;
+	else
+		first = j;
+	last = j;
+	inflight += j->data.size();
+}
+
+ss::crypto_job* ss::core::crypto_pipe::flow::take()
+{
+	if (!ready())
+		return nullptr;
+	crypto_job* j = first;
+	first = j->next;
+	if (first == nullptr)
+		last = nullptr;
+	inflight -= j->data.size();
+	return j;
+}
+
+void ss::core::crypto_pipe::flow::recycle(crypto_job* j)
+{
+	j->next = spare;
+	spare = j;
+}
+
+void ss::core::crypto_pipe::flow::wait_first()
+{
+	while (first != nullptr && !ready())
+		Sleep(0);
+}
+
+bool ss::core::crypto_pipe::offload(flow& f, size_t sz)
+{
+	if (!crypto->can_offload())
+		return false;
+	if (!f.offload(sz))
+		return false;
+	if (!sink)
+		sink = std::make_shared<crypto_sink>();
+	return sink->bind(pipe->get_waitable()) || !f.is_empty(); // only bridge workers can be woken up by crypto workers
+}
+
+void ss::core::crypto_pipe::submit(flow& f, crypto_job* j)
+{
+	f.push(j);
+	crypto_pool::get()->add(j);
+}
+
+bool ss::core::crypto_pipe::deliver()
+{
+	bool ok = true;
+	for (; ok;)
+	{
+		// records of several done jobs go by one vectored send
+		crypto_job* done[netkit::tcp_pipe::max_iov];
+		std::span<const u8> parts[netkit::tcp_pipe::max_iov];
+		signed_t n = 0;
+		for (crypto_job* j; n < netkit::tcp_pipe::max_iov && (j = encf.take()) != nullptr; ++n)
+		{
+			done[n] = j;
+			parts[n] = std::span<const u8>(j->data.data(), j->data.size());
+		}
+		if (n == 0)
+			break;
+		ok = pipe->send(std::span<const std::span<const u8>>(parts, n)) != SEND_FAIL;
+		for (signed_t i = 0; i < n; ++i)
+			encf.recycle(done[i]);
+	}
+	for (crypto_job* j; ok && (j = decf.take()) != nullptr; decf.recycle(j))
+	{
+		ok = j->ok;
+		if (ok && j->plain > 0)
+			decrypted_data.append(std::span<const u8>(j->data.data(), j->plain));
+	}
+	return ok;
+}
+
+void ss::core::crypto_pipe::settle(bool flush)
+{
+	// workers still use buffers of jobs; sealed records are sent if flush
+	for (flow* f : { &encf, &decf })
+	{
+		for (crypto_job* j; !f->is_empty(); f->recycle(j))
+		{
+			f->wait_first();
+			j = f->take();
+			if (flush && f == &encf && pipe)
+				flush = pipe->send(j->data.data(), j->data.size()) != SEND_FAIL;
+		}
+	}
+	if (sink)
+		sink->unbind();
 }
 
 /*virtual*/ bool ss::core::crypto_pipe::alive()
@@ -281,16 +617,80 @@ ss::core::crypto_pipe::crypto_pipe(netkit::pipe_ptr pipe, std::unique_ptr<crypto
 	incdec ddd(busy, this);
 	if (ddd) return SEND_FAIL;
 
-	if (data == nullptr)
-		return pipe->send(nullptr, 0); // check allow send
+	if (!deliver())
+		return SEND_FAIL;
 
-	crypto->encipher(std::span<const u8>(data, datasize), encrypted_data);
-	sendrslt rslt = pipe->send(encrypted_data.data(), encrypted_data.size());
-	encrypted_data.clear(); // IMPORTANT: clear after send, not before (due encrypted_data contains salt before 1st send)
+	if (data == nullptr || datasize == 0)
+	{
+		if (flush_held(true) == SEND_FAIL)
+			return SEND_FAIL;
+		if (data == nullptr)
+			return encf.inflight > max_inflight ? SEND_BUFFERFULL : pipe->send(nullptr, 0); // check allow send
+		return pipe->send(data, 0); // just send unsent buffer; empty chunk must not be encrypted
+	}
 
+	if (coalesce > 0 && (!held.empty() || datasize < AEAD_CHUNK_SIZE_MASK) && encf.is_empty())
+	{
+		// small writes are collected into one record until it is full or coalesce time passes
+		if (held.empty())
+		{
+			const std::shared_ptr<netkit::waker>& wk = netkit::pipe_waiter::current_waker();
+			if (!wk)
+				return seal_send(data, datasize); // nobody can flush it later
+			if (flusher != wk)
+			{
+				forget_held();
+				flusher = wk;
+			}
+			held_until = chrono::us() + coalesce;
+			flusher->wake_at(pipe->get_waitable(), held_until);
+		}
+		held += std::span<const u8>(data, datasize);
+		if (held.size() < AEAD_CHUNK_SIZE_MASK)
+			return pipe->send(nullptr, 0);
+		return flush_held(false);
+	}
+
+	return seal_send(data, datasize);
+}
+
+netkit::pipe::sendrslt ss::core::crypto_pipe::seal_send(const u8* data, signed_t datasize)
+{
+	if (sealed->data.empty() && offload(encf, datasize))
+	{
+		// sealed by crypto worker; bridge worker only sends records when they are ready
+		crypto_job* j = encf.get_job(sink);
+		crypto->frame(std::span<const u8>(data, datasize), *j);
+		submit(encf, j);
+		return encf.inflight > max_inflight ? SEND_BUFFERFULL : pipe->send(nullptr, 0);
+	}
+
+	crypto->encipher(std::span<const u8>(data, datasize), sealed->data);
+	sendrslt rslt = pipe->send(netkit::slice(sealed, 0, sealed->data.size())); // lower pipe keeps unsent part by reference
+	if (sealed->is_multi_ref())
+		sealed = new netkit::shared_data(); // still used by lower pipe
+	else
+		sealed->data.clear(); // IMPORTANT: clear after send, not before (due sealed contains salt before 1st send)
+
+	return rslt;
+}
+
+netkit::pipe::sendrslt ss::core::crypto_pipe::flush_held(bool due)
+{
+	if (held.empty() || (due && held_until - chrono::us() > 0))
+		return SEND_OK;
+
+	sendrslt rslt = seal_send(held.data(), held.size());
+	held.clear();
 	return rslt;
 }
 
+void ss::core::crypto_pipe::forget_held()
+{
+	if (flusher && pipe)
+		flusher->forget(pipe->get_waitable());
+}
+
 /*virtual*/ signed_t ss::core::crypto_pipe::recv(u8* data, signed_t maxdatasz)
 {
 	if (!pipe)
@@ -303,27 +703,102 @@ ss::core::crypto_pipe::crypto_pipe(netkit::pipe_ptr pipe, std::unique_ptr<crypto
 
 	if (!crypto->is_decryptor_init())
 	{
-		signed_t rb = pipe->recv(temp, -(signed_t)cp.KeySize);
-		if (rb != cp.KeySize)
-			return -1;
+		if (maxdatasz < 0)
+		{
+			signed_t rb = pipe->recv(temp, -(signed_t)(cp.KeySize - salt.size()));
+			if (rb != (signed_t)(cp.KeySize - salt.size()))
+				return -1;
+			salt += std::span<const u8>(temp, rb);
+		}
+		else
+		{
+			// bridge worker serves other bridges too, so just take what already received
+			signed_t rb = pipe->recv(temp, cp.KeySize - salt.size());
+			if (rb < 0)
+				return -1;
+			salt += std::span<const u8>(temp, rb);
+			if (salt.size() < cp.KeySize)
+				return 0;
+		}
 
 		buffer skey;
-		deriveAeadSubkey(skey, cp.KeySize, masterKey, std::span<u8>(temp, cp.KeySize));
+		deriveAeadSubkey(skey, cp.KeySize, masterKey, salt);
 		crypto->init_decryptor(skey);
+		salt.clear();
 	}
 
+	if (!deliver())
+		return -1;
+	while (!decf.is_empty() && maxdatasz < 0)
+	{
+		// exact size is needed right now
+		decf.wait_first();
+		if (!deliver())
+			return -1;
+	}
+
+	// while jobs hold too much data (or socket is closed), it's left in socket; bridge mutes pipe (see recv_stalled) until sink wakes it up
+	if (maxdatasz >= 0 && (rcv_eof || decf.inflight > max_inflight) && decrypted_data.is_empty())
+		return (rcv_eof && decf.is_empty()) ? -1 : 0;
+
 	bool do_recv = decrypted_data.is_empty();
 	if (do_recv)
 		netkit::clear_ready(get_waitable(), READY_PIPE);
+
+	rcv_more = false;
+	if (do_recv && maxdatasz >= min_inplace && decf.is_empty())
+	{
+		// records are opened right in output buffer; only incomplete record is kept between calls
+		signed_t tail = crypto->take_tail(data, maxdatasz / 2);
+		if (tail >= 0)
+		{
+			signed_t sz = pipe->recv(data + tail, maxdatasz - tail);
+			if (sz < 0)
+				return sz;
+			rcv_more = sz == maxdatasz - tail;
+			if (sz > 0 && offload(decf, sz))
+			{
+				crypto_job* j = decf.get_job(sink);
+				signed_t rv = crypto->cut(*j, std::span<const u8>(data, tail + sz));
+				if (rv < 0 || j->recs.empty())
+					decf.recycle(j);
+				else
+					submit(decf, j);
+				return rv < 0 ? -1 : 0;
+			}
+			return tail + sz > 0 ? crypto->decipher(std::span<u8>(data, tail + sz)) : 0;
+		}
+	}
 	for (;; do_recv = true)
 	{
 		signed_t sz = do_recv ? pipe->recv(temp, sizeof(temp)) : 0;
 		if (sz < 0)
-			return sz;
+		{
+			if (maxdatasz < 0 || (decf.is_empty() && decrypted_data.is_empty()))
+				return sz;
+
+			// connection is closed, but data of jobs has to be passed on first; next recvs report close
+			rcv_eof = true;
+			break;
+		}
 
-		if (sz > 0)
+		if (sz > 0 && maxdatasz >= 0 && offload(decf, sz))
+		{
+			// opened by crypto worker; bridge worker only opens sizes to find records
+			crypto_job* j = decf.get_job(sink);
+			if (crypto->cut(*j, std::span<const u8>(temp, sz)) < 0)
+			{
+				decf.recycle(j);
+				return -1;
+			}
+			if (j->recs.empty())
+				decf.recycle(j); // no complete record yet
+			else
+				submit(decf, j);
+		}
+		else if (sz > 0)
 		{
-			signed_t d = crypto->decipher(decrypted_data, std::span<const u8>(temp, sz)); // try decrypt
+			signed_t d = crypto->decipher(decrypted_data, std::span<u8>(temp, sz)); // try decrypt
 			if (d < 0)
 				return -1;
 		}
@@ -367,8 +842,23 @@ ss::core::crypto_pipe::crypto_pipe(netkit::pipe_ptr pipe, std::unique_ptr<crypto
 	incdec ddd(busy, this);
 	if (ddd) return NULL_WAITABLE;
 
+	if (!held.empty())
+	{
+		flush_held(true); // waiter was woken at held_until; failure is reported by next send
+		const std::shared_ptr<netkit::waker>& wk = netkit::pipe_waiter::current_waker();
+		if (!held.empty() && wk && flusher != wk)
+		{
+			// pipe is moved to another bridge worker
+			forget_held();
+			flusher = wk;
+			flusher->wake_at(pipe->get_waitable(), held_until);
+		}
+	}
+
 	auto r = pipe->get_waitable();
-	if (!decrypted_data.is_empty())
+	if (!encf.is_empty() || !decf.is_empty())
+		sink->bind(r); // pipe may be moved to another bridge worker
+	if (!decrypted_data.is_empty() || rcv_more || encf.ready() || decf.ready())
 		netkit::make_ready(r, READY_PIPE);
 	else
 		netkit::clear_ready(r, READY_PIPE);
@@ -379,150 +869,197 @@ ss::core::crypto_pipe::crypto_pipe(netkit::pipe_ptr pipe, std::unique_ptr<crypto
 	bool io = spinlock::increment_by(busy, 10001) > 0;
 	if (!io)
 	{
+		if (flush_before_close)
+			flush_held(false);
+		forget_held();
+		settle(flush_before_close);
 		pipe->close(flush_before_close);
 		pipe = nullptr;
 	}
 }
 
 
+ss::core::aead_cryptor::~aead_cryptor()
+{
+	if (std::unique_ptr<Botan::Cipher_Mode> m = encryptor.release())
+		modes->put(true, std::move(m));
+	if (std::unique_ptr<Botan::Cipher_Mode> m = decryptor.release())
+		modes->put(false, std::move(m));
+}
+
 /*virtual*/ void ss::core::aead_cryptor::init_encryptor(std::span<const u8> key)
 {
-	encryptor.setup(key, pars.NonceSize, cb);
+	encryptor.setup(modes->get(true), key, pars.NonceSize);
+	if (crypto_pool::get())
+		enckeys = std::make_shared<aead_set>(modes, true, key, pars.NonceSize);
 }
 
 /*virtual*/ void ss::core::aead_cryptor::init_decryptor(std::span<const u8> key)
 {
-	decryptor.setup(key, pars.NonceSize, cb);
+	decryptor.setup(modes->get(false), key, pars.NonceSize);
+	if (crypto_pool::get())
+		deckeys = std::make_shared<aead_set>(modes, false, key, pars.NonceSize);
 }
 
-/*virtual*/ signed_t ss::core::aead_cryptor::encipher(std::span<const u8> plain, buffer& cipher)
+static size_t framed_size(size_t plain)
 {
-	u16 inLen = (u16)(0xffff & (plain.size() > AEAD_CHUNK_SIZE_MASK ? AEAD_CHUNK_SIZE_MASK : plain.size()));
-	u16 size_be = netkit::to_ne(inLen);
-
-	auto encode = [this, &cipher](const u8* d, size_t sz)
-		{
-			encryptor.process(std::span<const u8>(d, sz), cipher);
-		};
-
-	// size block encode
-	encode(reinterpret_cast<const u8*>(&size_be), sizeof(size_be));
-	// payload block encode
-	encode(plain.data(), inLen);
-
-	if (inLen < plain.size()) {
-		// Append the remaining part recursively if there is any
-		encipher(std::span(plain.data() + inLen, plain.size() - inLen), cipher);
-	}
-	return inLen;
+	size_t numchunks = (plain + AEAD_CHUNK_SIZE_MASK - 1) / AEAD_CHUNK_SIZE_MASK;
+	return plain + numchunks * (sizeof(u16) + AEAD_TAG_SIZE * 2);
 }
 
-namespace
+void ss::core::aead_cryptor::frame(std::span<const u8> plain, u8* out)
 {
-	struct u16acpt : public ss::data_acceptor
+	// each chunk is [size][tag][payload][tag]
+	for (const u8* in = plain.data(), *end = in + plain.size(); in < end;)
 	{
-		u16 data;
-		/*virtual*/ void handle(const uint8_t input[], size_t size) override
-		{
-			ASSERT(size == sizeof(data));
-			data = *(u16 *)input;
-		}
-	};
-
-	struct chb_acpt : public ss::data_acceptor
-	{
-		ss::outbuffer* b;
-		chb_acpt(ss::outbuffer* b) :b(b) {}
-		/*virtual*/ void handle(const uint8_t input[], size_t size) override
-		{
-			b->append(std::span(input, size));
-		}
-	};
+		u16 inLen = (u16)std::min((size_t)(end - in), (size_t)AEAD_CHUNK_SIZE_MASK);
+		*(u16*)out = netkit::to_ne(inLen);
+		encryptor.enqueue(out, sizeof(u16));
+		out += sizeof(u16) + AEAD_TAG_SIZE;
+
+		memcpy(out, in, inLen);
+		encryptor.enqueue(out, inLen);
+		out += inLen + AEAD_TAG_SIZE;
+		in += inLen;
+	}
 }
 
-/*virtual*/ signed_t ss::core::aead_cryptor::decrypt(size_t& from, outbuffer& plain)
+/*virtual*/ signed_t ss::core::aead_cryptor::encipher(std::span<const u8> plain, buffer& cipher)
 {
-	auto decode = [this](signed_t skip, data_acceptor &out, size_t capacity) -> size_t
-	{
-		if ((unprocessed.size() - skip) < capacity + AEAD_TAG_SIZE)
-			return 0;
-
-		decryptor.process(std::span<const u8>(unprocessed.data() + skip, capacity + AEAD_TAG_SIZE), out);
-		return capacity + AEAD_TAG_SIZE;
-	};
+	// all records are sealed right in output buffer by one batch
+	size_t offset = cipher.size();
+	cipher.resize(offset + framed_size(plain.size()));
+	frame(plain, cipher.data() + offset);
+	encryptor.seal_queue();
+	return plain.size();
+}
 
-	size_t from_current = from;
+/*virtual*/ void ss::core::aead_cryptor::frame(std::span<const u8> plain, crypto_job& j)
+{
+	j.keys = enckeys;
+	j.data.resize(framed_size(plain.size()));
+	frame(plain, j.data.data());
+	encryptor.take_queue(j.recs);
+}
 
-	size_t payloadsize = last_block_payload_size;
-	if (last_block_payload_size > 0)
-	{
-		ASSERT(from_current == 0);
-		from_current = 2 + 16;
-	}
-	else
+signed_t ss::core::aead_cryptor::open_sizes(u8* d, size_t sz, size_t& from)
+{
+	// sizes have to be opened one by one to find next record
+	from = 0;
+	signed_t decr = 0;
+	for (;;)
 	{
-		try
+		if (pending_payload < 0)
 		{
-			u16acpt payloadsize_network_endian;
-			size_t delta = decode(from_current, payloadsize_network_endian, sizeof(u16));
-			if (delta == 0)
-				return 0; // not yet ready data
-			from_current += delta;
-			payloadsize = netkit::to_he(payloadsize_network_endian.data);
+			if (sz - from < sizeof(u16) + AEAD_TAG_SIZE)
+				break; // not yet ready data
+			if (!decryptor.open(d + from, sizeof(u16)))
+				return -1;
+			size_t payloadsize = netkit::to_he(*(u16*)(d + from));
 			if (payloadsize > AEAD_CHUNK_SIZE_MASK)
 				return -1; // looks like chunk size is corrupted or wrong decrypted
-			last_block_payload_size = payloadsize; // keep payloadsize in case of incomplete data because we have already increased IV
-		}
-		catch (...)
-		{
-			return -1;
+			pending_payload = payloadsize; // nonce is already increased, so keep size until payload is complete
 		}
-	}
 
-	ASSERT(payloadsize > 0);
-	if (payloadsize + AEAD_TAG_SIZE > (unprocessed.size() - from_current))
-		return 0; // not yet ready data
+		size_t payload = from + sizeof(u16) + AEAD_TAG_SIZE;
+		if (sz - payload < (size_t)pending_payload + AEAD_TAG_SIZE)
+			break; // not yet ready data
 
-	chb_acpt acpt(&plain);
+		decryptor.enqueue(d + payload, pending_payload);
+		decr += pending_payload;
+		from = payload + pending_payload + AEAD_TAG_SIZE;
+		pending_payload = -1;
+	}
+	return decr;
+}
 
-	from_current += decode(from_current, acpt, payloadsize);
-	from = from_current;
-	return payloadsize;
+/*virtual*/ signed_t ss::core::aead_cryptor::cut(crypto_job& j, std::span<const u8> cipher)
+{
+	// incomplete record of previous call goes first
+	j.keys = deckeys;
+	j.data.resize(unprocessed.size() + cipher.size());
+	memcpy(j.data.data(), unprocessed.data(), unprocessed.size());
+	memcpy(j.data.data() + unprocessed.size(), cipher.data(), cipher.size());
+	unprocessed.clear();
+
+	signed_t decr = open_sizes(j.data.data(), j.data.size(), j.used);
+	if (decr < 0)
+		return -1;
+	decryptor.take_queue(j.recs);
+
+	if (j.used < j.data.size())
+		unprocessed += std::span<const u8>(j.data.data() + j.used, j.data.size() - j.used);
+	return decr;
 }
 
-/*virtual*/ signed_t ss::core::aead_cryptor::decipher(outbuffer& plain, std::span<const u8> cipher)
+/*virtual*/ signed_t ss::core::aead_cryptor::decipher(outbuffer& plain, std::span<u8> cipher)
 {
-	unprocessed += cipher;
+	// records are opened in place: in received data, or in unprocessed if there is incomplete record from previous call
+	// complete payloads are opened by one batch
+	u8* d = cipher.data();
+	size_t sz = cipher.size();
+	bool tail = unprocessed.size() > 0;
+	if (tail)
+	{
+		unprocessed += cipher;
+		d = unprocessed.data();
+		sz = unprocessed.size();
+	}
 
-	size_t from = 0;
-	signed_t decr = 0;
-	for (size_t usz = unprocessed.size(); from < usz;)
+	size_t from;
+	signed_t decr = open_sizes(d, sz, from);
+	if (decr < 0)
+		return -1;
+
+	if (from > 0)
 	{
-		signed_t d = decrypt(from, plain);
-		if (d < 0)
+		if (!decryptor.open_queue())
 			return -1;
-		if (d == 0)
-			break;
-		last_block_payload_size = 0;
-		decr += d;
+		for (size_t i = 0; i < from;) // sizes are already plain
+		{
+			size_t payloadsize = netkit::to_he(*(u16*)(d + i));
+			i += sizeof(u16) + AEAD_TAG_SIZE;
+			plain.append(std::span<const u8>(d + i, payloadsize));
+			i += payloadsize + AEAD_TAG_SIZE;
+		}
 	}
 
-	if (decr > 0)
+	if (tail)
 	{
-		if (from == unprocessed.size())
-		{
+		if (from == sz)
 			unprocessed.clear();
-		}
 		else
-		{
-			if (from == 0 && unprocessed.size() > AEAD_CHUNK_SIZE_MASK)
-			{
-				// looks like data corrupt: decryptor can't process data
-				return -1;
-			}
 			unprocessed.erase(from);
-		}
 	}
+	else if (from < sz)
+		unprocessed += std::span<const u8>(d + from, sz - from);
 
 	return decr;
 }
+
+/*virtual*/ signed_t ss::core::aead_cryptor::take_tail(u8* out, size_t capacity)
+{
+	size_t sz = unprocessed.size();
+	if (sz > capacity)
+		return -1;
+	memcpy(out, unprocessed.data(), sz);
+	unprocessed.clear();
+	return sz;
+}
+
+/*virtual*/ signed_t ss::core::aead_cryptor::decipher(std::span<u8> cipher)
+{
+	// unprocessed is empty here (see take_tail), so only incomplete record at end is copied
+	u8* d = cipher.data();
+	size_t from;
+	signed_t decr = open_sizes(d, cipher.size(), from);
+	if (decr < 0)
+		return -1;
+
+	if (from < cipher.size())
+		unprocessed += std::span<const u8>(d + from, cipher.size() - from);
+	if (from > 0 && !decryptor.open_queue())
+		return -1;
+
+	return gather_payloads(d, from);
+}
@@ -1,5 +1,7 @@
 #pragma once
 
+#include "botan/internal/chacha20poly1305.h"
+
 #define AEAD_CHUNK_SIZE_MASK 0x3FFF
 #define AEAD_TAG_SIZE 16
 
@@ -25,82 +27,122 @@ namespace ss
 	std::unique_ptr<Botan::Cipher_Mode> make_aesgcm_192(bool enc);
 	std::unique_ptr<Botan::Cipher_Mode> make_aesgcm_256(bool enc);
 
-	class cipher;
-	class keyed_filter : public Botan::Keyed_Filter
+	class mode_pool // modes of closed pipes; new pipes rekey them instead of building cipher, key schedule and tables anew
 	{
-		std::unique_ptr<Botan::Cipher_Mode> mode;
-		buffer iv;
-		buffer buf;
-		void incnonce()
+		static constexpr size_t max_free = 256; // per direction
+
+		cipher_builder cb;
+		spinlock::syncvar<std::vector<std::unique_ptr<Botan::Cipher_Mode>>> free[2]; // [enc]
+
+	public:
+		mode_pool(cipher_builder cb) :cb(cb) {}
+
+		std::unique_ptr<Botan::Cipher_Mode> get(bool enc);
+		void put(bool enc, std::unique_ptr<Botan::Cipher_Mode>&& mode); // mode is already cleared
+	};
+
+	class aead // seals and opens records in place: [data][tag]; each record uses next nonce
+	{
+	public:
+		using record = Botan::ChaCha20Poly1305_Mode::Record;
+
+		struct batch // queued records and their reserved nonces
 		{
-			nonceIncrement(iv.data(), iv.size());
-		}
+			std::vector<record> recs;
+			std::vector<u8> nonces;
+
+			bool empty() const { return recs.empty(); }
+			void clear()
+			{
+				recs.clear();
+				nonces.clear();
+			}
+		};
+
+	private:
+		std::unique_ptr<Botan::Cipher_Mode> mode;
+		Botan::ChaCha20Poly1305_Mode* multi = nullptr; // mode processes several records per call (chacha20-ietf-poly1305)
+		Botan::secure_vector<u8> tail; // last incomplete block of record and tag (mode processes whole blocks in place)
+		batch queue; // waits for seal_queue/open_queue
+		size_t granularity = 1;
+		u8 iv[24];
+		u8 ivsize = 0;
+
+		bool process(std::span<const record> recs, bool enc);
 
 	public:
-		keyed_filter() {}
+		aead() {}
 
-		bool is_init() const { return iv.size() != 0; }
-		void setup(std::unique_ptr<Botan::Cipher_Mode>&& mode, std::span<const u8> key, unsigned NonceSize, cipher* ciph);
+		bool is_init() const { return ivsize != 0; }
+		void setup(std::unique_ptr<Botan::Cipher_Mode>&& mode, std::span<const u8> key, unsigned NonceSize);
+		std::unique_ptr<Botan::Cipher_Mode> release(); // forget key and give mode back; nullptr if not set up
 
-		/*virtual*/ void set_key(const Botan::SymmetricKey& /*key*/) override {}
-		/*virtual*/ Botan::Key_Length_Specification key_spec() const override { return mode->key_spec(); }
-		/*virtual*/ bool valid_iv_length(size_t /*length*/) const override { return true; }
+		void seal(u8* data, size_t size); // encrypts size bytes and writes tag after them (caller provides AEAD_TAG_SIZE bytes of space)
+		bool open(u8* data, size_t size); // decrypts size bytes if tag after them matches; returns false if not
 
-		/*virtual*/ str::astr name() const override { return mode->name(); };
-		/*virtual*/ void write(const uint8_t input[], size_t input_length) override;
-		/*virtual*/ void start_msg() override { mode->start(iv); }
-		/*virtual*/ void end_msg() override;
+		void enqueue(u8* data, size_t size); // reserve next nonce for record; data is processed by seal_queue/open_queue
+		void seal_queue() { process_batch(queue, true); }
+		bool open_queue() { return process_batch(queue, false); } // false if any queued record is corrupted
+		void take_queue(batch& b); // queued records go to b; other aead with same key processes them (see aead_set)
+		bool process_batch(batch& b, bool enc); // b is cleared; false if any record is corrupted
 	};
 
-	class cipher : public Botan::Filter
+	class aead_set // aeads with same key: crypto workers process records of one pipe direction on several cores at once
 	{
-		keyed_filter recoder;
+		std::shared_ptr<mode_pool> modes;
+		buffer key;
+		unsigned NonceSize;
+		bool enc;
+		spinlock::syncvar<std::vector<std::unique_ptr<aead>>> idle; // keyed ones not used by workers now
+
 	public:
-		cipher() {}
-		/*virtual*/ str::astr name() const override { return recoder.name(); };
+		aead_set(std::shared_ptr<mode_pool> modes, bool enc, std::span<const u8> key, unsigned NonceSize);
+		~aead_set();
+
+		bool encrypts() const { return enc; }
+		bool process(aead::batch& b); // any thread; false if any record is corrupted
 	};
 
-	class cipher_enc : public cipher
+	class crypto_sink // bridge worker that waits for jobs of pipe; shared by pipe and its jobs
 	{
+		struct target
+		{
+			std::shared_ptr<netkit::waker> wk;
+			netkit::WAITABLE w = NULL_WAITABLE;
+		};
+		spinlock::syncvar<target> t;
 
-		keyed_filter recoder;
-		buffer* current_output = nullptr; // valid only in process method
 	public:
-		cipher_enc() {}
-		void setup(std::span<const u8> key, unsigned NonceSize, cipher_builder cb);
-		bool process(std::span<const u8> input, buffer& output);
-
-		/*virtual*/ void write(const uint8_t input[], size_t length) override
-		{
-			size_t offset = current_output->size();
-			current_output->resize(offset + length);
-			memcpy(current_output->data() + offset, input, length);
-		}
+		bool bind(netkit::WAITABLE w); // thread of pipe: done jobs wake its waiter up; returns false if thread has no waiter
+		void unbind(); // pipe is going to be closed
+		void notify(); // crypto worker: job is done
 	};
 
-	struct data_acceptor
+	struct crypto_job // records of one send or recv of fast pipe; crypto worker seals or opens them
 	{
-		virtual void handle(const uint8_t input[], size_t size) = 0;
+		std::shared_ptr<aead_set> keys;
+		std::shared_ptr<crypto_sink> sink;
+		buffer data; // records; opened payloads are moved to start
+		aead::batch recs;
+		size_t used = 0; // opening: size of complete records at start of data
+		size_t plain = 0; // opening: size of payloads at start of data when done
+		crypto_job* next = nullptr; // next job of same pipe direction
+		std::atomic<bool> done = false;
+		bool ok = true;
 	};
 
-	class cipher_dec : public cipher
+	class crypto_pool // threads that seal and open records of fast pipes, so one pipe can use several cores; order of records is kept by pipes
 	{
+		std::mutex mut;
+		std::condition_variable cv;
+		tools::fifo<crypto_job*> q;
 
-		keyed_filter recoder;
-		data_acceptor *current_output; // valid only in process method
-		size_t handled;
-	public:
-		cipher_dec() {}
+		crypto_pool(signed_t n);
+		void work();
 
-		bool is_init() const { return recoder.is_init(); }
-		void setup(std::span<const u8> key, unsigned NonceSize, cipher_builder cb);
-		bool process(std::span<const u8> input, data_acceptor &output);
-
-		/*virtual*/ void write(const uint8_t input[], size_t length) override
-		{
-			current_output->handle(input, length);
-			handled += length;
-		}
+	public:
+		static crypto_pool* get(); // nullptr if there are no crypto workers (see crypto_threads setting)
+		void add(crypto_job* j);
 	};
 
 	using outbuffer = tools::chunk_buffer<16384>;
@@ -134,7 +176,16 @@ namespace ss
 			virtual void init_encryptor(std::span<const u8> /*key*/) {}
 			virtual void init_decryptor(std::span<const u8> /*key*/) {}
 			virtual signed_t encipher(std::span<const u8> plain, buffer& cipher) = 0;
-			virtual signed_t decipher(outbuffer& plain, std::span<const u8> cipher) = 0;
+			virtual signed_t decipher(outbuffer& plain, std::span<u8> cipher) = 0; // decrypts in place (cipher is clobbered)
+
+			// same, but plain goes to start of cipher: caller puts incomplete record of previous call (take_tail) before received data
+			virtual signed_t take_tail(u8* /*out*/, size_t /*capacity*/) { return -1; } // moves incomplete record to out; -1 if it doesn't fit
+			virtual signed_t decipher(std::span<u8> cipher) = 0; // returns size of plain at start of cipher or -1
+
+			// same, but crypto worker seals or opens records of job; only for cryptors that can_offload
+			virtual bool can_offload() const { return false; }
+			virtual void frame(std::span<const u8> /*plain*/, crypto_job& /*j*/) {} // lays plain out as records and reserves their nonces
+			virtual signed_t cut(crypto_job& /*j*/, std::span<const u8> /*cipher*/) { return -1; } // opens sizes; complete records go to job, rest waits for next cut; returns size of their payloads or -1
 
 			const crypto_par& getPars() const { return pars; };
 		};
@@ -153,11 +204,13 @@ namespace ss
 				cipher.assign(plain.begin(), plain.end());
 				return cipher.size();
 			}
-			/*virtual*/ signed_t decipher(outbuffer& plain, std::span<const u8> cipher)
+			/*virtual*/ signed_t decipher(outbuffer& plain, std::span<u8> cipher)
 			{
 				plain.assign(cipher);
 				return cipher.size();
 			}
+			/*virtual*/ signed_t take_tail(u8* /*out*/, size_t /*capacity*/) { return 0; }
+			/*virtual*/ signed_t decipher(std::span<u8> cipher) { return cipher.size(); }
 		};
 
 		struct skip_buf : public buffer
@@ -192,36 +245,44 @@ namespace ss
 		{
 		protected:
 
-			ss::cipher_builder cb;
-			ss::cipher_enc encryptor;
-			ss::cipher_dec decryptor;
-			skip_buf unprocessed;
-			size_t last_block_payload_size = 0;
+			std::shared_ptr<mode_pool> modes; // shared with core: pipes may outlive their proxy or handler
+			ss::aead encryptor;
+			ss::aead decryptor;
+			std::shared_ptr<aead_set> enckeys, deckeys; // for crypto workers (if there are ones)
+			skip_buf unprocessed; // incomplete record
+			signed_t pending_payload = -1; // size of payload of first unprocessed record, if its size block is already opened
 
-			/*virtual*/ signed_t decrypt(size_t& from, outbuffer& plain);
+			void frame(std::span<const u8> plain, u8* out); // out has place for records; they are queued in encryptor
+			signed_t open_sizes(u8* d, size_t sz, size_t& from); // queues payloads of complete records in decryptor; from - end of them; returns their size or -1
 
 		public:
-			aead_cryptor(crypto_par p, ss::cipher_builder cb) :cryptor(p), cb(cb) {}
+			aead_cryptor(crypto_par p, std::shared_ptr<mode_pool> modes) :cryptor(p), modes(modes) {}
+			~aead_cryptor();
 
 			/*virtual*/ bool is_decryptor_init() const { return decryptor.is_init(); }
 
 			/*virtual*/ void init_encryptor(std::span<const u8> key);
 			/*virtual*/ void init_decryptor(std::span<const u8> key);
 			/*virtual*/ signed_t encipher(std::span<const u8> plain, buffer& cipher);
-			/*virtual*/ signed_t decipher(outbuffer& plain, std::span<const u8> cipher);
+			/*virtual*/ signed_t decipher(outbuffer& plain, std::span<u8> cipher);
+			/*virtual*/ signed_t take_tail(u8* out, size_t capacity);
+			/*virtual*/ signed_t decipher(std::span<u8> cipher);
+
+			/*virtual*/ bool can_offload() const { return enckeys && deckeys; }
+			/*virtual*/ void frame(std::span<const u8> plain, crypto_job& j);
+			/*virtual*/ signed_t cut(crypto_job& j, std::span<const u8> cipher);
 		};
 
 		using cryptobuilder = std::function<std::unique_ptr<cryptor>(void)>;
 
-		std::unique_ptr<cryptor> make_aead_crypto_chachapoly();
-		std::unique_ptr<cryptor> make_aead_crypto_aesgcm_256();
-		std::unique_ptr<cryptor> make_aead_crypto_aesgcm_192();
-		std::unique_ptr<cryptor> make_aead_crypto_aesgcm_128();
+		std::unique_ptr<cryptor> make_aead_crypto();
 		static std::unique_ptr<cryptor> makeuncrypted();
 
 		str::astr masterKey;
 		crypto_par cp;
 		cryptobuilder cb;
+		std::shared_ptr<mode_pool> modes; // cipher modes of method
+		signed_t coalesce = 0; // us; small writes of pipes are collected into one record for this time; 0 - each write is sent at once
 
 	public:
 
@@ -239,19 +300,60 @@ namespace ss
 				}
 			};
 
+			struct flow // one direction of pipe; its records go to crypto workers while it is fast
+			{
+				crypto_job* first = nullptr; // jobs in order of records; done ones are passed on from first
+				crypto_job* last = nullptr;
+				crypto_job* spare = nullptr; // passed on ones; reused
+				size_t inflight = 0; // bytes of jobs
+				signed_t window = 0; // ms; start of rate window
+				size_t bytes = 0; // passed in window
+				bool fast = false;
+
+				~flow();
+				bool offload(size_t sz); // counts sz bytes; true if they have to go to crypto workers
+				crypto_job* get_job(const std::shared_ptr<crypto_sink>& sink);
+				void push(crypto_job* j);
+				crypto_job* take(); // done first job or nullptr; caller returns it by recycle
+				void recycle(crypto_job* j);
+				void wait_first();
+				bool is_empty() const { return first == nullptr; }
+				bool ready() const { return first != nullptr && first->done.load(std::memory_order_acquire); }
+			};
+
+			static constexpr size_t max_inflight = 512 * 1024; // per direction
+			static constexpr signed_t min_inplace = 2 * (AEAD_CHUNK_SIZE_MASK + sizeof(u16) + AEAD_TAG_SIZE * 2); // smaller recv goes via decrypted_data
+
 			volatile spinlock::long3264 busy = 0;
 			netkit::pipe_ptr pipe;
+			flow encf, decf;
+			std::shared_ptr<crypto_sink> sink;
 
 			std::unique_ptr<cryptor> crypto;
-			buffer encrypted_data;
+			netkit::shared_data_ptr sealed; // records for lower pipe; replaced while it holds them
+			buffer salt; // incoming salt collected by parts (bridge never waits for it)
 			outbuffer decrypted_data;
+			bool rcv_more = false; // last recv filled output buffer; underlying pipe can still have buffered data
+			bool rcv_eof = false; // underlying pipe closed, but data of jobs is not yet passed on; next recvs report close
+			signed_t coalesce; // see core::coalesce
+			buffer held; // plain of small writes that go as one record
+			signed_t held_until = 0; // chrono::us; held is sent after that
+			std::shared_ptr<netkit::waker> flusher; // wakes bridge worker at held_until
 			str::astr masterKey;
 			ss::cipher_builder cb;
 			crypto_par cp;
 			friend class proxy_shadowsocks;
 
+			bool offload(flow& f, size_t sz); // see flow::offload
+			void submit(flow& f, crypto_job* j);
+			bool deliver(); // passes done jobs on in order; false if pipe failed
+			void settle(bool flush); // waits for all jobs
+			sendrslt seal_send(const u8* data, signed_t datasize);
+			sendrslt flush_held(bool due); // only if held_until passed, if due
+			void forget_held();
+
 		public:
-			crypto_pipe(netkit::pipe_ptr pipe, std::unique_ptr<cryptor> c, str::astr masterKey, crypto_par cp);
+			crypto_pipe(netkit::pipe_ptr pipe, std::unique_ptr<cryptor> c, str::astr masterKey, crypto_par cp, signed_t coalesce = 0);
 			/*virtual*/ ~crypto_pipe();
 
 			/*virtual*/ bool alive() override;
@@ -259,6 +361,11 @@ namespace ss
 			/*virtual*/ signed_t recv(u8* data, signed_t maxdatasz) override;
 			/*virtual*/ netkit::WAITABLE get_waitable() override;
 			/*virtual*/ void close(bool flush_before_close) override;
+			/*virtual*/ signed_t queued() const override { return held.size() + encf.inflight + (pipe ? pipe->queued() : 0); }
+			/*virtual*/ bool recv_stalled() const override
+			{
+				return decrypted_data.is_empty() && !decf.ready() && (rcv_eof || decf.inflight > max_inflight || (pipe && pipe->recv_stalled()));
+			}
 
 		};
 
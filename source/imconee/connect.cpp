@@ -49,27 +49,29 @@ namespace conn
 		return port > 0;
 	}
 
-	netkit::pipe* connect(netkit::endpoint& addr)
+	netkit::pipe* connect(netkit::endpoint& addr, signed_t timeout, netkit::connect_result* cr)
 	{
-		if (addr.state() == netkit::EPS_DOMAIN)
-			addr.resolve_ip(glb.cfg.ipstack | conf::gip_any | conf::gip_log_it);
+		if (cr) *cr = netkit::CR_FAILED;
 
-		if (addr.state() == netkit::EPS_RESLOVED)
-		{
-
-			netkit::tcp_pipe* con = new netkit::tcp_pipe();
-			con->set_address(addr);
+		std::vector<netkit::ipap> ips;
+		if (!addr.resolve_all(ips, glb.cfg.ipstack | conf::gip_log_it))
+			return nullptr;
 
-			//if (addr.domain() != "play.google.com")
-				//return nullptr;
+		//if (addr.domain() != "play.google.com")
+			//return nullptr;
 
-			if (con->connect())
-				return con;
-			delete con;
-			return nullptr;
+		netkit::tcp_connector c(std::move(ips), timeout);
+		std::vector<pollfd> pfds;
+		while (c.step())
+		{
+			pfds.clear();
+			c.add_polls(pfds);
+			if (netkit::poll_sockets(pfds.data(), pfds.size(), c.wait_time()) > 0)
+				c.polled(pfds.data());
 		}
 
-		return nullptr;
+		if (cr) *cr = c.result();
+		return c.take();
 	}
 
 } // namespace conn
@@ -3,6 +3,6 @@
 namespace conn
 {
 	bool is_valid_addr(const str::astr_view& a_raw); // check string match to {tcp://domain_or_ipv4:port}
-	netkit::pipe* connect(netkit::endpoint& addr);
+	netkit::pipe* connect(netkit::endpoint& addr, signed_t timeout, netkit::connect_result* cr = nullptr); // blocks; timeout in ms (0 - until kernel gives up)
 }
 
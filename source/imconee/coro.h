@@ -0,0 +1,168 @@
+#pragma once
+
+namespace netkit
+{
+	struct co_context // chain of suspended coroutines; driver (bridge worker or co_run) resumes it when awaited event happens
+	{
+		enum waitfor : u8
+		{
+			CW_NONE, // not suspended (done, if resumed)
+			CW_READ, // pipe has data to read
+			CW_WRITE, // pipe has sent its buffered data
+			CW_CONNECT, // driver connects to target and puts connection into connected
+		};
+
+		std::coroutine_handle<> leaf; // innermost suspended coroutine
+		pipe* wpipe = nullptr; // CW_READ/CW_WRITE
+		endpoint* target = nullptr; // CW_CONNECT
+		pipe_ptr connected; // CW_CONNECT result; nullptr if not connected
+		signed_t connect_timeout = 0; // CW_CONNECT: ms; 0 - until kernel gives up
+		connect_result cresult = CR_OK; // CW_CONNECT outcome
+		waitfor wait = CW_NONE;
+
+		void resume()
+		{
+			std::coroutine_handle<> h = leaf;
+			leaf = nullptr;
+			wait = CW_NONE;
+			h.resume();
+		}
+		bool done() const { return leaf == nullptr; }
+
+		bool waits(pipe* p, waitfor w) const
+		{
+			return wait == w && wpipe->get_waitable() == p->get_waitable(); // wrapped pipes (e.g. crypto pipe) share socket with pipe they wrap
+		}
+
+		void run_blocking(); // drive chain on current thread; waits block it
+	};
+
+	void co_failed(std::exception_ptr e); // logs exception that ended coroutine chain
+
+	template<typename T> class co_task // lazy coroutine; started by co_await from other co_task or by start (root of chain)
+	{
+	public:
+		struct promise_type
+		{
+			T value{}; // default value if coroutine failed with exception
+			std::exception_ptr error; // exception that ended coroutine; goes on to parent, root logs it (see result)
+			co_context* ctx = nullptr;
+			std::coroutine_handle<> parent;
+
+			co_task get_return_object() { return co_task(std::coroutine_handle<promise_type>::from_promise(*this)); }
+			std::suspend_always initial_suspend() noexcept { return {}; }
+			auto final_suspend() noexcept
+			{
+				struct final_awaiter
+				{
+					bool await_ready() noexcept { return false; }
+					std::coroutine_handle<> await_suspend(std::coroutine_handle<promise_type> h) noexcept
+					{
+						std::coroutine_handle<> p = h.promise().parent;
+						return p ? p : std::noop_coroutine(); // root returns control to driver
+					}
+					void await_resume() noexcept {}
+				};
+				return final_awaiter{};
+			}
+			void return_value(T v) { value = std::move(v); }
+			void unhandled_exception() { error = std::current_exception(); } // i.e. crypto failure; caller of root gets default value
+		};
+
+	private:
+		std::coroutine_handle<promise_type> h;
+
+		explicit co_task(std::coroutine_handle<promise_type> h) :h(h) {}
+
+	public:
+		co_task() {}
+		co_task(co_task&& t) :h(t.h) { t.h = nullptr; }
+		co_task(const co_task&) = delete;
+		~co_task()
+		{
+			if (h)
+				h.destroy(); // also destroys suspended children (they are temporaries of this frame)
+		}
+		co_task& operator=(co_task&& t)
+		{
+			if (h)
+				h.destroy();
+			h = t.h;
+			t.h = nullptr;
+			return *this;
+		}
+
+		bool await_ready() const noexcept { return false; }
+		template<typename P> std::coroutine_handle<> await_suspend(std::coroutine_handle<P> caller) noexcept
+		{
+			h.promise().ctx = caller.promise().ctx;
+			h.promise().parent = caller;
+			return h; // start child; caller is resumed when child returns
+		}
+		T await_resume()
+		{
+			if (h.promise().error)
+				std::rethrow_exception(std::exchange(h.promise().error, nullptr)); // caller ends too, unless it catches
+			return std::move(h.promise().value);
+		}
+
+		void start(co_context* ctx) // run root coroutine until its first wait
+		{
+			h.promise().ctx = ctx;
+			ctx->leaf = h;
+			ctx->resume();
+		}
+		T& result() // root is done
+		{
+			if (h.promise().error)
+				co_failed(std::exchange(h.promise().error, nullptr));
+			return h.promise().value;
+		}
+	};
+
+	struct co_waitpipe // suspend until event of pipe
+	{
+		pipe* p;
+		co_context::waitfor w;
+
+		bool await_ready() const noexcept { return false; }
+		template<typename P> void await_suspend(std::coroutine_handle<P> caller) noexcept
+		{
+			co_context* c = caller.promise().ctx;
+			c->leaf = caller;
+			c->wpipe = p;
+			c->wait = w;
+		}
+		void await_resume() const noexcept {}
+	};
+
+	struct co_connect // suspend until driver connects to target (dns may block, so only driver knows where to do it)
+	{
+		endpoint& ep;
+		signed_t timeout;
+		co_context* c = nullptr;
+
+		co_connect(endpoint& ep, signed_t timeout) :ep(ep), timeout(timeout) {}
+
+		bool await_ready() const noexcept { return false; }
+		template<typename P> void await_suspend(std::coroutine_handle<P> caller) noexcept
+		{
+			c = caller.promise().ctx;
+			c->leaf = caller;
+			c->target = &ep;
+			c->connect_timeout = timeout;
+			c->wait = co_context::CW_CONNECT;
+		}
+		pipe_ptr await_resume() { return std::move(c->connected); }
+		connect_result result() const { return c->cresult; } // after resume
+	};
+
+	template<typename T> T co_run(co_task<T> t) // for threads that may block (e.g. udp): run coroutine to the end
+	{
+		co_context c;
+		t.start(&c);
+		c.run_blocking();
+		return std::move(t.result());
+	}
+
+}
@@ -808,11 +808,38 @@ netkit::ipap dns_resolver::resolve(const str::astr& hn_, bool log_it)
 	query_internals qi( hn_ );
 	qi.rindex = rndindex++;
 
+	if (auto r = lookup(qi, log_it))
+		return r->get_one(qi.rindex);
+	return netkit::ipap();
+}
+
+bool dns_resolver::resolve(const str::astr& hn_, std::vector<netkit::ipap>& ips, bool log_it)
+{
+	netkit::ipap temp = netkit::ipap::parse(str::view(hn_), false);
+	if (!temp.is_wildcard())
+	{
+		ips.push_back(temp);
+		return true;
+	}
+
+	query_internals qi(hn_);
+	qi.rindex = rndindex++;
+
+	if (auto r = lookup(qi, log_it))
+	{
+		auto ar = r->ips.lock_read();
+		ips.insert(ips.end(), ar().begin(), ar().end());
+	}
+	return !ips.empty();
+}
+
+ptr::shared_ptr<dns_resolver::cache_rec> dns_resolver::lookup(query_internals& qi, bool log_it)
+{
 	auto r = resolve(qi, true);
 	switch (qi.result)
 	{
 	case query_internals::r_ok:
-		return r->get_one(qi.rindex);
+		return r;
 	case query_internals::r_label2long:
 		if (log_it)
 			LOG_E("dns: name not legal (label too long): %s", qi.cur_host().c_str());
@@ -837,7 +864,7 @@ netkit::ipap dns_resolver::resolve(const str::astr& hn_, bool log_it)
 
 	LL1("query failed \"%s\"", qi.hns[0].c_str());
 
-	return netkit::ipap();
+	return ptr::shared_ptr<cache_rec>();
 }
 
 
@@ -400,11 +400,13 @@ class dns_resolver
 	static bool find_and_add(zones_array* za, nameserver* ns, const cache_rec* ips);
 	void add_zone_ns_ip(nameserver* ns, const cache_rec* ips); // removes ns from zone and adds ips to same zone
 	ptr::shared_ptr<cache_rec> resolve(query_internals &qi, bool lock_resolving);
+	ptr::shared_ptr<cache_rec> lookup(query_internals& qi, bool log_it); // nullptr if failed
 
 public:
 
 	dns_resolver(bool parse_hosts);
 	
 	netkit::ipap resolve(const str::astr &hn, bool log_it);
+	bool resolve(const str::astr& hn, std::vector<netkit::ipap>& ips, bool log_it); // all ips of host
 	void load_serves(engine *e, const asts* s);
 };
\ No newline at end of file
@@ -87,6 +87,18 @@ engine::~engine()
 #endif
 }
 
+static void report_memory()
+{
+	using rcvpool = tools::block_pool<netkit::tcp_pipe::rcvbuf_size>;
+	using chunkpool = tools::chunk_buffer<16384>::pool;
+	signed_t pipes = netkit::tcp_pipe::numpipes, used = rcvpool::used, pooled = rcvpool::pooled;
+	signed_t chunks = chunkpool::used;
+	signed_t total = pipes * sizeof(netkit::tcp_pipe) + (used + pooled) * netkit::tcp_pipe::rcvbuf_size + chunks * chunkpool::block_size + chunkpool::held_bytes();
+	LOG_N("memory: %i tcp pipes, %i receive buffers in use, %i spare; %i send chunks in use, %i KB spare (%i%% hits); %i KB queued by bridges%s; %i KB total, %i bytes per pipe", (int)pipes, (int)used, (int)pooled,
+		(int)chunks, (int)(chunkpool::held_bytes() / 1024), (int)chunkpool::hit_rate(), (int)(glb.queued / 1024), glb.pressure ? " (over budget)" : "",
+		(int)(total / 1024), (int)(pipes > 0 ? total / pipes : 0));
+}
+
 signed_t engine::working()
 {
 	if (glb.is_stop())
@@ -103,5 +115,15 @@ signed_t engine::working()
 		return -1;
 	}
 
+	if (glb.cfg.mem_report > 0)
+	{
+		signed_t ct = chrono::ms();
+		if (ct - report_time >= glb.cfg.mem_report * 1000)
+		{
+			report_time = ct;
+			report_memory();
+		}
+	}
+
 	return glb.log_muted || glb.prints.lock_read()().empty() ? 1000 : 1;
 }
@@ -5,6 +5,7 @@ class engine
 
 	larray listners;
 	std::vector<std::unique_ptr<proxy>> prox;
+	signed_t report_time = 0; // ms; last memory report (see conf::mem_report)
 
 public:
 
@@ -7,19 +7,19 @@ handler_ss::handler_ss(loader& ldr, listener* owner, const asts& bb) :handler(ld
 
 void handler_ss::on_pipe(netkit::pipe* pipe)
 {
-	std::thread th(&handler_ss::worker, this, pipe);
-	th.detach();
+	netkit::pipe_ptr p(pipe);
+	netkit::pipe_ptr p_enc(new ss::core::crypto_pipe(p, std::move(core.cb()), core.masterKey, core.cp, core.coalesce));
+	p = nullptr;
+	netkit::pipe* enc = p_enc.get();
+	negotiate(std::move(p_enc), handshake(enc));
 }
 
-void handler_ss::worker(netkit::pipe* raw_pipe)
+netkit::co_task<netkit::pipe_ptr> handler_ss::handshake(netkit::pipe* p_enc)
 {
-	netkit::pipe_ptr p(raw_pipe);
-	netkit::pipe_ptr p_enc(new ss::core::crypto_pipe(p, std::move(core.cb()), core.masterKey, core.cp));
-
 	u8 packet[512];
-	signed_t rb = p_enc->recv(packet, -2);
+	signed_t rb = co_await p_enc->read_exact(packet, 2);
 	if (rb != 2)
-		return;
+		co_return netkit::pipe_ptr();
 
 	netkit::endpoint ep;
 	signed_t len;
@@ -27,36 +27,31 @@ void handler_ss::worker(netkit::pipe* raw_pipe)
 	switch (packet[0])
 	{
 	case 1: // ip4
-		rb = p_enc->recv(packet + 2, -3);
+		rb = co_await p_enc->read_exact(packet + 2, 3);
 		if (rb != 3)
-			return;
+			co_return netkit::pipe_ptr();
 		
 		ep.set_ipap(netkit::ipap::build(packet + 1, 4));
 		break;
 	case 3: // domain name
 
 		len = packet[1]; // len of domain
-		rb = p_enc->recv(packet, -len);
+		rb = co_await p_enc->read_exact(packet, len);
 		if (rb != len)
-			return;
+			co_return netkit::pipe_ptr();
 		ep.set_domain(std::string((const char*)packet, len));
 		break;
 
-	case 4: // ipv6
-		/* ipv6 not supported yet */
-		p_enc->recv(packet+2, -15); // read 15 of 16 bytes of ipv6 address (1st byte already read)
-		ep.set_ipap(netkit::ipap::build(packet + 1, 16));
-		return;
+	default: // ipv6 not supported yet
+		co_return netkit::pipe_ptr();
 	}
 
-	rb = p_enc->recv(packet, -2);
+	rb = co_await p_enc->read_exact(packet, 2);
 	if (rb != 2)
-		return;
+		co_return netkit::pipe_ptr();
 
 	signed_t port = ((signed_t)packet[0]) << 8 | packet[1];
 	ep.set_port(port);
 
-	if (netkit::pipe_ptr outcon = connect(ep, false))
-		bridge(/*ep,*/ std::move(p_enc), std::move(outcon));
+	co_return co_await connect(ep);
 }
-
@@ -4,7 +4,7 @@
 
 class handler_ss : public handler // socks4 and socks5
 {
-	void worker(netkit::pipe* pipe);
+	netkit::co_task<netkit::pipe_ptr> handshake(netkit::pipe* pipe);
 
 	ss::core core;
 
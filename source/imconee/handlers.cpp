@@ -1,6 +1,7 @@
 #include "pch.h"
 
 #define BRIDGE_BUFFER_SIZE 65536
+#define QUEUE_LOW_WATERMARK 16384 // while memory budget is exceeded, bridge reads at most this and pauses source if its peer holds more
 
 handler* handler::build(loader& ldr, listener *owner, const asts& bb, netkit::socket_type st)
 {
@@ -54,6 +55,11 @@ handler* handler::build(loader& ldr, listener *owner, const asts& bb, netkit::so
 
 handler::handler(loader& ldr, listener* owner, const asts& bb):owner(owner)
 {
+	idle_timeout = bb.get_int(ASTR("idle-timeout"), idle_timeout);
+	handshake_timeout = bb.get_int(ASTR("handshake-timeout"), handshake_timeout);
+	connect_timeout = bb.get_int(ASTR("connect-timeout"), connect_timeout);
+	buffer_budget = bb.get_int(ASTR("buffer-budget"), 0) * 1024;
+
 	str::astr pch = bb.get_string(ASTR("proxychain"));
 	if (!pch.empty())
 	{
@@ -76,36 +82,22 @@ void handler::bridge(netkit::pipe_ptr &&pipe1, netkit::pipe_ptr&& pipe2)
 	ASSERT(!pipe1->is_multi_ref()); // avoid memory leak! bridge is now owner of pipe1 and pipe2
 	ASSERT(!pipe2->is_multi_ref());
 
-	auto tcp = tcp_pth.lock_read();
-	tcp_processing_thread* ptr = tcp().get();
-	for (; ptr != nullptr; ptr = ptr->get_next())
-	{
-		signed_t x = ptr->try_add_bridge(/*ep,*/ pipe1, pipe2);
-		if (x > 0)
-		{
-			tcp.unlock();
-			ptr->signal();
-			return;
-		}
-	}
-	tcp.unlock();
-
-
-	auto tcpw = tcp_pth.lock_write();
-	tcp_processing_thread *npt = new tcp_processing_thread();
-	npt->get_next_ptr()->reset(tcpw().get());
-	tcpw().release();
-	tcpw().reset(npt);
-	tcpw.unlock();
-
-	npt->try_add_bridge(pipe1, pipe2);
-	bridge(npt);
+	++numbridges;
+	pool().add(this, pipe1, pipe2);
 
 	pipe1 = nullptr;
 	pipe2 = nullptr;
+}
 
-	release_tcp(npt);
+void handler::negotiate(netkit::pipe_ptr&& pipe, netkit::co_task<netkit::pipe_ptr>&& handshake)
+{
+	ASSERT(!pipe->is_multi_ref());
 
+	++numbridges;
+	negotiation* n = new negotiation();
+	n->task = std::move(handshake);
+	netkit::pipe_ptr none;
+	pool().add(this, pipe, none, n);
 }
 
 #ifdef LOG_TRAFFIC
@@ -196,15 +188,138 @@ void traffic_logger::log21(u8* data, signed_t sz)
 #endif
 
 
+#ifdef USE_SPLICE
+void handler::bridged::prepare_splice()
+{
+	netkit::tcp_pipe* t1 = dynamic_cast<netkit::tcp_pipe*>(pipe1.get());
+	netkit::tcp_pipe* t2 = dynamic_cast<netkit::tcp_pipe*>(pipe2.get());
+	if (t1 == nullptr || t2 == nullptr || !netkit::splicer::allowed(t1) || !netkit::splicer::allowed(t2))
+	{
+		nosplice = true;
+		return;
+	}
+
+	if (!splice12)
+		splice12.reset(netkit::splicer::create(t1, t2));
+	if (!splice21)
+		splice21.reset(netkit::splicer::create(t2, t1));
+}
+#endif
+
+static bool over_budget(std::atomic<signed_t>& queued, std::atomic<bool>& pressure, signed_t budget)
+{
+	if (budget <= 0)
+		return false;
+	signed_t q = queued.load(std::memory_order_relaxed);
+	bool p = pressure.load(std::memory_order_relaxed);
+	if (p ? q < budget - budget / 4 : q >= budget)
+		pressure.store(p = !p, std::memory_order_relaxed);
+	return p;
+}
+
+void handler::bridged::account()
+{
+	signed_t q = queued_to(pipe1.get()) + queued_to(pipe2.get());
+	if (q == queued)
+		return;
+	owner->queued += q - queued;
+	glb.queued += q - queued;
+	queued = q;
+	over_budget(owner->queued, owner->pressure, owner->buffer_budget);
+	over_budget(glb.queued, glb.pressure, glb.cfg.buffer_budget);
+}
+
+void handler::bridged::unqueue()
+{
+	if (queued != 0 && owner != nullptr)
+	{
+		owner->queued -= queued;
+		glb.queued -= queued;
+		// pressure is re-checked only by changes; last bridge of burst must release it
+		over_budget(owner->queued, owner->pressure, owner->buffer_budget);
+		over_budget(glb.queued, glb.pressure, glb.cfg.buffer_budget);
+	}
+	queued = 0;
+}
+
+bool handler::bridged::pressure() const
+{
+	return owner->pressure.load(std::memory_order_relaxed) || glb.pressure.load(std::memory_order_relaxed);
+}
+
+bool handler::bridged::paused(netkit::pipe* to) const
+{
+	return pressure() && queued_to(to) > QUEUE_LOW_WATERMARK;
+}
+
+signed_t handler::bridged::queued_to(netkit::pipe* to) const
+{
+	signed_t q = to->queued();
+#ifdef USE_SPLICE
+	const std::unique_ptr<netkit::splicer>& sp = to == pipe2.get() ? splice12 : splice21;
+	if (sp)
+		q += sp->queued();
+#endif
+	return q;
+}
+
+bool handler::bridged::blocked(netkit::pipe* to) const
+{
+#ifdef USE_SPLICE
+	// splicer holds data until target accepts it; reading more would only spin on a full kernel pipe
+	const std::unique_ptr<netkit::splicer>& sp = to == pipe2.get() ? splice12 : splice21;
+	if (sp && !sp->is_empty())
+		return true;
+#endif
+	return to->send(nullptr, 0) == netkit::pipe::SEND_BUFFERFULL || paused(to);
+}
+
 handler::bridged::process_result handler::bridged::process(u8* data, netkit::pipe_waiter::mask &masks)
 {
-	process_result rv = masks.have_closed(mask1 | mask2) ? SLOT_DEAD : SLOT_SKIPPED;
+	bool closed1 = masks.have_closed(index1);
+	bool closed2 = masks.have_closed(index2);
+	process_result rv = (closed1 || closed2) ? SLOT_DEAD : SLOT_SKIPPED;
+
+#ifdef USE_SPLICE
+	if (!nosplice && (!splice12 || !splice21))
+		prepare_splice();
 
-	if (masks.have_read(mask1))
+	if (splice12 && masks.have_read(index1))
+	{
+		if (splice12->transfer(static_cast<netkit::tcp_pipe*>(pipe1.get()), static_cast<netkit::tcp_pipe*>(pipe2.get())) < 0)
+			return SLOT_DEAD;
+		if (splice12->is_empty())
+			masks.remove_write(index2);
+		if (rv != SLOT_DEAD) rv = SLOT_PROCESSES;
+	}
+	if (splice21 && masks.have_read(index2))
+	{
+		if (splice21->transfer(static_cast<netkit::tcp_pipe*>(pipe2.get()), static_cast<netkit::tcp_pipe*>(pipe1.get())) < 0)
+			return SLOT_DEAD;
+		if (splice21->is_empty())
+			masks.remove_write(index1);
+		if (rv != SLOT_DEAD) rv = SLOT_PROCESSES;
+	}
+	if (splice12 && !splice12->is_empty() && masks.have_write(index2))
+	{
+		if (splice12->flush(static_cast<netkit::tcp_pipe*>(pipe2.get())) == netkit::pipe::SEND_FAIL)
+			return SLOT_DEAD;
+		if (rv != SLOT_DEAD) rv = SLOT_PROCESSES;
+	}
+	if (splice21 && !splice21->is_empty() && masks.have_write(index1))
 	{
-		signed_t rcvsize = pipe2->send(nullptr, 0) == netkit::pipe::SEND_BUFFERFULL ? 1 : BRIDGE_BUFFER_SIZE;
+		if (splice21->flush(static_cast<netkit::tcp_pipe*>(pipe1.get())) == netkit::pipe::SEND_FAIL)
+			return SLOT_DEAD;
+		if (rv != SLOT_DEAD) rv = SLOT_PROCESSES;
+	}
+#endif
 
-		signed_t sz = pipe1->recv(data, rcvsize);
+	// while over memory budget, one partial send must not leave much data in pipe
+	signed_t maxsz = pressure() ? QUEUE_LOW_WATERMARK : BRIDGE_BUFFER_SIZE;
+
+	if (masks.have_read(index1) && pipe2->send(nullptr, 0) != netkit::pipe::SEND_BUFFERFULL) // data stays in socket while other side is full
+	{
+		signed_t sz = pipe1->recv(data, maxsz);
 		if (sz < 0)
 			return SLOT_DEAD;
 
@@ -215,7 +330,7 @@ handler::bridged::process_result handler::bridged::process(u8* data, netkit::pip
 				return SLOT_DEAD;
 
 			if (r == netkit::pipe::SEND_OK)
-				masks.remove_write(mask2);
+				masks.remove_write(index2);
 
 #ifdef LOG_TRAFFIC
 			loger.log12(data, sz);
@@ -223,11 +338,9 @@ handler::bridged::process_result handler::bridged::process(u8* data, netkit::pip
 		}
 		if (rv != SLOT_DEAD) rv = SLOT_PROCESSES;
 	}
-	if (masks.have_read(mask2))
+	if (masks.have_read(index2) && pipe1->send(nullptr, 0) != netkit::pipe::SEND_BUFFERFULL) // data stays in socket while other side is full
 	{
-		signed_t rcvsize = pipe1->send(nullptr, 0) == netkit::pipe::SEND_BUFFERFULL ? 1 : BRIDGE_BUFFER_SIZE;
-
-		signed_t sz = pipe2->recv(data, rcvsize);
+		signed_t sz = pipe2->recv(data, maxsz);
 		if (sz < 0)
 			return SLOT_DEAD;
 		if (sz > 0)
@@ -237,7 +350,7 @@ handler::bridged::process_result handler::bridged::process(u8* data, netkit::pip
 				return SLOT_DEAD;
 
 			if (r == netkit::pipe::SEND_OK)
-				masks.remove_write(mask1);
+				masks.remove_write(index1);
 
 #ifdef LOG_TRAFFIC
 			loger.log21(data, sz);
@@ -247,14 +360,14 @@ handler::bridged::process_result handler::bridged::process(u8* data, netkit::pip
 		if (rv != SLOT_DEAD) rv = SLOT_PROCESSES;
 	}
 
-	if (masks.have_write(mask1))
+	if (masks.have_write(index1))
 	{
 		netkit::pipe::sendrslt r = pipe1->send(data, 0); // just send unsent buffer
 		if (r == netkit::pipe::SEND_FAIL)
 			return SLOT_DEAD;
 		if (rv != SLOT_DEAD) rv = SLOT_PROCESSES;
 	}
-	if (masks.have_write(mask2))
+	if (masks.have_write(index2))
 	{
 		netkit::pipe::sendrslt r = pipe2->send(data, 0); // just send unsent buffer
 		if (r == netkit::pipe::SEND_FAIL)
@@ -266,174 +379,837 @@ handler::bridged::process_result handler::bridged::process(u8* data, netkit::pip
 
 }
 
-signed_t handler::tcp_processing_thread::tick(u8* data)
+handler::bridge_pool& handler::pool()
+{
+	static bridge_pool* p = new bridge_pool(); // never deleted: detached workers may run until process exit
+	return *p;
+}
+
+handler::bridge_pool::bridge_pool()
+{
+	signed_t n = glb.cfg.bridge_threads;
+	if (n <= 0)
+		n = math::maxv(1, (signed_t)std::thread::hardware_concurrency());
+
+	numcore = n;
+	auto w = workers.lock_write();
+	for (signed_t i = 0; i < n; ++i)
+		w().emplace_back(new tcp_processing_thread(true));
+	for (signed_t i = 0; i < n; ++i)
+		start(w()[i].get(), i);
+}
+
+void handler::bridge_pool::start(tcp_processing_thread* w, signed_t cpu)
 {
-	auto ns = numslots.lock_write();
+	std::thread th(&tcp_processing_thread::work, w, cpu);
+	th.detach();
+}
 
-	for (signed_t i = 0; i < ns(); ++i)
+handler::tcp_processing_thread* handler::bridge_pool::least_loaded(tcp_processing_thread* except)
+{
+	auto w = workers.lock_read();
+	for (;;)
 	{
-		if (!slots[i].prepare_wait(waiter))
+		tcp_processing_thread* best = nullptr;
+		signed_t bestload = MAXIMUM_SLOTS;
+		for (const auto& t : w())
 		{
-			--ns();
-			moveslot(i, ns());
+			if (except && (t.get() == except || !t->is_core()))
+				continue; // rebalancing goes only to core workers; extra ones can disappear any time
+			signed_t l = t->get_load();
+			if (l < bestload)
+			{
+				best = t.get();
+				bestload = l;
+			}
 		}
+		if (best == nullptr)
+			return nullptr;
+		if (best->reserve())
+			return best;
+		// other thread took last place; try again
 	}
+}
+
+handler::tcp_processing_thread* handler::bridge_pool::home(signed_t shard)
+{
+	auto w = workers.lock_read();
+	tcp_processing_thread* t = w()[shard].get();
+	return t->reserve() ? t : nullptr;
+}
 
-	if (ns() <= 0)
+static thread_local signed_t home_shard = -1; // see handler::acceptor_shard
+
+static void pin_thread(signed_t cpu)
+{
+#ifdef _WIN32
+	SetThreadAffinityMask(GetCurrentThread(), (DWORD_PTR)1 << (cpu % (sizeof(DWORD_PTR) * 8)));
+#endif
+#ifdef _NIX
+	cpu_set_t cs;
+	CPU_ZERO(&cs);
+	CPU_SET(cpu % CPU_SETSIZE, &cs);
+	pthread_setaffinity_np(pthread_self(), sizeof(cs), &cs);
+#endif
+}
+
+/*static*/ void handler::acceptor_shard(signed_t shard)
+{
+	home_shard = shard % pool().core_count();
+	if (glb.cfg.pin_bridge_threads)
+		pin_thread(home_shard); // same core as its worker (see bridge_pool::bridge_pool)
+}
+
+void handler::bridge_pool::add(handler* h, netkit::pipe_ptr& pipe1, netkit::pipe_ptr& pipe2, negotiation* hs)
+{
+	// worker serves many bridges, so any blocking send would stall all of them
+	netkit::make_nonblocking(pipe1->get_waitable());
+	if (pipe2 != nullptr)
+		netkit::make_nonblocking(pipe2->get_waitable());
+
+	bridge_request* r = new bridge_request{ std::move(pipe1), std::move(pipe2), h, nullptr, std::unique_ptr<negotiation>(hs) };
+
+	tcp_processing_thread* t = home_shard >= 0 ? home(home_shard) : nullptr; // sharded acceptor keeps its connections on its core
+	if (t == nullptr)
+		t = least_loaded(nullptr);
+	if (t == nullptr)
 	{
-		ns() = -1;
-		return -1;
+		// all workers are full; extra worker lives while it has bridges
+		t = new tcp_processing_thread(false);
+		t->reserve();
+		auto w = workers.lock_write();
+		w().emplace_back(t);
+		start(t, -1);
 	}
 
-	ns.unlock();
+	t->add(r);
+}
 
-	auto mask = waiter.wait(10 * 1000 * 1000 /*10 sec*/);
-	if (mask.is_empty())
-		return 0;
+bool handler::bridge_pool::release(tcp_processing_thread* t)
+{
+	auto w = workers.lock_write();
+	if (t->get_load() > 0)
+		return false; // bridge was added while lock was acquiring
+	for (auto it = w().begin(); it != w().end(); ++it)
+	{
+		if (it->get() == t)
+		{
+			w().erase(it);
+			return true;
+		}
+	}
+	return false;
+}
 
-	signed_t cur_numslots = numslots.lock_read()();
-	signed_t rv = MAXIMUM_SLOTS + 1;
+void handler::bridge_pool::stop_handler()
+{
+	++stopgen;
+	auto w = workers.lock_read();
+	for (const auto& t : w())
+		t->signal();
+}
 
-	signed_t was_del = -1;
+handler::connect_pool& handler::connector()
+{
+	static connect_pool* p = new connect_pool(); // never deleted, like bridge pool
+	return *p;
+}
 
-	for (signed_t i = 0; i < cur_numslots && !mask.is_empty();)
+void handler::connect_pool::add(connect_request* r)
+{
+	if (r->target.state() == netkit::EPS_RESLOVED)
 	{
-		bridged::process_result pr = slots[i].process(data, mask);
+		start_connect(r, std::vector<netkit::ipap>{ r->target.get_ip() }); // nothing to resolve
+		return;
+	}
 
-		if (bridged::SLOT_DEAD == pr)
+	std::unique_lock<std::mutex> m(mut);
+	q.emplace(r);
+	++queued;
+	if (queued > idle)
+	{
+		// all threads are busy with slow resolves; new thread stays for next ones
+		std::thread th(&connect_pool::resolve, this);
+		th.detach();
+		return;
+	}
+	cv.notify_one();
+}
+
+void handler::connect_pool::resolve()
+{
+	std::unique_lock<std::mutex> m(mut);
+	for (;;)
+	{
+		connect_request* r;
+		if (!q.get(r))
 		{
-			slots[i].clear();
-			if (was_del < 0)
-				was_del = i;
+			++idle;
+			bool timeout = !cv.wait_for(m, std::chrono::seconds(30), [this]() { return !q.empty(); });
+			--idle;
+			if (timeout)
+				return;
 			continue;
 		}
+		--queued;
+		m.unlock();
 
-		if (rv > MAXIMUM_SLOTS && bridged::SLOT_SKIPPED == pr)
-			rv = i;
+		std::vector<netkit::ipap> ips;
+		if (r->owner->need_stop || !r->target.resolve_all(ips, glb.cfg.ipstack | conf::gip_log_it))
+			reply(r, nullptr, netkit::CR_FAILED);
+		else
+			start_connect(r, std::move(ips));
 
-		++i;
+		m.lock();
 	}
+}
+
+void handler::connect_pool::start_connect(connect_request* r, std::vector<netkit::ipap>&& ips)
+{
+	r->conn.reset(new netkit::tcp_connector(std::move(ips), r->timeout));
+	resolved.lock_write()().push_back(r);
 
-	ns = numslots.lock_write();
+	std::unique_lock<std::mutex> m(mut);
+	if (!looping)
+	{
+#ifdef _WIN32
+		// WSAPoll can't wait for events; loop waits for datagram it sends to itself
+		sig[0] = ::socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+		sockaddr_in a = {};
+		a.sin_family = AF_INET;
+		a.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		int al = sizeof(a);
+		::bind(sig[0], (const sockaddr*)&a, sizeof(a));
+		getsockname(sig[0], (sockaddr*)&a, &al);
+		::connect(sig[0], (const sockaddr*)&a, sizeof(a));
+		sig[1] = sig[0];
+		u_long one(1);
+		ioctlsocket(sig[0], FIONBIO, &one);
+#endif
+#ifdef _NIX
+		socketpair(PF_LOCAL, SOCK_STREAM, 0, sig);
+		fcntl(sig[0], F_SETFL, O_NONBLOCK | fcntl(sig[0], F_GETFL));
+		fcntl(sig[1], F_SETFL, O_NONBLOCK | fcntl(sig[1], F_GETFL)); // full buffer means loop is going to wake up anyway
+#endif
+		looping = true;
+		std::thread th(&connect_pool::loop, this);
+		th.detach();
+	}
+	u8 fakedata = 1;
+	::send(sig[1], (const char*)&fakedata, 1, 0);
+}
 
-	ASSERT(cur_numslots <= ns());
+void handler::connect_pool::signal()
+{
+	std::unique_lock<std::mutex> m(mut);
+	if (!looping)
+		return;
+	u8 fakedata = 1;
+	::send(sig[1], (const char*)&fakedata, 1, 0);
+}
 
-	if (was_del >= 0)
+void handler::connect_pool::reply(connect_request* r, netkit::pipe_ptr&& outcon, netkit::connect_result cr)
+{
+	r->worker->add(new bridge_request{ nullptr, std::move(outcon), r->owner, nullptr, nullptr, r->connid, cr });
+	delete r;
+}
+
+void handler::connect_pool::loop()
+{
+	std::vector<connect_request*> conns;
+	std::vector<pollfd> pfds;
+	std::vector<signed_t> firsts; // index of first pfds entry of each connect
+	for (;;)
 	{
-		for (signed_t i = was_del + 1; i < ns(); ++i)
+		auto rs = resolved.lock_write();
+		conns.insert(conns.end(), rs().begin(), rs().end());
+		rs().clear();
+		rs.unlock();
+
+		for (signed_t i = conns.size() - 1; i >= 0; --i)
 		{
-			if (slots[i].is_empty())
+			connect_request* r = conns[i];
+			if (r->owner->need_stop)
+				reply(r, nullptr, netkit::CR_FAILED);
+			else if (!r->conn->step())
+				reply(r, netkit::pipe_ptr(r->conn->take()), r->conn->result());
+			else
 				continue;
-			slots[was_del] = std::move(slots[i]);
-			if (rv == i)
-				rv = was_del;
+			conns[i] = conns.back();
+			conns.pop_back();
+		}
+
+		pfds.clear();
+		firsts.clear();
+		pollfd pfd = {};
+		pfd.fd = sig[0];
+		pfd.events = POLLIN;
+		pfds.push_back(pfd);
+
+		signed_t timeout = -1;
+		for (connect_request* r : conns)
+		{
+			firsts.push_back(pfds.size());
+			r->conn->add_polls(pfds);
+			signed_t w = r->conn->wait_time();
+			if (w >= 0 && (timeout < 0 || w < timeout))
+				timeout = w;
+		}
+
+		if (netkit::poll_sockets(pfds.data(), pfds.size(), timeout) <= 0)
+			continue;
 
-			was_del++;
-			ASSERT(slots[was_del].is_empty());
+		if (0 != (pfds[0].revents & POLLIN))
+		{
+			u8 temp[64];
+			while (::recv(sig[0], (char*)temp, sizeof(temp), 0) > 0); // just clear
 		}
-		ns() = was_del;
+
+		for (signed_t i = 0, cnt = conns.size(); i < cnt; ++i)
+			conns[i]->conn->polled(pfds.data() + firsts[i]);
 	}
+}
 
-	bool cont_inue = ns() > 0;
-	if (!cont_inue)
-		ns() = -1; // lock this thread
+handler::tcp_processing_thread::~tcp_processing_thread()
+{
+	for (bridge_request* r = incoming.exchange(nullptr); r;)
+	{
+		bridge_request* n = r->next;
+		--r->owner->numbridges;
+		delete r;
+		r = n;
+	}
+	for (signed_t i = 0; i < numslots; ++i)
+		if (slots[i].owner)
+			--slots[i].owner->numbridges;
+}
 
-	return cont_inue ? rv : -1;
+bool handler::tcp_processing_thread::reserve()
+{
+	signed_t l = load;
+	for (;;)
+	{
+		if (l >= MAXIMUM_SLOTS)
+			return false;
+		if (load.compare_exchange_weak(l, l + 1))
+			return true;
+	}
 }
 
-void handler::bridge(tcp_processing_thread *npt)
+void handler::tcp_processing_thread::add(bridge_request* r)
 {
-	u8 data[BRIDGE_BUFFER_SIZE];
-	netkit::pipe_waiter::mask mask;
-	for (; !need_stop ;)
+	r->next = incoming;
+	while (!incoming.compare_exchange_weak(r->next, r));
+	signal();
+}
+
+void handler::tcp_processing_thread::take_incoming()
+{
+	bridge_request* r = incoming.exchange(nullptr);
+	if (r == nullptr)
+		return;
+
+	// stack is LIFO; restore order of arrival
+	bridge_request* rev = nullptr;
+	for (; r;)
 	{
-		signed_t r = npt->tick(data);
-		if (r < 0)
-			break;
+		bridge_request* n = r->next;
+		r->next = rev;
+		rev = r;
+		r = n;
+	}
 
-		if (glb.is_stop())
-			break;
+	for (r = rev; r;)
+	{
+		ASSERT(numslots < MAXIMUM_SLOTS); // guaranteed by reserve
+		bridge_request* n = r->next;
+		if (r->connid != 0)
+		{
+			connected(r);
+		}
+		else if (r->owner->need_stop)
+		{
+			// handler stopped while bridge was moving between workers
+			--r->owner->numbridges;
+			--load;
+		}
+		else
+		{
+			signed_t i = numslots++;
+			bridged& br = slots[i];
+			br.pipe1 = std::move(r->pipe1);
+			br.pipe2 = std::move(r->pipe2);
+			br.owner = r->owner;
+			br.hs = std::move(r->hs);
+			br.active = timers.ticks();
+			arm(br);
+			if (br.hs)
+			{
+				// first step without waiting: target of port mapping is already known, and client could send data before accept
+				br.hs->task.start(&br.hs->ctx);
+				if (!shake(i))
+					kill_slot(i);
+			}
+		}
+		delete r;
+		r = n;
+	}
+}
+
+signed_t handler::tcp_processing_thread::connect_ticket(signed_t i)
+{
+	signed_t ticket;
+	if (freetickets.empty())
+	{
+		ticket = connslots.size();
+		connslots.push_back(i);
+	}
+	else
+	{
+		ticket = freetickets.back();
+		freetickets.pop_back();
+		connslots[ticket] = i;
+	}
+	return ticket + 1;
+}
+
+void handler::tcp_processing_thread::connected(bridge_request* r)
+{
+	// connect request holds one place of load and one bridge of handler (so handler isn't deleted while connecting)
+	--load;
+
+	signed_t ticket = r->connid - 1;
+	signed_t i = connslots[ticket];
+	connslots[ticket] = -1;
+	freetickets.push_back(ticket);
 
-		if (r < MAXIMUM_SLOTS)
+	// -1 - slot was killed while connecting (stopped handler or closed client)
+	if (i >= 0 && slots[i].hs && slots[i].hs->connid == r->connid)
+	{
+		bridged& br = slots[i];
+		br.hs->connid = 0;
+		if (br.owner->need_stop)
+			kill_slot(i);
+		else
 		{
-			// transplant idle slots to end of thread list to free up the current thread faster
+			br.hs->ctx.connected = std::move(r->pipe2);
+			br.hs->ctx.cresult = r->cresult;
+			br.hs->ctx.resume();
+			if (!shake(i))
+				kill_slot(i);
+		}
+	}
 
-			auto tcp = tcp_pth.lock_read(); // why lock read? due we do not kill or change list-pointers here. we just expect no one kill them while this job in progress
+	--r->owner->numbridges;
+}
 
-			if (tcp_processing_thread * ptr = npt->get_next())
-				npt->transplant(r, ptr);
+bool handler::tcp_processing_thread::shake(signed_t i)
+{
+	bridged& br = slots[i];
+	netkit::co_context& ctx = br.hs->ctx;
 
-			/*
-			tcp_processing_thread *ptr = tcp().get();
-			for (; ptr && ptr != npt; ptr = ptr->get_next())
+	switch (ctx.wait)
+	{
+	case netkit::co_context::CW_NONE:
+		return negotiated(i);
+	case netkit::co_context::CW_CONNECT:
+		// dns blocks, so connect pool does it; pipes are muted until result
+		br.hs->connid = connect_ticket(i);
+		++load;
+		++br.owner->numbridges;
+		connector().add(new connect_request{ this, br.owner, *ctx.target, br.hs->connid, ctx.connect_timeout });
+		break;
+	default:
+		if (br.pipe2 == nullptr && ctx.wpipe->get_waitable() != br.pipe1->get_waitable())
+		{
+			// coroutine waits for upstream proxy; worker must watch its socket
+			br.pipe2 = ctx.wpipe;
+#ifdef USE_EPOLL
+			if (i < numattached)
 			{
-				if (npt->transplant(r, ptr))
-					break;
+				if (!waiter.attach(br.pipe2, i * 2 + 1))
+					return false;
+				br.index2 = i * 2 + 1;
 			}
-			*/
+#endif
 		}
+		break;
 	}
+
+#ifdef USE_EPOLL
+	if (i < numattached)
+	{
+		// only awaited pipe is read; data of other one stays in socket buffer until its turn
+		waiter.mute(br.pipe1, !ctx.waits(br.pipe1.get(), netkit::co_context::CW_READ));
+		if (br.pipe2 != nullptr)
+			waiter.mute(br.pipe2, !ctx.waits(br.pipe2.get(), netkit::co_context::CW_READ));
+	}
+#endif
+	return true;
 }
 
-void handler::release_udps()
+bool handler::tcp_processing_thread::negotiated(signed_t i)
 {
-#ifdef _DEBUG
-	ASSERT(spinlock::tid_self() == owner->accept_tid);
-#endif // _DEBUG
+	bridged& br = slots[i];
+	netkit::pipe_ptr out = std::move(br.hs->task.result());
+	if (out == nullptr || br.owner->need_stop)
+		return false;
 
-	auto keys = std::move( finished.lock_write()() );
+	netkit::make_nonblocking(out->get_waitable());
+	br.hs.reset();
+	br.active = timers.ticks();
+	arm(br); // idle timeout now
 
-	for(const auto &k : keys)
-		udp_pth.erase(k);
+	if (br.pipe2 != nullptr && br.pipe2->get_waitable() == out->get_waitable())
+	{
+		br.pipe2 = out; // same socket, maybe wrapped by proxy (e.g. crypto pipe); already attached
+	}
+	else
+	{
+#ifdef USE_EPOLL
+		if (br.index2 >= 0)
+		{
+			waiter.detach(br.pipe2);
+			br.index2 = -1;
+		}
+#endif
+		br.pipe2 = out;
+#ifdef USE_EPOLL
+		if (i < numattached)
+		{
+			if (!waiter.attach(br.pipe2, i * 2 + 1))
+				return false;
+			br.index2 = i * 2 + 1;
+		}
+#endif
+	}
+
+#ifdef USE_EPOLL
+	if (i < numattached)
+	{
+		waiter.mute(br.pipe1, false); // also schedules processing of data client sent together with handshake
+		waiter.mute(br.pipe2, false);
+	}
+#endif
+	return true;
 }
 
-void handler::release_udp(udp_processing_thread* udp_wt)
+bool handler::tcp_processing_thread::handshake_event(signed_t i, netkit::pipe_waiter::mask& masks)
 {
-	finished.lock_write()().push_back(udp_wt->key());
+	bridged& br = slots[i];
+	bool ev = masks.have_closed(br.index1) | masks.have_read(br.index1) | masks.have_write(br.index1);
+	if (br.index2 >= 0)
+		ev = masks.have_closed(br.index2) | masks.have_read(br.index2) | masks.have_write(br.index2) | ev;
+	if (!ev || br.hs->connid != 0)
+		return true; // muted while connecting; closed client will be noticed after connect
+	br.hs->ctx.resume();
+	return shake(i);
 }
 
-void handler::release_tcp(tcp_processing_thread* tcp_wt)
+void handler::tcp_processing_thread::kill_slot(signed_t i)
 {
-	auto tcp = tcp_pth.lock_write();
-	std::unique_ptr<tcp_processing_thread>* ptr = &tcp();
-	for (tcp_processing_thread* t = ptr->get(); t;)
+	bridged& br = slots[i];
+#ifdef USE_EPOLL
+	if (i < numattached)
+		br.detach(waiter); // so pendings of waiter don't refer to closed sockets
+#endif
+	if (br.hs && br.hs->connid != 0)
+		connslots[br.hs->connid - 1] = -1; // connect result will find nothing
+	--br.owner->numbridges;
+	br.clear();
+	--load;
+	deadslots.push_back(i);
+}
+
+void handler::tcp_processing_thread::arm(bridged& br)
+{
+	signed_t t = br.hs ? br.owner->handshake_timeout : br.owner->idle_timeout;
+	if (t <= 0)
 	{
-		if (t == tcp_wt)
-		{
-			t = t->get_next_and_forget();
-			ptr->reset(t); // it now deletes previous t
+		br.timer.cancel();
+		return;
+	}
+	timers.arm(br.timer, br.active + (t + TIMER_TICK_MS - 1) / TIMER_TICK_MS);
+}
+
+void handler::tcp_processing_thread::expired(bridged* br)
+{
+	// timer is not re-armed on each transfer (too expensive); it is checked here instead
+	signed_t t = br->hs ? br->owner->handshake_timeout : br->owner->idle_timeout;
+	if (t > 0 && br->active + (t + TIMER_TICK_MS - 1) / TIMER_TICK_MS > timers.ticks())
+	{
+		arm(*br);
+		return;
+	}
+	kill_slot(br - slots.data());
+}
+
+void handler::tcp_processing_thread::advance_timers()
+{
+	signed_t ticks = (uint32_t)(chrono::ms() - timers_time) / TIMER_TICK_MS; // ms wraps around
+	if (ticks <= 0)
+		return;
+	timers_time += ticks * TIMER_TICK_MS;
+	timers.advance(timers.ticks() + ticks, [this](bridged* br) { expired(br); });
+}
+
+long handler::tcp_processing_thread::wait_time() const
+{
+	signed_t ms = timers.idle_ticks() * TIMER_TICK_MS - (uint32_t)(chrono::ms() - timers_time);
+	return (long)math::clamp(ms, 0, 10 * 1000 /*10 sec*/) * 1000;
+}
+
+void handler::tcp_processing_thread::stop_handlers()
+{
+	signed_t g = pool().stop_generation();
+	if (g == stopgen)
+		return;
+	stopgen = g;
+
+	for (signed_t i = 0; i < numslots; ++i)
+		if (!slots[i].is_empty() && slots[i].owner->need_stop)
+			kill_slot(i);
+}
+
+void handler::tcp_processing_thread::rebalance()
+{
+	// only handoff of whole bridges is possible, so move them only if difference is significant
+#ifdef USE_IO_URING
+	if (waiter.uses_ring())
+		return; // data received by io_uring belongs to this worker's ring
+#endif
+
+	signed_t my = load;
+	if (my < 8)
+		return;
+
+	tcp_processing_thread* t = pool().least_loaded(this);
+	if (t == nullptr)
+		return;
+
+	signed_t his = t->get_load() - 1; // one place is reserved by least_loaded
+	signed_t n = (my - his) / 2;
+	if (my - his <= math::maxv(4, my / 4))
+		n = 0;
+
+	bool reserved = true;
+	for (signed_t i = numslots - 1; i >= 0 && n > 0; --i)
+	{
+		bridged& br = slots[i];
+		if (br.is_empty() || br.hs)
+			continue; // result of connect comes to this worker
+#ifdef USE_SPLICE
+		if (!br.splice_empty())
+			continue; // data in kernel pipes can't be moved
+#endif
+		if (!reserved && !t->reserve())
 			break;
-		}
-		ptr = t->get_next_ptr();
-		t = t->get_next();
+		reserved = false;
+
+#ifdef USE_EPOLL
+		if (i < numattached)
+			br.detach(waiter); // before other worker attaches it
+#endif
+		t->add(new bridge_request{ std::move(br.pipe1), std::move(br.pipe2), br.owner });
+		br.clear();
+		--load;
+		deadslots.push_back(i);
+		--n;
 	}
 
+	if (reserved)
+		--t->load;
 }
 
+void handler::tcp_processing_thread::remove_dead()
+{
+	if (deadslots.size() == 0)
+		return;
+
+#ifdef USE_EPOLL
+	attach_new(); // so all slots are attached and last slot can be moved to free place
+#endif
+
+	std::sort(deadslots.begin(), deadslots.end(), std::greater<signed_t>());
+	for (signed_t i : deadslots)
+	{
+		--numslots;
+		moveslot(i, numslots);
+	}
+	deadslots.clear();
+#ifdef USE_EPOLL
+	numattached = numslots;
+#endif
+}
 
-netkit::pipe_ptr handler::connect( netkit::endpoint& addr, bool direct)
+#ifdef USE_EPOLL
+void handler::tcp_processing_thread::attach_new()
 {
-	static spinlock::long3264 tag = 1;
+	// bridges are attached to waiter once; after that waiter reports only sockets that got events
+	for (; numattached < numslots;)
+	{
+		if (slots[numattached].is_empty() || slots[numattached].attach(waiter, numattached)) // empty - handshake failed before attach; removed by remove_dead
+		{
+			++numattached;
+			continue;
+		}
+		--slots[numattached].owner->numbridges;
+		--load;
+		--numslots;
+		moveslot(numattached, numslots);
+	}
+}
 
-	if (direct || proxychain.size() == 0)
+void handler::tcp_processing_thread::tick(u8* data)
+{
+	take_incoming();
+	attach_new();
+	stop_handlers();
+	remove_dead();
+
+	auto &mask = waiter.wait(wait_time());
+	advance_timers();
+	if (!mask.is_empty())
 	{
-		if (netkit::pipe* pipe = conn::connect(addr))
+		for (signed_t index : mask.active())
 		{
-			if (proxychain.size() == 0)
+			signed_t i = index / 2;
+			if (i >= numattached || slots[i].is_empty())
+				continue;
+
+			if (slots[i].hs)
 			{
-				LOG_N("connected to (%s) via listener [%s]", addr.desc().c_str(), str::printable(owner->get_name()));
+				if (!handshake_event(i, mask))
+					kill_slot(i);
+				continue;
 			}
 
-			netkit::pipe_ptr pp(pipe);
-			return pp;
+			bridged::process_result pr = slots[i].process(data, mask);
+			if (bridged::SLOT_DEAD == pr)
+				kill_slot(i);
+			else if (bridged::SLOT_PROCESSES == pr)
+				slots[i].active = timers.ticks();
 		}
 
-		if (proxychain.size() == 0)
+		// pipes with buffered data must be processed on next tick even if there are no new events on sockets
+		for (signed_t index : mask.active())
 		{
-			LOG_N("not connected to (%s) via listener [%s]", addr.desc().c_str(), str::printable(owner->get_name()));
+			signed_t i = index / 2;
+			if (i < numattached && !slots[i].is_empty())
+				slots[i].update_flow(waiter);
 		}
+	}
 
-		return netkit::pipe_ptr();
+	signed_t ct = chrono::ms();
+	if (ct - balance_time >= 1000)
+	{
+		balance_time = ct;
+		rebalance();
+	}
+
+	remove_dead();
+}
+#else
+void handler::tcp_processing_thread::tick(u8* data)
+{
+	take_incoming();
+	stop_handlers();
+	remove_dead();
+
+	for (signed_t i = 0; i < numslots; ++i)
+	{
+		if (!slots[i].prepare_wait(waiter))
+		{
+			--slots[i].owner->numbridges;
+			--load;
+			--numslots;
+			moveslot(i, numslots);
+			--i;
+		}
+	}
+
+	auto &mask = waiter.wait(wait_time());
+
+	for (signed_t i = 0; i < numslots && !mask.is_empty(); ++i)
+	{
+		if (slots[i].hs)
+		{
+			if (!handshake_event(i, mask))
+				kill_slot(i);
+			continue;
+		}
+		bridged::process_result pr = slots[i].process(data, mask);
+		if (bridged::SLOT_DEAD == pr)
+			kill_slot(i);
+		else if (bridged::SLOT_PROCESSES == pr)
+			slots[i].active = timers.ticks();
+	}
+	advance_timers();
+
+	signed_t ct = chrono::ms();
+	if (ct - balance_time >= 1000)
+	{
+		balance_time = ct;
+		rebalance();
+	}
+
+	remove_dead();
+}
+
+#endif
+
+void handler::tcp_processing_thread::work(signed_t cpu)
+{
+	if (cpu >= 0 && glb.cfg.pin_bridge_threads)
+		pin_thread(cpu);
+
+	waiter.wait(0); // create signal primitives; bridges added before that are taken by first tick
+	waiter.make_current(); // crypto workers wake this thread up when records of its pipes are ready
+
+	u8 data[BRIDGE_BUFFER_SIZE];
+	for (;;)
+	{
+		tick(data);
+
+		if (!core && load == 0 && pool().release(this))
+			return; // this is deleted now
+	}
+}
+
+void handler::release_udps()
+{
+#ifdef _DEBUG
+	ASSERT(spinlock::tid_self() == owner->accept_tid);
+#endif // _DEBUG
+
+	auto keys = std::move( finished.lock_write()() );
+
+	for(const auto &k : keys)
+		udp_pth.erase(k);
+}
+
+void handler::release_udp(udp_processing_thread* udp_wt)
+{
+	finished.lock_write()().push_back(udp_wt->key());
+}
+
+netkit::co_task<netkit::pipe_ptr> handler::connect( netkit::endpoint& addr)
+{
+	static spinlock::long3264 tag = 1;
+
+	if (proxychain.size() == 0)
+	{
+		netkit::co_connect cc(addr, connect_timeout);
+		netkit::pipe_ptr pp = co_await cc;
+		if (pp != nullptr)
+		{
+			LOG_N("connected to (%s) via listener [%s]", addr.desc().c_str(), str::printable(owner->get_name()));
+		}
+		else
+		{
+			LOG_N("not connected to (%s) via listener [%s] (%s)", addr.desc().c_str(), str::printable(owner->get_name()), netkit::connect_result_desc(cc.result()));
+		}
+		co_return pp;
 	}
 
 	spinlock::long3264 t = spinlock::increment(tag);
@@ -466,7 +1242,9 @@ netkit::pipe_ptr handler::connect( netkit::endpoint& addr, bool direct)
 			return prx_ep;
 		};
 	
-	netkit::pipe_ptr pp = connect(get_proxy_addr(0), true);
+	netkit::co_connect cc(get_proxy_addr(0), proxychain[0]->connect_timeout(connect_timeout));
+	netkit::pipe_ptr pp = co_await cc;
+	proxychain[0]->connect_done(cc.result());
 
 	for (signed_t i = 0; pp != nullptr && i < (signed_t)proxychain.size(); ++i)
 	{
@@ -481,51 +1259,9 @@ netkit::pipe_ptr handler::connect( netkit::endpoint& addr, bool direct)
 			ps("connecting to proxy (%s)"); LOG_N(stag.c_str(), proxychain[i + 1]->desc().c_str());
 		}
 
-		pp = proxychain[i]->prepare(pp, na);
-	}
-	return pp;
-}
-
-bool handler::tcp_processing_thread::transplant(signed_t slot, tcp_processing_thread* n)
-{
-	auto ns = numslots.lock_write();
-
-	ASSERT(slot < ns());
-	bridged& br = slots[slot];
-
-	if (n->try_add_bridge(br.pipe1, br.pipe2) > 0)
-	{
-		--ns();
-		moveslot(slot, ns());
-		if (ns() == 0)
-		{
-			ns() = -1;
-			return true;
-		}
+		pp = co_await proxychain[i]->prepare(pp, na);
 	}
-
-	return false;
-
-}
-
-void handler::tcp_processing_thread::close()
-{
-	signal();
-	{
-		std::array<netkit::pipe_ptr, MAXIMUM_SLOTS * 2> ptrs;
-		signed_t n = 0;
-
-		auto ns = numslots.lock_write();
-		for (signed_t i = 0; i < ns(); ++i)
-		{
-			ptrs[n++] = std::move(slots[i].pipe1);
-			ptrs[n++] = std::move(slots[i].pipe2);
-		}
-		ns() = 0;
-	}
-
-	if (next)
-		next->close();
+	co_return pp;
 }
 
 void handler::udp_processing_thread::udp_bridge(SOCKET initiator)
@@ -612,11 +1348,11 @@ void handler::stop()
 #endif // _DEBUG
 
 	need_stop = true;
-
-	auto tcp = tcp_pth.lock_write();
-	if (tcp())
-		tcp()->close();
-	tcp.unlock();
+	if (numbridges > 0)
+	{
+		pool().stop_handler();
+		connector().signal();
+	}
 
 	for (auto &pp : udp_pth)
 	{
@@ -624,7 +1360,7 @@ void handler::stop()
 			pp.second->close();
 	}
 
-	for (; tcp_pth.lock_read()().get() != nullptr || !udp_pth.empty();)
+	for (; numbridges > 0 || !udp_pth.empty();)
 	{
 		Sleep(100);
 		release_udps();
@@ -673,8 +1409,14 @@ handler_direct::handler_direct(loader& ldr, listener* owner, const asts& bb, net
 
 void handler_direct::on_pipe(netkit::pipe* pipe)
 {
-	std::thread th(&handler_direct::tcp_worker, this, pipe);
-	th.detach();
+	netkit::pipe_ptr p(pipe);
+	negotiate(std::move(p), tcp_worker());
+}
+
+netkit::co_task<netkit::pipe_ptr> handler_direct::tcp_worker()
+{
+	netkit::endpoint tgt(to_addr);
+	co_return co_await connect(tgt);
 }
 
 void handler_direct::on_udp(netkit::socket& lstnr, netkit::udp_packet& p)
@@ -775,17 +1517,6 @@ void handler_direct::udp_worker(netkit::socket* lstnr, udp_processing_thread* ud
 	release_udp(udp_wt);
 }
 
-void handler_direct::tcp_worker(netkit::pipe* pipe)
-{
-	// now try to connect to out
-
-	netkit::pipe_ptr p(pipe);
-	ep.preparse(to_addr);
-
-	if (netkit::pipe_ptr outcon = connect(ep, false))
-		bridge(std::move(p), std::move(outcon));
-}
-
 
 //////////////////////////////////////////////////////////////////////////////////
 //
@@ -825,39 +1556,35 @@ handler_socks::handler_socks(loader& ldr, listener* owner, const asts& bb, const
 
 void handler_socks::on_pipe(netkit::pipe* pipe)
 {
-	std::thread th(&handler_socks::handshake, this, pipe);
-	th.detach();
+	netkit::pipe_ptr p(pipe);
+	negotiate(std::move(p), handshake(pipe));
 }
 
-void handler_socks::handshake(netkit::pipe* pipe)
+netkit::co_task<netkit::pipe_ptr> handler_socks::handshake(netkit::pipe* pipe)
 {
 	u8 packet[8];
-	signed_t rb = pipe->recv(packet, -1);
+	signed_t rb = co_await pipe->read_exact(packet, 1);
 	if (rb != 1)
-		return;
+		co_return netkit::pipe_ptr();
 
 	if (packet[0] == 4)
-	{
-		handshake4(pipe);
-		return;
-	}
+		co_return co_await handshake4(pipe);
 
 	if (packet[0] == 5)
-	{
-		handshake5(pipe);
-		return;
-	}
+		co_return co_await handshake5(pipe);
+
+	co_return netkit::pipe_ptr();
 }
 
-void handler_socks::handshake4(netkit::pipe* pipe)
+netkit::co_task<netkit::pipe_ptr> handler_socks::handshake4(netkit::pipe* pipe)
 {
 	if (!allow_4)
-		return;
+		co_return netkit::pipe_ptr();
 
 	u8 packet[8];
-	signed_t rb = pipe->recv(packet, -7);
+	signed_t rb = co_await pipe->read_exact(packet, 7);
 	if (rb != 7 || packet[0] != 1)
-		return;
+		co_return netkit::pipe_ptr();
 
 	u16 port = (((u16)packet[1]) << 8) | packet[2];
 	netkit::ipap dst = netkit::ipap::build(packet + 3, 4, port);
@@ -865,9 +1592,9 @@ void handler_socks::handshake4(netkit::pipe* pipe)
 	str::astr uid;
 	for (;;)
 	{
-		rb = pipe->recv(packet, -1);
+		rb = co_await pipe->read_exact(packet, 1);
 		if (rb != 1)
-			return;
+			co_return netkit::pipe_ptr();
 		if (packet[0] == 0 || uid.size() > 255)
 			break;
 		uid.push_back(packet[0]);
@@ -880,14 +1607,12 @@ void handler_socks::handshake4(netkit::pipe* pipe)
 		packet[2] = 0; packet[3] = 0;
 		packet[4] = 0; packet[5] = 0; packet[6] = 0; packet[7] = 0;
 
-		pipe->send(packet, 8);
-		return;
+		co_await pipe->write(packet, 8);
+		co_return netkit::pipe_ptr();
 	}
 
 	netkit::endpoint inf(dst);
-	worker(pipe, inf, [port, dst](netkit::pipe* p, rslt ec) {
-
-		u8 rp[8];
+	co_return co_await worker(pipe, inf, [port, dst](u8* rp, rslt ec) -> signed_t {
 
 		rp[0] = 0;
 
@@ -905,9 +1630,10 @@ void handler_socks::handshake4(netkit::pipe* pipe)
 		}
 
 		rp[2] = (port>>8) & 0xff; rp[3] = port & 0xff;
-		*(u32*)(rp + 4) = (u32)dst;
+		uint32_t ip4 = (uint32_t)(u32)dst;
+		memcpy(rp + 4, &ip4, 4);
 
-		p->send(rp, 8);
+		return 8;
 	});
 }
 
@@ -920,20 +1646,20 @@ namespace
 
 }
 
-void handler_socks::handshake5(netkit::pipe* pipe)
+netkit::co_task<netkit::pipe_ptr> handler_socks::handshake5(netkit::pipe* pipe)
 {
 	if (!allow_5)
-		return;
+		co_return netkit::pipe_ptr();
 
 	u8 packet[512];
-	signed_t rb = pipe->recv(packet, -1);
+	signed_t rb = co_await pipe->read_exact(packet, 1);
 	if (rb != 1)
-		return;
+		co_return netkit::pipe_ptr();
 
 	signed_t numauth = packet[0];
-	rb = pipe->recv(packet, -numauth);
+	rb = co_await pipe->read_exact(packet, numauth);
 	if (numauth != rb)
-		return;
+		co_return netkit::pipe_ptr();
 
 	u8 rauth = 0xff;
 
@@ -954,37 +1680,38 @@ void handler_socks::handshake5(netkit::pipe* pipe)
 
 	packet[0] = 5;
 	packet[1] = rauth;
-	if (pipe->send(packet, 2) == netkit::pipe::SEND_FAIL || rauth == 0xff)
-		return;
+	if (!co_await pipe->write(packet, 2) || rauth == 0xff)
+		co_return netkit::pipe_ptr();
 
 	if (rauth == 2)
 	{
 		// wait for auth packet
-		rb = pipe->recv(packet, -2);
+		rb = co_await pipe->read_exact(packet, 2);
 		if (rb != 2 || packet[0] != 1)
-			return;
+			co_return netkit::pipe_ptr();
 		signed_t loginlen = 1 + packet[1]; // and one byte - len of pass
-		rb = pipe->recv(packet, -loginlen);
+		rb = co_await pipe->read_exact(packet, loginlen);
 		if (rb != loginlen)
-			return;
+			co_return netkit::pipe_ptr();
 		str::astr rlogin, rpass;
 		rlogin.append((const char *)packet, loginlen - 1);
 		signed_t passlen = packet[loginlen - 1];
-		rb = pipe->recv(packet, -passlen);
+		rb = co_await pipe->read_exact(packet, passlen);
 		if (rb != passlen)
-			return;
+			co_return netkit::pipe_ptr();
 		rpass.append((const char*)packet, passlen);
 
 		if (rlogin != login || rpass != pass)
 		{
 			packet[0] = 1;
 			packet[1] = 1;
-			pipe->send(packet, 2);
-			return;
+			co_await pipe->write(packet, 2);
+			co_return netkit::pipe_ptr();
 		}
 		packet[0] = 1;
 		packet[1] = 0;
-		pipe->send(packet, 2);
+		if (!co_await pipe->write(packet, 2))
+			co_return netkit::pipe_ptr();
 	}
 
 	auto fail_answer = [&](u8 code)
@@ -995,14 +1722,14 @@ void handler_socks::handshake5(netkit::pipe* pipe)
 		packet[3] = 1; // ATYPE // ip4
 		packet[4] = 0; packet[5] = 0; packet[6] = 0; packet[7] = 0;
 		packet[8] = 0; packet[9] = 0;
-		pipe->send(packet, 10);
+		return pipe->write(packet, 10);
 	};
 
-	rb = pipe->recv(packet, -5);
+	rb = co_await pipe->read_exact(packet, 5);
 	if (rb != 5 || packet[0] != 5)
 	{
-		fail_answer(1); // FAILURE
-		return;
+		co_await fail_answer(1); // FAILURE
+		co_return netkit::pipe_ptr();
 	}
 
 	if (packet[1] == 3 /* udp assoc */)
@@ -1011,32 +1738,23 @@ void handler_socks::handshake5(netkit::pipe* pipe)
 		switch (packet[3])
 		{
         case 1: // ip4
-            rb = pipe->recv(packet + 5, -3-2);
-            if (rb != 3)
-                return;
+            rb = co_await pipe->read_exact(packet + 5, 3+2);
             break;
         case 3: // domain name
-
-            numauth = packet[4]; // len of domain
-            rb = pipe->recv(packet, -numauth-2);
-            if (rb != numauth)
-                return;
+            rb = co_await pipe->read_exact(packet + 5, packet[4]+2); // len of domain
             break;
-
         case 4: // ipv6
-            rb = pipe->recv(packet + 5, -15-2); // read 15 of 16 bytes of ipv6 address (1st byte already read) and 2 bytes port
-            if (rb != 15)
-                return;
+            rb = co_await pipe->read_exact(packet + 5, 15+2); // read 15 of 16 bytes of ipv6 address (1st byte already read) and 2 bytes port
             break;
 		}
 		//udp_assoc_listener udpl;
-		return;
+		co_return netkit::pipe_ptr();
 	}
 
 	if (packet[1] != 1 /* only CONNECT for now */)
 	{
-		fail_answer(7); // COMMAND NOT SUPPORTED
-		return;
+		co_await fail_answer(7); // COMMAND NOT SUPPORTED
+		co_return netkit::pipe_ptr();
 	}
 
 	netkit::endpoint ep;
@@ -1044,38 +1762,40 @@ void handler_socks::handshake5(netkit::pipe* pipe)
 	switch (packet[3])
 	{
 	case 1: // ip4
-		rb = pipe->recv(packet + 5, -3);
+		rb = co_await pipe->read_exact(packet + 5, 3);
 		if (rb != 3)
-			return;
+			co_return netkit::pipe_ptr();
 		ep.set_ipap(netkit::ipap::build(packet + 4, 4));
 		break;
 	case 3: // domain name
 
 		numauth = packet[4]; // len of domain
-		rb = pipe->recv(packet, -numauth);
+		rb = co_await pipe->read_exact(packet, numauth);
 		if (rb != numauth)
-			return;
+			co_return netkit::pipe_ptr();
 		ep.set_domain( str::astr((const char *)packet, numauth) );
 		break;
 
 	case 4: // ipv6
-		rb = pipe->recv(packet + 5, -15); // read 15 of 16 bytes of ipv6 address (1st byte already read)
+		rb = co_await pipe->read_exact(packet + 5, 15); // read 15 of 16 bytes of ipv6 address (1st byte already read)
 		if (rb != 15)
-			return;
+			co_return netkit::pipe_ptr();
 		ep.set_ipap(netkit::ipap::build(packet + 4, 16));
 		break;
+
+	default:
+		co_await fail_answer(8); // ADDRESS TYPE NOT SUPPORTED
+		co_return netkit::pipe_ptr();
 	}
 
-	rb = pipe->recv(packet, -2);
+	rb = co_await pipe->read_exact(packet, 2);
 	if (rb != 2)
-		return;
+		co_return netkit::pipe_ptr();
 
 	signed_t port = ((signed_t)packet[0]) << 8 | packet[1];
 	ep.set_port(port);
 
-	worker(pipe, ep, [port, &ep](netkit::pipe* p, rslt ec) {
-
-		u8 rp[10];
+	co_return co_await worker(pipe, ep, [port](u8* rp, rslt ec) -> signed_t {
 
 		rp[0] = 5; // VER
 		rp[2] = 0;
@@ -1094,26 +1814,21 @@ void handler_socks::handshake5(netkit::pipe* pipe)
 			break;
 		}
 
-		*(u32*)(rp + 4) = 0; // (u32)ep.get_ip(conf::gip_only4);
+		rp[4] = 0; rp[5] = 0; rp[6] = 0; rp[7] = 0; // (u32)ep.get_ip(conf::gip_only4);
 		rp[8] = (port >> 8) & 0xff;
 		rp[9] = port & 0xff;
-		p->send(rp, 10);
+		return 10;
 	});
 }
 
 
-void handler_socks::worker(netkit::pipe* pipe, netkit::endpoint &inf, sendanswer answ)
+netkit::co_task<netkit::pipe_ptr> handler_socks::worker(netkit::pipe* pipe, netkit::endpoint &inf, makeanswer answ)
 {
 	// now try to connect to out
 
-	netkit::pipe_ptr p(pipe);
-	if (netkit::pipe_ptr outcon = connect(inf, false))
-	{
-		answ( pipe, EC_GRANTED );
-		bridge(std::move(p), std::move(outcon));
-	}
-	else {
-		answ(pipe, EC_REMOTE_HOST_UNRCH);
-	}
-
+	u8 rp[16];
+	netkit::pipe_ptr outcon = co_await connect(inf);
+	if (!co_await pipe->write(rp, answ(rp, outcon != nullptr ? EC_GRANTED : EC_REMOTE_HOST_UNRCH)))
+		co_return netkit::pipe_ptr();
+	co_return outcon;
 }
@@ -1,6 +1,12 @@
 #pragma once
 
+#ifdef USE_EPOLL
+#define MAXIMUM_SLOTS ((MAXIMUM_WAITABLES / 2) - 1)
+#else
 #define MAXIMUM_SLOTS 30 // only 30 due each slot - two sockets, but maximum sockets per thread are 64
+#endif
+
+#define TIMER_TICK_MS 1000 // resolution of idle and handshake timeouts
 
 class listener;
 
@@ -29,23 +35,61 @@ class handler
 {
 protected:
 
+	struct negotiation // handshake coroutine of accepted client; resumed by bridge worker
+	{
+		netkit::co_context ctx;
+		netkit::co_task<netkit::pipe_ptr> task; // result is connection to target requested by client (nullptr if failed)
+		signed_t connid = 0; // non-zero while connect_pool connects to ctx.target; connect ticket + 1 (see connslots)
+	};
+
 	struct bridged
 	{
 		netkit::pipe_ptr pipe1;
-		netkit::pipe_ptr pipe2;
-		size_t mask1 = 0;
-		size_t mask2 = 0;
+		netkit::pipe_ptr pipe2; // during handshake: nullptr or connection to upstream proxy being negotiated
+		handler* owner = nullptr;
+		std::unique_ptr<negotiation> hs; // client is not negotiated yet
+		tools::timing_wheel<bridged>::node timer{ this }; // handshake or idle timeout
+		u64 active = 0; // timer tick of last transfer (of start, if handshake)
+		signed_t index1 = -1; // registration indices in waiter
+		signed_t index2 = -1;
+		signed_t queued = 0; // bytes buffered by pipes for sending; accounted in owner and glb
+#ifdef USE_SPLICE
+		std::unique_ptr<netkit::splicer> splice12; // zero-copy mode of direction pipe1 -> pipe2
+		std::unique_ptr<netkit::splicer> splice21;
+		bool nosplice = false; // pipes are not plain tcp pipes
+		void prepare_splice();
+		bool splice_empty() const
+		{
+			return (!splice12 || splice12->is_empty()) && (!splice21 || splice21->is_empty());
+		}
+#endif
 
 #ifdef LOG_TRAFFIC
 		traffic_logger loger;
 #endif
 
+		void account(); // updates queued
+		void unqueue(); // bridge is going away or moves to another worker
+		bool pressure() const; // memory budget of owner or global one is exceeded
+		bool paused(netkit::pipe* to) const; // source of to must not be read: memory budget is exceeded and to holds too much data
+		signed_t queued_to(netkit::pipe* to) const; // bytes waiting to be sent to given pipe (including kernel pipe of splicer)
+		bool blocked(netkit::pipe* to) const; // source of to must not be read now: to can't accept data or budget pause
+
 		void clear()
 		{
+			unqueue();
+			hs.reset(); // coroutine frame refers to pipes
+			timer.cancel();
 			pipe1 = nullptr;
 			pipe2 = nullptr;
-			mask1 = 0;
-			mask2 = 0;
+			owner = nullptr;
+			index1 = -1;
+			index2 = -1;
+#ifdef USE_SPLICE
+			splice12.reset();
+			splice21.reset();
+			nosplice = false;
+#endif
 #ifdef LOG_TRAFFIC
 			loger.clear();
 #endif
@@ -53,19 +97,95 @@ protected:
 
 		bool is_empty() const
 		{
-			return pipe1 == nullptr || pipe2 == nullptr;
+			return pipe1 == nullptr || (pipe2 == nullptr && !hs);
 		}
 
+#ifdef USE_EPOLL
+		bool attach(netkit::pipe_waiter& w, signed_t slot)
+		{
+			if (!w.attach(pipe1, slot * 2)) return false;
+			if (pipe2 != nullptr && !w.attach(pipe2, slot * 2 + 1))
+			{
+				w.detach(pipe1);
+				return false;
+			}
+			index1 = slot * 2;
+			index2 = pipe2 != nullptr ? slot * 2 + 1 : -1;
+			return true;
+		}
+		void detach(netkit::pipe_waiter& w)
+		{
+			w.detach(pipe1);
+			if (pipe2 != nullptr)
+				w.detach(pipe2);
+			index1 = -1;
+			index2 = -1;
+		}
+		void reindex(netkit::pipe_waiter& w, signed_t slot)
+		{
+			if (index1 < 0)
+				return; // not attached
+			index1 = slot * 2;
+			w.reindex(pipe1, index1);
+			if (index2 >= 0)
+			{
+				index2 = slot * 2 + 1;
+				w.reindex(pipe2, index2);
+			}
+		}
+		void update_flow(netkit::pipe_waiter& w)
+		{
+			if (hs)
+			{
+				// only awaited pipe is not muted
+				w.check_ready(pipe1);
+				if (pipe2 != nullptr)
+					w.check_ready(pipe2);
+				return;
+			}
+			// don't read side whose data can't be sent now; socket buffers will hold it and slow down the peer
+			account();
+			w.mute(pipe1, blocked(pipe2.get()) || pipe1->recv_stalled());
+			w.mute(pipe2, blocked(pipe1.get()) || pipe2->recv_stalled());
+			w.check_ready(pipe1);
+			w.check_ready(pipe2);
+		}
+#else
 		bool prepare_wait(netkit::pipe_waiter& w)
 		{
-			mask1 = w.reg(pipe1); if (mask1 == 0) return false;
-			mask2 = w.reg(pipe2); if (mask2 == 0)
+			if (hs)
+			{
+				netkit::WAITABLE w1 = pipe1->get_waitable();
+				if (w1 == NULL_WAITABLE)
+					return false;
+				w1->muted = !hs->ctx.waits(pipe1.get(), netkit::co_context::CW_READ);
+				index1 = w.reg(pipe1);
+				index2 = -1;
+				if (index1 < 0 || pipe2 == nullptr)
+					return index1 >= 0;
+				netkit::WAITABLE w2 = pipe2->get_waitable();
+				if (w2 == NULL_WAITABLE)
+					return false;
+				w2->muted = !hs->ctx.waits(pipe2.get(), netkit::co_context::CW_READ);
+				index2 = w.reg(pipe2);
+				return index2 >= 0;
+			}
+			netkit::WAITABLE w1 = pipe1->get_waitable(), w2 = pipe2->get_waitable();
+			if (w1 == NULL_WAITABLE || w2 == NULL_WAITABLE)
+				return false;
+			// don't read side whose data can't be sent now
+			account();
+			w1->muted = blocked(pipe2.get()) || pipe1->recv_stalled();
+			w2->muted = blocked(pipe1.get()) || pipe2->recv_stalled();
+			index1 = w.reg(pipe1); if (index1 < 0) return false;
+			index2 = w.reg(pipe2); if (index2 < 0)
 			{
 				w.unreg_last();
 				return false;
 			}
 			return true;
 		}
+#endif
 
 		enum process_result
 		{
@@ -78,86 +198,156 @@ protected:
 
 	};
 
-	class tcp_processing_thread
+	struct bridge_request // new bridge (or handshake, or connect result) for worker; node of lock-free stack
+	{
+		netkit::pipe_ptr pipe1;
+		netkit::pipe_ptr pipe2;
+		handler* owner;
+		bridge_request* next = nullptr;
+		std::unique_ptr<negotiation> hs; // pipe1 is accepted client, pipe2 is nullptr
+		signed_t connid = 0; // result of connect: pipe2 is connection to target of handshake connid (nullptr if failed)
+		netkit::connect_result cresult = netkit::CR_OK; // result of connect
+	};
+
+	class tcp_processing_thread // bridge worker; serves bridges of all handlers
 	{
-		//volatile spinlock::long3264 sync = 0;
-		spinlock::syncvar<signed_t> numslots;
 		netkit::pipe_waiter waiter;
 		std::array<bridged, MAXIMUM_SLOTS> slots;
-		std::unique_ptr<tcp_processing_thread> next;
+		signed_t numslots = 0; // only worker thread touches slots
+		std::atomic<bridge_request*> incoming = nullptr; // pushed by any thread, taken by worker
+		std::atomic<signed_t> load = 0; // number of bridges assigned to this worker (incoming and active)
+		signed_t stopgen = 0; // last seen generation of stopped handlers
+		signed_t balance_time = 0;
+		std::vector<signed_t> connslots; // slot of handshake by connect ticket (-1 - slot killed); ticket is free again when connect result comes
+		std::vector<signed_t> freetickets;
+		tools::timing_wheel<bridged> timers;
+		signed_t timers_time; // ms of current tick of timers
+		bool core; // one of fixed workers; extra workers exist only while core ones are full
+#ifdef USE_EPOLL
+		signed_t numattached = 0; // slots [0..numattached) are attached to waiter; new slots are appended by take_incoming
+		void attach_new();
+#endif
+		std::vector<signed_t> deadslots; // slots cleared during tick
 
 		void moveslot(signed_t to, signed_t from)
 		{
 			ASSERT(to <= from);
+			slots[to].unqueue(); // overwritten or removed
 			if (to < from)
 			{
 				slots[to] = std::move(slots[from]);
+#ifdef USE_EPOLL
+				slots[to].reindex(waiter, to);
+#endif
+				if (slots[to].hs && slots[to].hs->connid != 0)
+					connslots[slots[to].hs->connid - 1] = to; // connect result finds it here
 			}
+			slots[from].queued = 0; // now accounted by slots[to]
 			slots[from].pipe1 = nullptr;
 			slots[from].pipe2 = nullptr;
+			slots[from].owner = nullptr;
+			slots[from].hs.reset();
+			slots[from].timer.cancel();
+			slots[from].index1 = -1;
+			slots[from].index2 = -1;
+#ifdef USE_SPLICE
+			slots[from].splice12.reset();
+			slots[from].splice21.reset();
+			slots[from].nosplice = false;
+#endif
 #ifdef LOG_TRAFFIC
 			slots[from].loger.clear();
 #endif
 		}
 
+		void take_incoming();
+		signed_t connect_ticket(signed_t i); // connid for connect of handshake of slot i
+		void connected(bridge_request* r); // connect of handshake finished
+		bool shake(signed_t i); // resume handshake coroutine; returns false if slot is dead
+		bool negotiated(signed_t i); // handshake coroutine finished; returns false if slot is dead
+		bool handshake_event(signed_t i, netkit::pipe_waiter::mask& masks); // returns false if slot is dead
+		void kill_slot(signed_t i); // closes bridge
+		void arm(bridged& br); // (re)start timeout of bridge or handshake since br.active
+		void expired(bridged* br);
+		void advance_timers();
+		long wait_time() const; // microseconds till next timer tick to be processed
+		void stop_handlers(); // kill bridges of stopped handlers
+		void rebalance(); // move some bridges to least loaded worker
+		void remove_dead(); // compact slots after kill_slot/rebalance
+
 	public:
+		tcp_processing_thread(bool core) :timers_time(chrono::ms()), core(core) {}
+		~tcp_processing_thread();
+
+		bool is_core() const { return core; }
+		signed_t get_load() const { return load; }
+		bool reserve(); // reserve place for new bridge (any thread); returns false if worker is full
+		void add(bridge_request* r); // any thread; place must be reserved
 		void signal()
 		{
 			waiter.signal();
 		}
-		bool transplant(signed_t slot, tcp_processing_thread* to);
-		tcp_processing_thread* get_next()
-		{
-			return next.get();
-		}
-		tcp_processing_thread* get_next_and_forget()
-		{
-			tcp_processing_thread* n = next.get();
-			next.release();
-			return n;
-		}
-		std::unique_ptr<tcp_processing_thread>* get_next_ptr()
-		{
-			return &next;
-		}
-		void close();
-		signed_t try_add_bridge(netkit::pipe* pipe1, netkit::pipe* pipe2)
-		{
-			auto ns = numslots.lock_read();
-			if (ns() < 0)
-				return -1;
-			if (ns() < MAXIMUM_SLOTS)
-			{
-				ns.unlock();
-				auto nsw = numslots.lock_write();
-
-				// check again
-				if (nsw() < 0)
-					return -1;
-				if (nsw() >= MAXIMUM_SLOTS)
-					return 0;
-
-				ASSERT(slots[nsw()].pipe1 == nullptr);
-				ASSERT(slots[nsw()].pipe2 == nullptr);
-
-				slots[nsw()].pipe1 = pipe1;
-				slots[nsw()].pipe2 = pipe2;
-				slots[nsw()].mask1 = 0;
-				slots[nsw()].mask2 = 0;
-				++nsw();
-				return 1;
-			}
-			return 0;
-		}
-		/*
-		signed_t check()
-		{
-			return numslots.lock_read()() < 0 ? -1 : 0;
-		}
-		*/
-		signed_t tick(u8 *data); // returns -1 to stop, 0..numslots - inactive slot index (4 forward), >MAXIMUM_SLOTS - do nothing
+
+		void tick(u8 *data);
+		void work(signed_t cpu); // thread proc
 	};
 
+	class bridge_pool // fixed set of bridge workers (one per core by default); new bridges go to least loaded one
+	{
+		spinlock::syncvar<std::vector<std::unique_ptr<tcp_processing_thread>>> workers; // core workers first
+		std::atomic<signed_t> stopgen = 0;
+		signed_t numcore = 0;
+
+		void start(tcp_processing_thread* w, signed_t cpu);
+
+	public:
+		bridge_pool();
+
+		void add(handler* h, netkit::pipe_ptr& pipe1, netkit::pipe_ptr& pipe2, negotiation* hs = nullptr); // pipe2 is nullptr if hs
+		tcp_processing_thread* least_loaded(tcp_processing_thread* except); // returns reserved worker or nullptr; non-null except - core workers only (rebalancing)
+		tcp_processing_thread* home(signed_t shard); // returns reserved core worker of acceptor shard or nullptr if it is full
+		signed_t core_count() const { return numcore; }
+		bool release(tcp_processing_thread* w); // extra worker with no bridges is deleted; returns true if deleted
+		void stop_handler(); // some handler stopped; workers will close its bridges
+		signed_t stop_generation() const { return stopgen; }
+	};
+
+	static bridge_pool& pool();
+
+	struct connect_request
+	{
+		tcp_processing_thread* worker; // connect result goes back to this worker
+		handler* owner;
+		netkit::endpoint target;
+		signed_t connid;
+		signed_t timeout; // ms
+		std::unique_ptr<netkit::tcp_connector> conn; // target is resolved; connecting
+	};
+
+	class connect_pool // connects to targets of handshakes: one loop thread drives non-blocking connects of all of them; dns blocks, so resolver threads are reused and exit when idle
+	{
+		std::mutex mut;
+		std::condition_variable cv;
+		tools::fifo<connect_request*> q; // not resolved yet
+		signed_t queued = 0;
+		signed_t idle = 0;
+
+		spinlock::syncvar<std::vector<connect_request*>> resolved; // taken by loop
+		SOCKET sig[2] = { INVALID_SOCKET, INVALID_SOCKET }; // wakes loop up
+		bool looping = false; // under mut
+
+		void resolve(); // resolver thread
+		void loop(); // connect loop thread
+		void start_connect(connect_request* r, std::vector<netkit::ipap>&& ips);
+		static void reply(connect_request* r, netkit::pipe_ptr&& outcon, netkit::connect_result cr);
+
+	public:
+		void add(connect_request* r);
+		void signal(); // wake loop up (i.e. handler stopped: its connects are cancelled)
+	};
+
+	static connect_pool& connector();
+
 	struct send_data
 	{
         netkit::endpoint tgt;
@@ -250,7 +440,13 @@ protected:
 
 	};
 
-	spinlock::syncvar<std::unique_ptr<tcp_processing_thread>> tcp_pth; // list of tcp threads
+	std::atomic<signed_t> numbridges = 0; // bridges of this handler in pool
+	std::atomic<signed_t> queued = 0; // bytes buffered by pipes of bridges for sending
+	std::atomic<bool> pressure = false; // queued exceeded buffer_budget and not yet fell below low watermark
+	signed_t buffer_budget = 0; // bytes; 0 - only global budget
+	signed_t idle_timeout = 0; // ms; bridge without transfers is closed; 0 - never (default: quiet long-lived tunnels must survive)
+	signed_t handshake_timeout = 30000; // ms; includes connect to target
+	signed_t connect_timeout = DEFAULT_CONNECT_TIMEOUT; // ms; tcp connect to target or first proxy of chain (unless proxy has its own)
 	std::unordered_map<netkit::ipap, ptr::shared_ptr<udp_processing_thread>> udp_pth; // only accept thread can modify this map
 	spinlock::syncvar<std::vector<netkit::ipap>> finished; // keys of finished threads
 
@@ -259,19 +455,19 @@ protected:
 
 	volatile bool need_stop = false;
 
-	void bridge(netkit::pipe_ptr &&pipe1, netkit::pipe_ptr &&pipe2); // either does job in current thread or forwards job to another thread with same endpoint
-	void bridge(tcp_processing_thread *npt);
+	void bridge(netkit::pipe_ptr &&pipe1, netkit::pipe_ptr &&pipe2); // hands bridge to pool; returns immediately
+	void negotiate(netkit::pipe_ptr &&pipe, netkit::co_task<netkit::pipe_ptr> &&handshake); // hands accepted pipe to pool; bridge worker runs handshake coroutine and then bridges pipe with its result
 
 	void release_udps(); // must be called from listener thread
 	void release_udp(udp_processing_thread *udp_wt);
-	void release_tcp(tcp_processing_thread* udp_wt);
 
 public:
 	handler(loader& ldr, listener* owner, const asts& bb);
 	virtual ~handler() { stop(); }
 
 	void stop();
-	netkit::pipe_ptr connect(netkit::endpoint& addr, bool direct); // just connect to remote host using current handler's proxy settings
+	static void acceptor_shard(signed_t shard); // calling thread accepts for core bridge worker shard; its new bridges go to that worker
+	netkit::co_task<netkit::pipe_ptr> connect(netkit::endpoint& addr); // just connect to remote host using current handler's proxy settings
 
 	virtual str::astr desc() const = 0;
 	virtual bool compatible(netkit::socket_type /*st*/) const
@@ -302,7 +498,7 @@ class handler_direct : public handler // just port mapper
 	str::astr to_addr; // in format like: tcp://domain_or_ip:port
 	netkit::endpoint ep; // only accessed from listener thread
 
-	void tcp_worker(netkit::pipe* pipe); // sends all from pipe to out connection
+	netkit::co_task<netkit::pipe_ptr> tcp_worker(); // connects to mapped address
 	void udp_worker(netkit::socket* lstnr, udp_processing_thread* udp_wt);
 	signed_t udp_timeout_ms = 5000;
 
@@ -337,14 +533,13 @@ class handler_socks : public handler // socks4 and socks5
 	bool allow_4 = true;
 	bool allow_5 = true;
 
-	void handshake4(netkit::pipe* pipe);
-	void handshake5(netkit::pipe* pipe);
-
-	void handshake(netkit::pipe* pipe);
+	netkit::co_task<netkit::pipe_ptr> handshake(netkit::pipe* pipe);
+	netkit::co_task<netkit::pipe_ptr> handshake4(netkit::pipe* pipe);
+	netkit::co_task<netkit::pipe_ptr> handshake5(netkit::pipe* pipe);
 
-	using sendanswer = std::function< void(netkit::pipe* pipe, rslt ecode) >;
+	using makeanswer = std::function< signed_t(u8* packet, rslt ecode) >; // returns size of answer
 
-	void worker(netkit::pipe* pipe, netkit::endpoint& inf, sendanswer answ);
+	netkit::co_task<netkit::pipe_ptr> worker(netkit::pipe* pipe, netkit::endpoint& inf, makeanswer answ);
 
 public:
 	handler_socks(loader& ldr, listener* owner, const asts& bb, const str::astr_view &st);
@@ -159,11 +159,33 @@ tcp_listener::tcp_listener(loader& ldr, const str::astr& name, const asts& bb) :
 		LOG_E("handler %s is not compatible with listener [%s] (TCP not supported)", str::printable(hand->desc()), str::printable(name));
 		return;
 	}
+
+	acceptors = math::maxv(1, bb.get_int(ASTR("acceptors"), 1));
+#ifdef _WIN32
+	if (acceptors > 1)
+	{
+		LOG_W("{acceptors} of listener [%s] ignored: sharded accept requires SO_REUSEPORT (linux only)", str::printable(name));
+		acceptors = 1;
+	}
+#endif
+#ifdef _NIX
+	if (acceptors > 1)
+		shards.resize(acceptors);
+#endif
 }
 
 #ifdef _NIX
 /*virtual*/ void tcp_listener::kick_socket()
 {
+	if (acceptors > 1)
+	{
+		// fake connection would wake only one of acceptors; shutdown of listening socket wakes its poll
+		for (netkit::waitable_socket& s : shards)
+			if (s.ready())
+				shutdown(s.sock(), SHUT_RD);
+		return;
+	}
+
     auto st = state.lock_read();
     netkit::ipap cnct = netkit::ipap::localhost(st().bind.v4);
     if (!st().bind.is_wildcard())
@@ -175,8 +197,91 @@ tcp_listener::tcp_listener(loader& ldr, const str::astr& name, const asts& bb) :
 }
 #endif
 
+static void accept_failed(const str::astr& name, bool& failing) // tcp_accept returned nullptr
+{
+#ifdef _WIN32
+	int err = WSAGetLastError();
+	bool transient = err == WSAEWOULDBLOCK || err == WSAECONNRESET || err == WSAEINTR;
+#endif
+#ifdef _NIX
+	int err = errno;
+	bool transient = err == EAGAIN || err == EWOULDBLOCK || err == ECONNABORTED || err == EINTR;
+#endif
+	if (transient || glb.is_stop())
+		return;
+
+	// i.e. out of descriptors: connection stays in backlog and listening socket stays readable, so don't spin on it
+	if (!failing)
+		LOG_W("listener [%s] can't accept connections (error %i); retrying", str::printable(name), err);
+	failing = true;
+	Sleep(100);
+}
+
+#ifdef _NIX
+void tcp_listener::accept_shard(signed_t shard)
+{
+	netkit::waitable_socket* s = &shards[shard];
+	handler::acceptor_shard(shard);
+	netkit::make_nonblocking(s->get_waitable());
+
+	bool failing = false;
+	for (; !state.lock_read()().need_stop;)
+	{
+		pollfd p = { s->sock(), POLLIN };
+		if (poll(&p, 1, LOOP_PERIOD / 1000) <= 0)
+			continue; // timeout - check stop
+
+		// take whole backlog at once; non-blocking accept returns nullptr when it is empty
+		for (; !state.lock_read()().need_stop;)
+		{
+			netkit::tcp_pipe* pipe = s->tcp_accept(name);
+			if (nullptr == pipe)
+			{
+				accept_failed(name, failing);
+				break;
+			}
+			failing = false;
+			hand->on_pipe(pipe);
+		}
+	}
+}
+#endif
+
 /*virtual*/ void tcp_listener::accept_impl(const netkit::ipap& bind2)
 {
+#ifdef _NIX
+	if (acceptors > 1)
+	{
+		for (netkit::waitable_socket& s : shards)
+		{
+			if (!s.listen(name, bind2, true))
+			{
+				for (netkit::waitable_socket& x : shards)
+					x.close(false);
+				return;
+			}
+		}
+
+#ifdef _DEBUG
+		accept_tid = spinlock::tid_self();
+#endif // _DEBUG
+
+		LOG_N("listener {%s} has been started (bind ip: %s, port: %i, acceptors: %i)", str::printable(name), bind2.to_string(false).c_str(), bind2.port, acceptors);
+
+		std::vector<std::thread> ths;
+		for (signed_t i = 1; i < acceptors; ++i)
+			ths.emplace_back(&tcp_listener::accept_shard, this, i);
+		accept_shard(0);
+		for (std::thread& th : ths)
+			th.join();
+		for (netkit::waitable_socket& s : shards)
+			s.close(false);
+
+		hand->stop();
+		return;
+	}
+#endif
+
 	if (sock.listen(name, bind2))
 	{
 #ifdef _DEBUG
@@ -185,11 +290,17 @@ tcp_listener::tcp_listener(loader& ldr, const str::astr& name, const asts& bb) :
 
 		LOG_N("listener {%s} has been started (bind ip: %s, port: %i)", str::printable(name), bind2.to_string(false).c_str(), bind2.port);
 
+		bool failing = false;
 		for (; !state.lock_read()().need_stop;)
 		{
 			netkit::tcp_pipe* pipe = sock.tcp_accept(name);
-			if (nullptr != pipe)
-				hand->on_pipe(pipe);
+			if (nullptr == pipe)
+			{
+				accept_failed(name, failing);
+				continue;
+			}
+			failing = false;
+			hand->on_pipe(pipe);
 		}
 
 		hand->stop();
@@ -73,6 +73,12 @@ public:
 class tcp_listener : public socket_listener
 {
 	netkit::waitable_socket sock;
+	signed_t acceptors = 1; // >1 - each acceptor thread has its own SO_REUSEPORT socket and feeds its own bridge worker (linux only)
+#ifdef _NIX
+	std::vector<netkit::waitable_socket> shards; // sockets of acceptors if acceptors > 1
+
+	void accept_shard(signed_t shard);
+#endif
 
 protected:
 	/*virtual*/ void accept_impl(const netkit::ipap& bind2) override;
@@ -127,6 +127,20 @@ bool loader::load_conf(const FN& cfp)
 		else if (dnso.starts_with(ASTR("sys")))
 			glb.cfg.dnso = conf::dnso_system;
 
+		glb.cfg.bridge_threads = settings->get_int("bridge_threads", glb.cfg.bridge_threads);
+		glb.cfg.pin_bridge_threads = settings->get_bool("pin_bridge_threads");
+		glb.cfg.connect_attempt_delay = settings->get_int("connect_attempt_delay", glb.cfg.connect_attempt_delay);
+		if (glb.cfg.connect_attempt_delay < 10) glb.cfg.connect_attempt_delay = 10;
+		glb.cfg.crypto_threads = settings->get_int("crypto_threads", glb.cfg.crypto_threads);
+		glb.cfg.crypto_offload = settings->get_int("crypto_offload", glb.cfg.crypto_offload);
+		if (glb.cfg.crypto_offload < 1) glb.cfg.crypto_offload = 1;
+		glb.cfg.mem_report = settings->get_int("mem_report", glb.cfg.mem_report);
+		glb.cfg.buffer_budget = settings->get_int("buffer_budget", 0) * 1024;
+
+#ifdef _NIX
+		glb.cfg.io_uring = settings->get_bool("io_uring");
+#endif
+
 
 #if (defined _DEBUG || defined _CRASH_HANDLER) && defined _WIN32
 		glb.cfg.crash_log_file = settings->get_string(ASTR("crash_log_file"), glb.cfg.crash_log_file);
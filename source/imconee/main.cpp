@@ -63,6 +63,11 @@ static void shapka()
 #ifdef _DEBUG
 void dns_test();
 void fifo_test();
+void poly1305_test();
+void aesgcm_test();
+#ifdef USE_IO_URING
+void uring_test();
+#endif
 #endif // _DEBUG
 
 int run_engine(bool as_service)
@@ -92,11 +97,18 @@ int run_engine(bool as_service)
         LOG_E("could not set control handler");
         return EXIT_FAIL_CTLHANDLE;
     }
+
+    signal(SIGPIPE, SIG_IGN); // send to closed peer must fail, not kill whole process with all its bridges
 #endif // _NIX
 
 #ifdef _DEBUG
 	dns_test();
 	fifo_test();
+	poly1305_test();
+	aesgcm_test();
+#ifdef USE_IO_URING
+	uring_test();
+#endif
 #endif
 
 	for (;;)
@@ -32,6 +32,16 @@ struct conf
 #endif
 	getip_options ipstack = gip_prior4;
 	dns_options dnso = dnso_internal_with_hosts;
+	signed_t bridge_threads = 0; // 0 - one per core
+	bool pin_bridge_threads = false;
+	signed_t connect_attempt_delay = 250; // ms; delay before next address is tried while previous one is still connecting
+	signed_t crypto_threads = 0; // workers that encrypt fast shadowsocks pipes; 0 - pipes are encrypted by their bridge workers
+	signed_t crypto_offload = 32768; // KB/s; pipe direction faster than this is encrypted by crypto workers
+	signed_t mem_report = 0; // sec; period of memory usage report; 0 - no report
+	signed_t buffer_budget = 0; // bytes; data buffered by all bridges for sending; 0 - unlimited
+#ifdef _NIX
+	bool io_uring = false;
+#endif
 
 	conf()
 	{
@@ -104,6 +114,8 @@ private:
 	volatile bool exit = false;
 public:
 	volatile spinlock::long3264 numlisteners = 0;
+	std::atomic<signed_t> queued = 0; // bytes buffered by pipes of all bridges for sending
+	std::atomic<bool> pressure = false; // queued exceeded cfg.buffer_budget and not yet fell below low watermark
 
 	void stop() { Print(); exit = true; }
 	bool is_stop() { return exit; }
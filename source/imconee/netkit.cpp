@@ -5,6 +5,13 @@
 #ifdef _NIX
 #include <sys/ioctl.h>
 #include <linux/sockios.h> // SIOCOUTQ
+#ifdef USE_EPOLL
+#include <sys/epoll.h>
+#include <sys/syscall.h> // epoll_pwait2
+#endif
+#ifdef USE_IO_URING
+#include "uring.h"
+#endif
 #endif
 
 namespace netkit
@@ -275,12 +282,16 @@ namespace netkit
 		{
 			if (flush_before_close)
 				/*int errm =*/ shutdown(sock(), SD_SEND);
+#ifdef USE_IO_URING
+			if (_socket.urec)
+				uring::forget(&_socket);
+#endif
 			closesocket(sock());
 			_socket = INVALID_SOCKET;
 		}
 	}
 
-	bool waitable_socket::listen(const str::astr& name, const ipap& bind2)
+	bool waitable_socket::listen(const str::astr& name, const ipap& bind2, bool reuseport)
 	{
 		if (glb.cfg.ipstack == conf::gip_only6 && bind2.v4)
 		{
@@ -297,6 +308,14 @@ namespace netkit
 		if (INVALID_SOCKET == sock())
 			return false;
 
+#ifdef _NIX
+		if (reuseport)
+		{
+			int one = 1;
+			setsockopt(sock(), SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one)); // kernel spreads incoming connections between sockets
+		}
+#endif
+
 		if (bind2.bind(sock()) < 0)
 		{
 			LOG_W("bind failed for listener [%s]; check binding (%s)", str::printable(name), bind2.to_string(true).c_str());
@@ -445,69 +464,302 @@ namespace netkit
 		return tgt_ip.sendto(s, p);
 	}
 
+	static bool tune_tcp_socket(SOCKET s)
+	{
+		int val = 0;
+		socklen_t optl = sizeof(val);
+		if (SOCKET_ERROR == getsockopt(s, SOL_SOCKET, SO_RCVBUF, (char*)&val, &optl))
+			return false;
+		if (val < 128 * 1024)
+		{
+			val = 128 * 1024;
+			if (SOCKET_ERROR == setsockopt(s, SOL_SOCKET, SO_RCVBUF, (char*)&val, sizeof(val)))
+				return false;
+		}
+
+		if (SOCKET_ERROR == getsockopt(s, SOL_SOCKET, SO_SNDBUF, (char*)&val, &optl))
+			return false;
+		if (val < 128 * 1024)
+		{
+			val = 128 * 1024;
+			if (SOCKET_ERROR == setsockopt(s, SOL_SOCKET, SO_SNDBUF, (char*)&val, sizeof(val)))
+				return false;
+		}
+		else if (val > send_buffer_size)
+			send_buffer_size = val;
+
+		return true;
+	}
+
 	bool tcp_pipe::connect()
 	{
 		if (connected())
 			close(false);
 
-		_socket = ::socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+		_socket = ::socket(addr.v4 ? AF_INET : AF_INET6, SOCK_STREAM, IPPROTO_TCP);
 		if (INVALID_SOCKET == sock())
 			return false;
 
 		// LOG socket created
 
-		int val = 0;
-		socklen_t optl = sizeof(val);
-		if (SOCKET_ERROR == getsockopt(sock(), SOL_SOCKET, SO_RCVBUF, (char*)&val, &optl))
+		if (!tune_tcp_socket(sock()))
 		{
 			close(false);
 			return false;
 		}
-		if (val < 128 * 1024)
+
+		if (!addr.connect(sock()))
 		{
-			val = 128 * 1024;
-			if (SOCKET_ERROR == setsockopt(sock(), SOL_SOCKET, SO_RCVBUF, (char*)&val, sizeof(val)))
-			{
-				close(false);
-				return false;
-			}
+			close(false);
+			return false;
+		}
+
+		make_nonblocking(get_waitable());
+
+		// LOG connected
+
+		return true;
+	}
+
+	const char* connect_result_desc(connect_result r)
+	{
+		switch (r)
+		{
+		case CR_OK: return "connected";
+		case CR_REFUSED: return "refused";
+		case CR_TIMEOUT: return "timed out";
+		case CR_UNREACHABLE: return "unreachable";
+		default: return "failed";
 		}
+	}
 
-		if (SOCKET_ERROR == getsockopt(sock(), SOL_SOCKET, SO_SNDBUF, (char*)&val, &optl))
+	static connect_result classify_connect_error(int err)
+	{
+		switch (err)
 		{
-			close(false);
+#ifdef _WIN32
+		case WSAECONNREFUSED:
+			return CR_REFUSED;
+		case WSAETIMEDOUT:
+			return CR_TIMEOUT;
+		case WSAENETUNREACH:
+		case WSAEHOSTUNREACH:
+		case WSAENETDOWN:
+		case WSAEHOSTDOWN:
+			return CR_UNREACHABLE;
+#endif
+#ifdef _NIX
+		case ECONNREFUSED:
+			return CR_REFUSED;
+		case ETIMEDOUT:
+			return CR_TIMEOUT;
+		case ENETUNREACH:
+		case EHOSTUNREACH:
+		case ENETDOWN:
+		case EHOSTDOWN:
+			return CR_UNREACHABLE;
+#endif
+		}
+		return CR_FAILED;
+	}
+
+	int poll_sockets(pollfd* pfds, signed_t n, signed_t timeout_ms)
+	{
+#ifdef _WIN32
+		return WSAPoll(pfds, (ULONG)n, (INT)timeout_ms);
+#endif
+#ifdef _NIX
+		return ::poll(pfds, n, (int)timeout_ms);
+#endif
+	}
+
+	tcp_connector::tcp_connector(std::vector<ipap>&& ips_, signed_t timeout) :ips(std::move(ips_)), starttime(chrono::ms()), timeout(timeout)
+	{
+	}
+
+	tcp_connector::~tcp_connector()
+	{
+		for (const attempt& a : atts)
+			closesocket(a.s);
+		if (winner != INVALID_SOCKET)
+			closesocket(winner);
+	}
+
+	signed_t tcp_connector::elapsed() const
+	{
+		return (uint32_t)(chrono::ms() - starttime); // ms() may wrap
+	}
+
+	void tcp_connector::start_next(signed_t ct)
+	{
+		const ipap& ip = ips[next];
+		attempt a = { ::socket(ip.v4 ? AF_INET : AF_INET6, SOCK_STREAM, IPPROTO_TCP), next, ct };
+		++next;
+		nexttime = ct + glb.cfg.connect_attempt_delay;
+
+		if (INVALID_SOCKET == a.s)
+			return;
+		if (!tune_tcp_socket(a.s))
+		{
+			closesocket(a.s);
+			return;
+		}
+#ifdef _WIN32
+		u_long one(1);
+		ioctlsocket(a.s, FIONBIO, &one);
+#endif
+#ifdef _NIX
+		fcntl(a.s, F_SETFL, O_NONBLOCK | fcntl(a.s, F_GETFL));
+#endif
+		if (ip.connect(a.s))
+		{
+			winner = a.s; winneri = a.ipi;
+			LOG_D("connect: [%s] connected immediately", ip.to_string(true).c_str());
+			return;
+		}
+#ifdef _WIN32
+		int err = WSAGetLastError();
+		if (err == WSAEWOULDBLOCK)
+#endif
+#ifdef _NIX
+		int err = errno;
+		if (err == EINPROGRESS)
+#endif
+		{
+			atts.push_back(a);
+			return;
+		}
+		failed(a, err);
+	}
+
+	void tcp_connector::failed(const attempt& a, int err)
+	{
+		res = classify_connect_error(err);
+		LOG_D("connect: [%s] %s in %i ms (error %i)", ips[a.ipi].to_string(true).c_str(), connect_result_desc(res), elapsed() - a.start, err);
+		closesocket(a.s);
+	}
+
+	void tcp_connector::finish()
+	{
+		finished = true;
+
+		for (const attempt& a : atts)
+		{
+			LOG_D("connect: [%s] cancelled after %i ms", ips[a.ipi].to_string(true).c_str(), elapsed() - a.start);
+			closesocket(a.s);
+		}
+		atts.clear();
+
+		if (winner == INVALID_SOCKET)
+			return;
+
+		res = CR_OK;
+		if (winneri > 0)
+			LOG_N("connect: [%s] connected in %i ms (attempt %i of %i)", ips[winneri].to_string(true).c_str(), elapsed(), winneri + 1, ips.size());
+	}
+
+	bool tcp_connector::step()
+	{
+		if (finished)
+			return false;
+
+		signed_t ct = elapsed();
+		if (timeout > 0 && ct >= timeout && winner == INVALID_SOCKET)
+		{
+			res = CR_TIMEOUT;
+			finish();
 			return false;
 		}
-		if (val < 128 * 1024)
+
+		while (winner == INVALID_SOCKET && next < (signed_t)ips.size() && (ct >= nexttime || atts.empty())) // next attempt is due, or all previous ones have already failed
+			start_next(ct);
+
+		if (winner != INVALID_SOCKET || atts.empty())
 		{
-			val = 128 * 1024;
-			if (SOCKET_ERROR == setsockopt(sock(), SOL_SOCKET, SO_SNDBUF, (char*)&val, sizeof(val)))
+			finish();
+			return false;
+		}
+		return true;
+	}
+
+	void tcp_connector::add_polls(std::vector<pollfd>& pfds) const
+	{
+		for (const attempt& a : atts)
+		{
+			pollfd pfd = {};
+			pfd.fd = a.s;
+			pfd.events = POLLOUT;
+			pfds.push_back(pfd);
+		}
+	}
+
+	void tcp_connector::polled(const pollfd* pfds)
+	{
+		for (signed_t i = atts.size() - 1; i >= 0; --i)
+		{
+			if (pfds[i].revents == 0)
+				continue;
+
+			int err = 0;
+			socklen_t errl = sizeof(err);
+			if (SOCKET_ERROR == getsockopt(atts[i].s, SOL_SOCKET, SO_ERROR, (char*)&err, &errl))
+				err = -1;
+
+			if (err != 0)
+				failed(atts[i], err);
+			else if (winner != INVALID_SOCKET)
+				closesocket(atts[i].s); // another attempt won at same poll
+			else
 			{
-				close(false);
-				return false;
+				winner = atts[i].s; winneri = atts[i].ipi;
+				LOG_D("connect: [%s] established in %i ms (started at %i ms)", ips[winneri].to_string(true).c_str(), elapsed() - atts[i].start, atts[i].start);
 			}
+			atts.erase(atts.begin() + i);
 		}
-		else if (val > send_buffer_size)
-			send_buffer_size = val;
+	}
 
-		if (!addr.connect(sock()))
+	signed_t tcp_connector::wait_time() const
+	{
+		if (finished)
+			return 0;
+
+		signed_t ct = elapsed();
+		signed_t w = -1;
+		if (next < (signed_t)ips.size())
+			w = std::max(nexttime - ct, (signed_t)0);
+		if (timeout > 0)
 		{
-			close(false);
-			return false;
+			signed_t t = std::max(timeout - ct, (signed_t)0);
+			if (w < 0 || t < w)
+				w = t;
 		}
+		return w;
+	}
 
-		#ifdef _WIN32
-		// non-blocking mode
-		u_long one(1);
-		ioctlsocket(sock(), FIONBIO, (u_long*)&one);
-		#endif
-		#ifdef _NIX
-        fcntl(sock(), F_SETFL, O_NONBLOCK | fcntl(sock(),F_GETFL));
-		#endif
+	tcp_pipe* tcp_connector::take()
+	{
+		if (winner == INVALID_SOCKET)
+			return nullptr;
 
-		// LOG connected
+		tcp_pipe* p = new tcp_pipe();
+		p->_socket = winner;
+		p->addr = ips[winneri];
+		winner = INVALID_SOCKET;
+		make_nonblocking(p->get_waitable());
+		return p;
+	}
 
-		return true;
+	void make_nonblocking(WAITABLE w)
+	{
+		if (w == NULL_WAITABLE)
+			return;
+#ifdef _WIN32
+		u_long one(1);
+		ioctlsocket(w->s, FIONBIO, (u_long*)&one);
+#endif
+#ifdef _NIX
+		fcntl(w->s, F_SETFL, O_NONBLOCK | fcntl(w->s, F_GETFL));
+#endif
 	}
 
 #ifdef _WIN32
@@ -524,42 +776,126 @@ namespace netkit
 		return false;
 	}
 
-	pipe::sendrslt tcp_pipe::send(const u8* data, signed_t datasize)
+	void tcp_pipe::set_bufferfull(bool full)
 	{
-		if (data == nullptr)
-			return outbuf.is_empty() ? SEND_OK : SEND_BUFFERFULL;
+#ifdef _WIN32
+		WSAEventSelect(sock(), get_waitable()->wsaevent, full ? (FD_READ|FD_WRITE|FD_CLOSE) : (FD_READ|FD_CLOSE));
+#endif
+#ifdef _NIX
+		get_waitable()->bufferfull = full ? 1 : 0;
+#ifdef USE_EPOLL
+		pipe_waiter::update_interest(get_waitable());
+#endif
+#endif // _NIX
+	}
 
-		if (!outbuf.is_empty())
+	static signed_t sendv(SOCKET s, const std::span<const u8>* parts, signed_t n) // several parts by one call; returns sent bytes or SOCKET_ERROR
+	{
+#ifdef _WIN32
+		WSABUF bufs[tcp_pipe::max_iov];
+		for (signed_t i = 0; i < n; ++i)
 		{
-			if (datasize > 0)
-			{
-				auto d = std::span<const u8>(data, datasize);
-				outbuf.append(d);
-			}
-			auto d2s = outbuf.get_1st_chunk();
-
-			int iRetVal = ::send(sock(), (const char*)d2s.data(), int(d2s.size()), 0);
-			if (iRetVal == SOCKET_ERROR)
-			{
-				if (CHECK_IF_NOT_NOW)
-					return SEND_BUFFERFULL;
-				return SEND_FAIL;
-			}
-
-			outbuf.skip(iRetVal);
-			if (outbuf.is_empty())
-			{
+			bufs[i].buf = (CHAR*)parts[i].data();
+			bufs[i].len = (ULONG)parts[i].size();
+		}
+		DWORD sent = 0;
+		if (WSASend(s, bufs, (DWORD)n, &sent, 0, nullptr, nullptr) == SOCKET_ERROR)
+			return SOCKET_ERROR;
+		return sent;
+#endif
+#ifdef _NIX
+		iovec iov[tcp_pipe::max_iov];
+		for (signed_t i = 0; i < n; ++i)
+		{
+			iov[i].iov_base = (void*)parts[i].data();
+			iov[i].iov_len = parts[i].size();
+		}
+		msghdr msg = {};
+		msg.msg_iov = iov;
+		msg.msg_iovlen = n;
+		return ::sendmsg(s, &msg, 0);
+#endif
+	}
 
+	static signed_t recvv(SOCKET s, const std::span<u8>* parts, signed_t n) // same for receive
+	{
 #ifdef _WIN32
-				WSAEventSelect(sock(), get_waitable()->wsaevent, FD_READ|FD_CLOSE);
+		WSABUF bufs[2];
+		for (signed_t i = 0; i < n; ++i)
+		{
+			bufs[i].buf = (CHAR*)parts[i].data();
+			bufs[i].len = (ULONG)parts[i].size();
+		}
+		DWORD got = 0, flags = 0;
+		if (WSARecv(s, bufs, (DWORD)n, &got, &flags, nullptr, nullptr) == SOCKET_ERROR)
+			return SOCKET_ERROR;
+		return got;
 #endif
 #ifdef _NIX
-                get_waitable()->bufferfull = 0;
-#endif // _NIX
-				return SEND_OK;
-			}
+		iovec iov[2];
+		for (signed_t i = 0; i < n; ++i)
+		{
+			iov[i].iov_base = parts[i].data();
+			iov[i].iov_len = parts[i].size();
+		}
+		return ::readv(s, iov, (int)n);
+#endif
+	}
+
+	pipe::sendrslt pipe::send(std::span<const std::span<const u8>> parts)
+	{
+		sendrslt r = SEND_OK;
+		for (const std::span<const u8>& p : parts)
+		{
+			sendrslt pr = send(p.data(), p.size());
+			if (pr == SEND_FAIL)
+				return SEND_FAIL;
+			if (pr == SEND_BUFFERFULL)
+				r = SEND_BUFFERFULL;
+		}
+		return r;
+	}
+
+	pipe::sendrslt tcp_pipe::flush()
+	{
+		// whole backlog by one call
+		std::span<const u8> parts[max_iov];
+		signed_t n = 0;
+		if (!outslice.empty())
+			parts[n++] = std::span<const u8>(outslice.data(), outslice.size);
+		n += outbuf.get_chunks(parts + n, max_iov - n);
+
+		signed_t sent = sendv(sock(), parts, n);
+		if (sent == SOCKET_ERROR)
+		{
+			if (CHECK_IF_NOT_NOW)
+				return SEND_BUFFERFULL;
+			return SEND_FAIL;
+		}
+
+		signed_t fromslice = math::minv(sent, outslice.size);
+		if (fromslice > 0)
+			outslice.skip(fromslice);
+		if (sent > fromslice)
+			outbuf.skip(sent - fromslice);
 
+		if (!all_sent())
 			return SEND_BUFFERFULL;
+
+		set_bufferfull(false);
+		return SEND_OK;
+	}
+
+	pipe::sendrslt tcp_pipe::send(const u8* data, signed_t datasize)
+	{
+		if (data == nullptr)
+			return all_sent() ? SEND_OK : SEND_BUFFERFULL;
+
+		if (!all_sent())
+		{
+			if (datasize > 0)
+				outbuf.append(std::span<const u8>(data, datasize));
+			return flush();
 		}
 
 		if (datasize == 0)
@@ -578,13 +914,7 @@ namespace netkit
 
 		if (iRetVal < datasize)
 		{
-#ifdef _WIN32
-			WSAEventSelect(sock(), get_waitable()->wsaevent, FD_READ|FD_WRITE|FD_CLOSE);
-#endif
-#ifdef _NIX
-            // mark this pipe as bufferfull
-            get_waitable()->bufferfull = 1;
-#endif // _NIX
+			set_bufferfull(true);
 			auto d = std::span<const u8>(data+iRetVal, datasize-iRetVal);
 			outbuf.append(d);
 			return SEND_BUFFERFULL;
@@ -593,46 +923,237 @@ namespace netkit
 		return SEND_OK;
 	}
 
-	/*virtual*/ signed_t tcp_pipe::recv(u8* data, signed_t maxdatasz)
+	pipe::sendrslt tcp_pipe::send(std::span<const std::span<const u8>> parts)
 	{
-		if (maxdatasz < 0)
+		if (!all_sent())
 		{
-			try
+			for (const std::span<const u8>& p : parts)
+				outbuf.append(p);
+			return flush();
+		}
+
+		signed_t n = math::minv((signed_t)parts.size(), max_iov);
+		signed_t sent = sendv(sock(), parts.data(), n);
+		if (sent == SOCKET_ERROR)
+		{
+			if (!CHECK_IF_NOT_NOW)
+				return SEND_FAIL;
+			sent = 0;
+		}
+
+		// unsent rest (and parts beyond max_iov) waits in outbuf
+		for (const std::span<const u8>& p : parts)
+		{
+			if (sent >= (signed_t)p.size())
 			{
-				// need exactly -maxdatasz bytes
-				maxdatasz = -maxdatasz;
-				for (; rcvbuf.datasize() < maxdatasz;)
-				{
-					if (!rcv_all())
-						return -1;
-					if (rcvbuf.datasize() < maxdatasz)
-						wait(get_waitable(), LOOP_PERIOD);
-				}
-				rcvbuf.peek(data, maxdatasz);
-				return maxdatasz;
+				sent -= p.size();
+				continue;
 			}
-			catch (const std::exception&) {}
-			return -1;
+			outbuf.append(p.subspan(sent));
+			sent = 0;
 		}
 
-		if (rcvbuf.datasize() < maxdatasz)
-			if (!rcv_all())
-				return -1;
-		if (rcvbuf.datasize() > 0)
-			return rcvbuf.peek(data, maxdatasz);
-		return 0;
+		if (all_sent())
+			return SEND_OK;
+		set_bufferfull(true);
+		return SEND_BUFFERFULL;
 	}
 
-	/*virtual*/ WAITABLE tcp_pipe::get_waitable()
+	pipe::sendrslt tcp_pipe::send(slice&& s)
+	{
+		if (s.empty())
+			return send(nullptr, 0);
+		if (!all_sent())
+			return send(s.data(), s.size); // goes after unsent data
+
+		int iRetVal = ::send(sock(), (const char*)s.data(), int(s.size), 0);
+		if (iRetVal == SOCKET_ERROR)
+		{
+			if (!CHECK_IF_NOT_NOW)
+				return SEND_FAIL;
+			iRetVal = 0;
+		}
+
+		if (iRetVal < s.size)
+		{
+			// rest is kept by reference; no copy to outbuf
+			set_bufferfull(true);
+			s.skip(iRetVal);
+			outslice = std::move(s);
+			return SEND_BUFFERFULL;
+		}
+
+		return SEND_OK;
+	}
+
+	/*virtual*/ signed_t tcp_pipe::recv(u8* data, signed_t maxdatasz)
+	{
+		if (maxdatasz < 0)
+		{
+			try
+			{
+				// need exactly -maxdatasz bytes
+				maxdatasz = -maxdatasz;
+				for (; rcvbuf.datasize() < maxdatasz;)
+				{
+					if (!rcv_all())
+						return -1;
+					if (rcvbuf.datasize() < maxdatasz)
+					{
+						if (eof)
+							return -1; // peer closed connection before required data
+						if (WR_CLOSED == wait(get_waitable(), LOOP_PERIOD) && !rcv_all())
+							return -1;
+					}
+				}
+				rcvbuf.peek(data, maxdatasz);
+				return maxdatasz;
+			}
+			catch (const std::exception&) {}
+			return -1;
+		}
+
+		if (rcvbuf.datasize() == 0 && maxdatasz >= 16384 // bulk read; small ones take all available data to rcvbuf by one call
+#ifdef USE_IO_URING
+			&& !get_waitable()->urec // io_uring has already received data to its buffers
+#endif
+			)
+		{
+			// nothing buffered: data goes right to caller's memory, not through rcvbuf
+			signed_t _bytes = ::recv(sock(), (char*)data, (int)maxdatasz, 0);
+			if (_bytes == SOCKET_ERROR)
+			{
+				if (CHECK_IF_NOT_NOW)
+				{
+					clear_ready(get_waitable(), READY_SYSTEM);
+					return 0;
+				}
+				close(false);
+				return -1;
+			}
+			if (_bytes == 0)
+			{
+				// connection closed
+				close(false);
+				return -1;
+			}
+			clear_ready(get_waitable(), READY_SYSTEM);
+			return _bytes;
+		}
+
+		if (rcvbuf.datasize() < maxdatasz)
+			if (!rcv_all())
+				return -1;
+		if (rcvbuf.datasize() > 0)
+			return rcvbuf.peek(data, maxdatasz);
+		return 0;
+	}
+
+	co_task<signed_t> pipe::read_exact(u8* data, signed_t n)
+	{
+		for (signed_t have = 0;;)
+		{
+			signed_t rb = recv(data + have, n - have);
+			if (rb < 0)
+				co_return -1;
+			have += rb;
+			if (have >= n)
+				co_return n;
+			co_await co_waitpipe{ this, co_context::CW_READ };
+		}
+	}
+
+	co_task<bool> pipe::write(const u8* data, signed_t datasize)
+	{
+		sendrslt r = send(data, datasize);
+		for (; r == SEND_BUFFERFULL;)
+		{
+			co_await co_waitpipe{ this, co_context::CW_WRITE };
+			r = send(data, 0); // just send unsent buffer
+		}
+		co_return r == SEND_OK;
+	}
+
+	void co_failed(std::exception_ptr e)
+	{
+		try
+		{
+			std::rethrow_exception(e);
+		}
+		catch (const std::exception& x)
+		{
+			LOG_E("handshake failed due exception: %s", x.what());
+		}
+		catch (...)
+		{
+			LOG_E("handshake failed due unknown exception");
+		}
+	}
+
+	void co_context::run_blocking()
+	{
+		for (; !done();)
+		{
+			switch (wait)
+			{
+			case CW_READ:
+				netkit::wait(wpipe->get_waitable(), LOOP_PERIOD); // closed pipe will be noticed by recv
+				break;
+			case CW_WRITE:
+				if (WAITABLE w = wpipe->get_waitable(); w != NULL_WAITABLE)
+					wait_write(w, LOOP_PERIOD); // closed pipe will be noticed by send
+				break;
+			case CW_CONNECT:
+				connected = conn::connect(*target, connect_timeout, &cresult);
+				break;
+			default:
+				break;
+			}
+			resume();
+		}
+	}
+
+	/*virtual*/ WAITABLE tcp_pipe::get_waitable()
 	{
 		return waitable_socket::get_waitable();
 	}
 
 	bool tcp_pipe::rcv_all()
 	{
+		if (eof)
+		{
+			if (rcvbuf.datasize() > 0)
+				return true;
+			close(false);
+			return false;
+		}
 		if (rcvbuf.is_full())
 			return true;
 
+#ifdef USE_IO_URING
+		if (get_waitable()->urec)
+		{
+			// data already received by io_uring; just take it
+			for (; rcvbuf.get_free_size() > 0;)
+			{
+				signed_t _bytes = uring::fetch(get_waitable(), rcvbuf.get_1st_free());
+				if (_bytes < 0)
+				{
+					if (rcvbuf.datasize() > 0)
+						break; // close after buffered data processed
+					close(false);
+					return false;
+				}
+				if (_bytes == 0)
+					break;
+				rcvbuf.confirm(_bytes);
+			}
+			if (rcvbuf.datasize() == 0)
+				rcvbuf.clear(); // idle pipe keeps no storage
+			return true;
+		}
+#endif
+
 		for (;;)
 		{
 			u_long rb = 0;
@@ -653,11 +1174,12 @@ namespace netkit
 
 			if (rb > 0)
 			{
-				if (rcvbuf.get_free_size() > 1300)
+				signed_t freesz = rcvbuf.get_free_size();
+				if (freesz > 1300)
 				{
-					auto tank = rcvbuf.get_1st_free();
-
-					signed_t _bytes = ::recv(sock(), (char*)tank.data(), (int)(math::minv(tank.size(), 16384)), 0);
+					// both free parts of ring by one call
+					tools::circular_buffer<rcvbuf_size>::tank parts[2];
+					signed_t _bytes = recvv(sock(), parts, rcvbuf.get_free(parts));
 					if (_bytes == SOCKET_ERROR)
 					{
 						if (CHECK_IF_NOT_NOW)
@@ -671,25 +1193,151 @@ namespace netkit
 					if (_bytes == 0)
 					{
 						// connection closed
+						if (rcvbuf.datasize() > 0)
+						{
+							eof = true; // close after buffered data processed
+							break;
+						}
 						close(false);
 						return false;
 					}
 
 					clear_ready(get_waitable(), READY_SYSTEM);
 					rcvbuf.confirm(_bytes);
-					if (rcvbuf.get_free_size() < 1300)
-						break;
+					if (_bytes < freesz || rcvbuf.get_free_size() < 1300)
+						break; // all taken or buffer is full
 					continue;
 				}
 			}
 
 			break;
 		}
+		if (rcvbuf.datasize() == 0)
+			rcvbuf.clear(); // idle pipe keeps no storage
 		return true;
 	}
 
+#ifdef USE_SPLICE
+	splicer::~splicer()
+	{
+		if (p[0] >= 0)
+		{
+			::close(p[0]);
+			::close(p[1]);
+		}
+	}
+
+	/*static*/ bool splicer::allowed(tcp_pipe* tp)
+	{
+#ifdef USE_IO_URING
+		if (tp->get_waitable()->urec)
+			return false; // data is received by io_uring into its buffers
+#endif
+		return tp->connected();
+	}
+
+	/*static*/ splicer* splicer::create(tcp_pipe* from, tcp_pipe* to)
+	{
+		// data left in user space buffers (i.e. after handshake) must be sent by usual way first
+		if (!allowed(from) || !allowed(to) || from->rcvbuf.datasize() > 0 || !to->all_sent())
+			return nullptr;
+
+		std::unique_ptr<splicer> sp(new splicer());
+		if (pipe2(sp->p, O_NONBLOCK | O_CLOEXEC) < 0)
+		{
+			sp->p[0] = -1;
+			return nullptr;
+		}
+
+		// accepted sockets are blocking; splice to blocking socket waits until all data sent
+		fcntl(from->sock(), F_SETFL, O_NONBLOCK | fcntl(from->sock(), F_GETFL));
+		fcntl(to->sock(), F_SETFL, O_NONBLOCK | fcntl(to->sock(), F_GETFL));
+
+		return sp.release();
+	}
+
+	signed_t splicer::transfer(tcp_pipe* from, tcp_pipe* to)
+	{
+		if (eof)
+		{
+			// source closed; just wait until target accepts rest of data
+			if (flush(to) != pipe::SEND_BUFFERFULL)
+				return -1;
+			return 0;
+		}
+
+		if (buffered > 0)
+		{
+			// bridge mutes source while kernel pipe holds data, but read event could be already reported
+			pipe::sendrslt r = flush(to);
+			if (r == pipe::SEND_FAIL)
+				return -1;
+			if (r == pipe::SEND_BUFFERFULL)
+				return 0; // rest of data stays in source socket
+		}
+
+		ssize_t n = ::splice(from->sock(), nullptr, p[1], nullptr, 65536, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+		if (n == 0)
+		{
+			// connection closed
+			if (flush(to) == pipe::SEND_BUFFERFULL)
+			{
+				eof = true;
+				return 0;
+			}
+			from->close(false);
+			return -1;
+		}
+		if (n < 0)
+		{
+			if (!CHECK_IF_NOT_NOW)
+			{
+				from->close(false);
+				return -1;
+			}
+			n = 0; // no data or kernel pipe is full
+		}
+
+		clear_ready(from->get_waitable(), READY_SYSTEM);
+		buffered += n;
+
+		if (flush(to) == pipe::SEND_FAIL)
+			return -1;
+
+		return n;
+	}
+
+	pipe::sendrslt splicer::flush(tcp_pipe* to)
+	{
+		for (; buffered > 0;)
+		{
+			ssize_t n = ::splice(p[0], nullptr, to->sock(), nullptr, buffered, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+			if (n < 0)
+			{
+				if (!CHECK_IF_NOT_NOW)
+					return pipe::SEND_FAIL;
+
+				if (!to->get_waitable()->bufferfull)
+				{
+					to->get_waitable()->bufferfull = 1;
+					pipe_waiter::update_interest(to->get_waitable());
+				}
+				return pipe::SEND_BUFFERFULL;
+			}
+			buffered -= n;
+		}
+
+		if (to->get_waitable()->bufferfull && to->all_sent())
+		{
+			to->get_waitable()->bufferfull = 0;
+			pipe_waiter::update_interest(to->get_waitable());
+		}
+		return pipe::SEND_OK;
+	}
+#endif
+
 #ifdef _WIN32
-	bool dnsresolve_sys(const str::astr& host, ipap& addr)
+	bool dnsresolve_sys(const str::astr& host, std::vector<ipap>& addrs)
 	{
 		ADDRINFOEXA* result = nullptr;
 
@@ -713,44 +1361,32 @@ namespace netkit
 			return false;
 		}
 
-		sockaddr_in* a4 = nullptr;
-		sockaddr_in6* a6 = nullptr;
-
 		for (ADDRINFOEXA* ptr = result; ptr != nullptr; ptr = ptr->ai_next)
 		{
+			ipap a;
 			switch (ptr->ai_family)
 			{
 			case AF_INET:
-				a4 = (sockaddr_in*)ptr->ai_addr;
-				continue;
+				a.set((sockaddr_in*)ptr->ai_addr, false);
+				break;
 			case AF_INET6:
-				a6 = (sockaddr_in6*)ptr->ai_addr;
+				a.set((sockaddr_in6*)ptr->ai_addr, false);
+				break;
+			default:
 				continue;
 			}
+			addrs.push_back(a);
 		}
 
-		if (a4 != nullptr && a6 == nullptr && glb.cfg.ipstack != conf::gip_only6)
-			addr.set(a4, false);
-		else if (a6 != nullptr && a4 == nullptr && glb.cfg.ipstack != conf::gip_only4)
-			addr.set(a6, false);
-		else if (a4 != nullptr && a6 != nullptr)
-		{
-			if (glb.cfg.ipstack == conf::gip_prior4 || glb.cfg.ipstack == conf::gip_only4)
-				addr.set(a4, false);
-			else if (glb.cfg.ipstack == conf::gip_prior6 || glb.cfg.ipstack == conf::gip_only6)
-				addr.set(a6, false);
-		}
-
-
 #undef FreeAddrInfoEx
 		FreeAddrInfoEx(result);
 
-		return a4 != nullptr || a6 != nullptr;
+		return !addrs.empty();
 
 	}
 #endif
 #ifdef _NIX
-	bool dnsresolve_sys(const str::astr& host, ipap& addr)
+	bool dnsresolve_sys(const str::astr& host, std::vector<ipap>& addrs)
 	{
 		addrinfo hints;
 		addrinfo* res;
@@ -773,40 +1409,60 @@ namespace netkit
 			return false;
 		}
 
-		sockaddr_in* a4 = nullptr;
-		sockaddr_in6* a6 = nullptr;
-
 		for (addrinfo* rp = res; rp != nullptr; rp = rp->ai_next) {
 
+			ipap a;
 			switch (rp->ai_family)
 			{
 			case AF_INET:
-				a4 = (sockaddr_in*)rp->ai_addr;
-				continue;
+				a.set((sockaddr_in*)rp->ai_addr, false);
+				break;
 			case AF_INET6:
-				a6 = (sockaddr_in6*)rp->ai_addr;
+				a.set((sockaddr_in6*)rp->ai_addr, false);
+				break;
+			default:
 				continue;
 			}
+			addrs.push_back(a);
 		}
+		freeaddrinfo(res);
 
-		if (a4 != nullptr && a6 == nullptr && glb.cfg.ipstack != conf::gip_only6)
-			addr.set(a4, false);
-		else if (a6 != nullptr && a4 == nullptr && glb.cfg.ipstack != conf::gip_only4)
-			addr.set(a6, false);
-		else if (a4 != nullptr && a6 != nullptr)
+		return !addrs.empty();
+
+	}
+#endif
+
+	void order_for_connect(std::vector<ipap>& addrs)
+	{
+		bool prefer4 = glb.cfg.ipstack == conf::gip_only4 || glb.cfg.ipstack == conf::gip_prior4;
+		bool only = glb.cfg.ipstack == conf::gip_only4 || glb.cfg.ipstack == conf::gip_only6;
+
+		std::vector<ipap> pref, other;
+		for (const ipap& a : addrs)
 		{
-			if (glb.cfg.ipstack == conf::gip_prior4 || glb.cfg.ipstack == conf::gip_only4)
-				addr.set(a4, false);
-			else if (glb.cfg.ipstack == conf::gip_prior6 || glb.cfg.ipstack == conf::gip_only6)
-				addr.set(a6, false);
-		}
-		else
-			return false;
+			bool dup = false;
+			for (const ipap& x : pref)
+				dup |= x.copmpare_a(a);
+			for (const ipap& x : other)
+				dup |= x.copmpare_a(a);
+			if (dup)
+				continue;
 
-		return true;
+			if (a.v4 == prefer4)
+				pref.push_back(a);
+			else if (!only)
+				other.push_back(a);
+		}
 
+		addrs.clear();
+		for (size_t i = 0, c = std::max(pref.size(), other.size()); i < c; ++i)
+		{
+			if (i < pref.size())
+				addrs.push_back(pref[i]);
+			if (i < other.size())
+				addrs.push_back(other[i]);
+		}
 	}
-#endif
 
 	bool dnsresolve(const str::astr& host, ipap& addr, bool log_it)
 	{
@@ -828,7 +1484,43 @@ namespace netkit
 			if (0 == (glb.cfg.dnso & conf::dnso_bit_use_system))
 				return false;
 		}
-		if (dnsresolve_sys(host, addr))
+
+		std::vector<ipap> addrs;
+		if (dnsresolve_sys(host, addrs))
+		{
+			order_for_connect(addrs);
+			if (addrs.size() > 0)
+			{
+				addr.set(addrs[0], false);
+				return true;
+			}
+		}
+
+		if (log_it)
+		{
+			LOG_E("dns: name resolve failed: [%s]", host.c_str());
+		}
+
+		return false;
+	}
+
+	bool dnsresolve(const str::astr& host, std::vector<ipap>& addrs, bool log_it)
+	{
+		addrs.clear();
+
+		if ((glb.cfg.dnso & conf::dnso_mask) == conf::dnso_internal)
+		{
+			if (glb.dns->resolve(host, addrs, log_it))
+				order_for_connect(addrs);
+			if (addrs.size() > 0)
+				return true;
+			if (0 == (glb.cfg.dnso & conf::dnso_bit_use_system))
+				return false;
+		}
+
+		if (dnsresolve_sys(host, addrs))
+			order_for_connect(addrs);
+		if (addrs.size() > 0)
 			return true;
 
 		if (log_it)
@@ -944,10 +1636,38 @@ namespace netkit
 		return ipap();
 	}
 
+	bool netkit::endpoint::resolve_all(std::vector<ipap>& ips, size_t options)
+	{
+		ips.clear();
+
+		if (state_ == EPS_EMPTY)
+			return false;
+
+		if (state_ == EPS_RESLOVED)
+		{
+			ips.push_back(ip);
+			return true;
+		}
+
+		if (!netkit::dnsresolve(domain_, ips, (0 != (options & conf::gip_log_it))))
+			return false;
+
+		for (ipap& a : ips)
+			a.port = ip.port;
+
+		ip.set(ips[0], false);
+		state_ = EPS_RESLOVED;
+		return true;
+	}
+
 	wrslt wait(WAITABLE s, long microsec)
 	{
 		if (is_ready(s))
 			return WR_READY4READ;
+#ifdef USE_IO_URING
+		if (s->urec)
+			return uring::wait(s, microsec);
+#endif
 
 #ifdef _WIN32
 		if (microsec == 0)
@@ -1005,42 +1725,435 @@ namespace netkit
 #endif
 	}
 
-	u64 pipe_waiter::reg(pipe* p)
+	wrslt wait_write(WAITABLE s, long microsec)
+	{
+#ifdef _WIN32
+		WSAPOLLFD p = { s->s, POLLWRNORM };
+		int pr = WSAPoll(&p, 1, microsec < 0 ? -1 : (int)(microsec / 1000));
+#endif
+#ifdef _NIX
+		pollfd p = { s->s, POLLOUT };
+		int pr = poll(&p, 1, microsec < 0 ? -1 : (int)(microsec / 1000));
+#endif
+		if (pr == 0)
+			return WR_TIMEOUT;
+		if (pr < 0 || (p.revents & (POLLERR | POLLHUP | POLLNVAL)))
+			return WR_CLOSED;
+		return WR_READY4WRITE;
+	}
+
+	void waker::wake(WAITABLE w)
+	{
+		auto s = st.lock_write();
+		if (s().waiter == nullptr)
+			return;
+		bool signaled = !s().woken.empty(); // waiter hasn't taken previous ones yet
+		s().woken.push_back(w);
+		if (!signaled)
+			s().waiter->signal();
+	}
+
+	void waker::wake_at(WAITABLE w, signed_t deadline)
+	{
+		auto s = st.lock_write();
+		if (s().waiter == nullptr)
+			return;
+		s().timed.emplace_back(w, deadline);
+	}
+
+	void waker::forget(WAITABLE w)
+	{
+		auto s = st.lock_write();
+		for (signed_t i = tools::find(s().woken, w); i >= 0; i = tools::find(s().woken, w))
+			tools::remove_fast(s().woken, i);
+		for (signed_t i = s().timed.size() - 1; i >= 0; --i)
+			if (s().timed[i].first == w)
+				tools::remove_fast(s().timed, i);
+	}
+
+	static thread_local std::shared_ptr<waker> current_wkr;
+
+	pipe_waiter::~pipe_waiter()
+	{
+		if (wkr)
+		{
+			auto s = wkr->st.lock_write();
+			s().waiter = nullptr;
+			s().woken.clear();
+			s().timed.clear();
+		}
+#ifdef _WIN32
+		if (sig)
+			WSACloseEvent(sig);
+#endif
+#ifdef _NIX
+            if (evt[0] >= 0)
+            {
+                ::close(evt[0]);
+                ::close(evt[1]);
+            }
+#ifdef USE_EPOLL
+		if (efd >= 0)
+			::close(efd);
+#endif
+#ifdef USE_IO_URING
+		delete ring;
+#endif
+#endif // _NIX
+	}
+
+	void pipe_waiter::make_current()
+	{
+		if (!wkr)
+		{
+			wkr = std::make_shared<waker>();
+			wkr->st.lock_write()().waiter = this;
+		}
+		current_wkr = wkr;
+	}
+
+	/*static*/ const std::shared_ptr<waker>& pipe_waiter::current_waker()
+	{
+		return current_wkr;
+	}
+
+	void pipe_waiter::collect_woken(long& microsec)
+	{
+		auto s = wkr->st.lock_write();
+		woken.swap(s().woken);
+		if (s().timed.empty())
+			return;
+
+		signed_t now = chrono::us();
+		for (signed_t i = s().timed.size() - 1; i >= 0; --i)
+		{
+			signed_t left = s().timed[i].second - now;
+			if (left <= 0)
+			{
+				woken.push_back(s().timed[i].first);
+				tools::remove_fast(s().timed, i);
+			}
+			else if (microsec < 0 || left < microsec)
+				microsec = (long)left;
+		}
+	}
+
+#ifdef USE_EPOLL
+	bool pipe_waiter::take_woken(long& microsec)
+	{
+		if (!wkr)
+			return false;
+		collect_woken(microsec);
+
+		bool any = false;
+		for (WAITABLE w : woken)
+		{
+			if (w->owner != this && !closed_attached(w))
+				continue; // moved to another waiter; it checks ready state of pipe on attach
+			m.add_read(w->index);
+			m.add_write(w->index);
+			any = true;
+		}
+		woken.clear();
+		return any;
+	}
+
+	int pipe_waiter::epoll_wait_us(epoll_event* evs, int maxevs, long microsec)
+	{
+#ifdef SYS_epoll_pwait2
+		static volatile bool pwait2 = true; // kernel 5.11+
+		if (pwait2 && microsec > 0 && microsec % 1000 != 0)
+		{
+			// deadline of waker::wake_at needs better resolution than ms
+			struct timespec ts = { microsec / 1000000, (microsec % 1000000) * 1000 };
+			int n = (int)syscall(SYS_epoll_pwait2, efd, evs, maxevs, &ts, nullptr, 0);
+			if (n >= 0 || errno != ENOSYS)
+				return n;
+			pwait2 = false;
+		}
+#endif
+		return epoll_wait(efd, evs, maxevs, microsec >= 0 ? (int)((microsec + 999) / 1000) : -1); // rounded up: short deadline mustn't spin
+	}
+
+	bool pipe_waiter::prepare()
+	{
+		if (efd >= 0)
+			return true;
+
+		efd = epoll_create1(EPOLL_CLOEXEC);
+		if (efd < 0)
+			return false;
+		if (evt[0] < 0)
+			socketpair(PF_LOCAL, SOCK_STREAM, 0, evt);
+
+#ifdef USE_IO_URING
+		if (glb.cfg.io_uring)
+		{
+			ring = uring::create(evt[0], evt[1]);
+			if (ring == nullptr)
+			{
+				static bool warned = false;
+				if (!warned)
+				{
+					warned = true;
+					LOG_W("io_uring is not supported by kernel; epoll used");
+				}
+			}
+		}
+#endif
+
+		epoll_event ev = {};
+		ev.events = EPOLLIN;
+		ev.data.ptr = nullptr; // signal
+		epoll_ctl(efd, EPOLL_CTL_ADD, evt[0], &ev);
+		return true;
+	}
+
+	bool pipe_waiter::attach(pipe* p, signed_t index)
+	{
+		auto x = p->get_waitable();
+		if (x == NULL_WAITABLE || !prepare())
+			return false;
+
+		u8 need = interest(x);
+#ifdef USE_IO_URING
+		if (ring)
+		{
+			if (!ring->attach(x))
+				return false;
+			x->owner = this;
+			x->polled = need;
+			x->index = index;
+			check_ready(p);
+			return true;
+		}
+#endif
+		epoll_event ev = {};
+		ev.events = ((need & POLLED_READ) ? EPOLLIN : 0) | ((need & POLLED_WRITE) ? EPOLLOUT : 0);
+		ev.data.ptr = x;
+		if (epoll_ctl(efd, EPOLL_CTL_ADD, x->s, &ev) < 0)
+		{
+			if (errno != EEXIST || epoll_ctl(efd, EPOLL_CTL_MOD, x->s, &ev) < 0)
+				return false;
+		}
+		x->owner = this;
+		x->polled = need;
+		x->index = index;
+
+		check_ready(p);
+		return true;
+	}
+
+	void pipe_waiter::detach(pipe* p)
+	{
+		auto x = p->get_waitable();
+		if (x == NULL_WAITABLE)
+			return;
+		if (x->owner != this && !closed_attached(x))
+			return;
+
+		if (x->owner == this)
+		{
+#ifdef USE_IO_URING
+			if (ring)
+				ring->detach(x);
+			else
+#endif
+			epoll_ctl(efd, EPOLL_CTL_DEL, x->s, nullptr);
+		}
+		x->owner = nullptr;
+		x->polled = 0;
+		x->index = -1;
+		for (signed_t i = tools::find(pendings, x); i >= 0; i = tools::find(pendings, x))
+			tools::remove_fast(pendings, i);
+	}
+
+	void pipe_waiter::reindex(pipe* p, signed_t index)
+	{
+		if (auto x = p->get_waitable())
+			x->index = index;
+	}
+
+	void pipe_waiter::check_ready(pipe* p)
+	{
+		auto x = p->get_waitable(); // complex pipes update ready bit here
+		if (x != NULL_WAITABLE && is_ready(x) && (x->owner == this || closed_attached(x)) && !x->muted)
+			pendings.push_back(x);
+#ifdef USE_IO_URING
+		if (x != NULL_WAITABLE && x->urec && x->bufferfull)
+			uring::want_write(x); // POLLOUT request is one-shot
+#endif
+	}
+
+	/*static*/ void pipe_waiter::update_interest(WAITABLE w)
+	{
+		if (w->owner == nullptr)
+			return; // not attached yet; attach will take bufferfull into account
+
+		u8 need = interest(w);
+		if (need == w->polled)
+			return;
+
+#ifdef USE_IO_URING
+		if (w->urec)
+		{
+			// one-shot POLLOUT request; rearmed by next update if buffer still full
+			// reading of muted socket stops by itself (receiving pauses when its buffers are not fetched)
+			if (need & POLLED_WRITE)
+				uring::want_write(w);
+			w->polled = need & POLLED_READ;
+			return;
+		}
+#endif
+
+		epoll_event ev = {};
+		ev.events = ((need & POLLED_READ) ? EPOLLIN : 0) | ((need & POLLED_WRITE) ? EPOLLOUT : 0);
+		ev.data.ptr = w;
+		if (epoll_ctl(w->owner->efd, EPOLL_CTL_MOD, w->s, &ev) == 0)
+			w->polled = need;
+	}
+
+	void pipe_waiter::mute(pipe* p, bool m_)
+	{
+		auto x = p->get_waitable();
+		if (x == NULL_WAITABLE || x->muted == (u8)m_)
+			return;
+		x->muted = m_;
+		update_interest(x);
+		if (!m_)
+			check_ready(p); // data buffered while muted
+	}
+
+	pipe_waiter::mask& pipe_waiter::wait(long microsec)
+	{
+		m.clear();
+		if (!prepare())
+			return m;
+
+		for (WAITABLE w : pendings)
+			if (w->owner == this || closed_attached(w))
+				m.add_read(w->index);
+		bool nowait = take_woken(microsec) || !pendings.empty();
+
+#ifdef USE_IO_URING
+		if (ring)
+		{
+			ring->enter(nowait ? 0 : microsec);
+			pendings.clear();
+			ring->collect(m);
+			return m;
+		}
+#endif
+
+		epoll_event evs[512];
+		int n = epoll_wait_us(evs, (int)std::size(evs), nowait ? 0 : microsec);
+		pendings.clear();
+
+		for (int i = 0; i < n; ++i)
+		{
+			WAITABLE w = (WAITABLE)evs[i].data.ptr;
+			if (w == nullptr)
+			{
+				u8 temp[64];
+				::recv(evt[0], temp, sizeof(temp), 0); // just clear buf of socketpair
+				continue;
+			}
+
+			if (w->owner != this)
+			{
+				// socket has been moved to another waiter
+				epoll_ctl(efd, EPOLL_CTL_DEL, w->s, nullptr);
+				continue;
+			}
+
+			u32 e = evs[i].events;
+			if (0 != (e & (EPOLLHUP | EPOLLERR)))
+			{
+				m.add_close(w->index);
+			}
+			if (0 != (e & EPOLLIN))
+			{
+				m.add_read(w->index);
+				make_ready(w, READY_SYSTEM);
+			}
+			if (0 != (e & EPOLLOUT))
+			{
+				m.add_write(w->index);
+			}
+		}
+
+		return m;
+	}
+
+	void pipe_waiter::signal()
+	{
+		u8 fakedata = 1;
+		::send(evt[1], &fakedata, 1, 0);
+	}
+
+#else
+
+	bool pipe_waiter::take_woken(long& microsec)
 	{
-		u64 mask = 1ull << numw;
-		pipes[numw] = p;
+		if (!wkr)
+			return false;
+		collect_woken(microsec);
 
+		bool any = false;
+		for (WAITABLE w : woken)
+		{
+			for (signed_t i = 0; i < numw; ++i)
+			{
+				if (pipes[i]->get_waitable() != w)
+					continue;
+				m.add_read(i);
+				m.add_write(i);
+				any = true;
+			}
+		}
+		woken.clear();
+		return any;
+	}
+
+	signed_t pipe_waiter::reg(pipe* p)
+	{
 		auto x = p->get_waitable();
 		if (x == NULL_WAITABLE)
-			return 0;
+			return -1;
+
+		if (numw == 0)
+			m.clear();
+
+		signed_t index = numw;
+		pipes[index] = p;
 
 #ifdef _WIN32
-		soks[numw] = x->s;
-		www[numw] = x->wsaevent;
+		soks[index] = x->s;
+		www[index] = x->wsaevent;
 #endif
 #ifdef _NIX
-        polls[numw].fd = x->s;
-        polls[numw].events = POLLIN;
+        polls[index].fd = x->s;
+        polls[index].events = POLLIN;
 #endif // _NIX
-		if (is_ready(x))
-			readymask |= mask;
+		if (is_ready(x) && !x->muted)
+		{
+			m.add_read(index);
+			++numready;
+		}
 
 		++numw;
-		return mask;
+		return index;
 	}
 
 	void pipe_waiter::unreg_last()
 	{
 		--numw;
-		u64 mask = 1ull << numw;
-		readymask &= ~mask;
+		m.remove_read(numw);
 	}
 
 #ifdef _NIX
-	pipe_waiter::mask pipe_waiter::checkall()
+	pipe_waiter::mask& pipe_waiter::checkall()
 	{
-        mask m(readymask);
-
         for (int i = 0; i < numw; ++i)
         {
             WAITABLE w = pipes[i]->get_waitable();
@@ -1048,10 +2161,10 @@ namespace netkit
             int er = ioctl (w->s, FIONREAD, &rb);
             if (er < 0)
             {
-                m.add_close(1ull << i);
+                m.add_close(i);
             } else if (rb > 0)
             {
-                m.add_read(1ull << i);
+                m.add_read(i);
                 make_ready(w, READY_SYSTEM);
             }
             if (w->bufferfull)
@@ -1059,24 +2172,27 @@ namespace netkit
                 rb = 0;
                 int er = ioctl (w->s, SIOCOUTQ, &rb);
                 if (er < 0)
-                    m.add_close(1ull << i);
+                    m.add_close(i);
                 else if ((send_buffer_size-rb) > 0)
-                    m.add_write(1ull << i);
+                    m.add_write(i);
             }
 
         }
 
-        readymask = 0;
+        numready = 0;
         numw = 0;
         return m;
 
 	}
 #endif // _NIX
 
-	pipe_waiter::mask pipe_waiter::wait(long microsec)
+	pipe_waiter::mask& pipe_waiter::wait(long microsec)
 	{
+		if (take_woken(microsec))
+			++numready; // don't wait
+
 #ifdef _WIN32
-		if (readymask != 0)
+		if (numready != 0)
 		{
 			u32 rslt = WSAWaitForMultipleEvents(tools::as_dword(numw), www, FALSE, 0, FALSE);
 
@@ -1084,40 +2200,33 @@ namespace netkit
 			{
 				signed_t i = (rslt - WSA_WAIT_EVENT_0);
 
-				mask m(readymask);
-
 				WSANETWORKEVENTS e;
 				for (; i < numw; ++i)
 				{
 					WSAEnumNetworkEvents(soks[i], www[i], &e);
 					if (0 != (e.lNetworkEvents & FD_CLOSE))
 					{
-						m.add_close(1ull << i);
+						m.add_close(i);
 					}
 					if (0 != (e.lNetworkEvents & FD_READ))
 					{
-						m.add_read(1ull << i);
+						m.add_read(i);
 						make_ready(pipes[i]->get_waitable(), READY_SYSTEM);
 					}
 					if (0 != (e.lNetworkEvents & FD_WRITE))
 					{
-						m.add_write(1ull << i);
+						m.add_write(i);
 					}
 				}
-
-				readymask = 0;
-				numw = 0;
-				return m;
 			}
 
-			u64 rm = readymask;
-			readymask = 0;
+			numready = 0;
 			numw = 0;
-			return mask(rm);
+			return m;
 		}
 
 		if (numw == 0)
-			return mask();
+			m.clear(); // nothing registered; wait for signal only
 
 		if (sig == NULL_WAITABLE)
 		{
@@ -1125,61 +2234,60 @@ namespace netkit
 		}
 
 		www[numw] = sig;
-		u32 rslt = WSAWaitForMultipleEvents(tools::as_dword(numw + 1), www, FALSE, microsec < 0 ? WSA_INFINITE : (microsec / 1000), FALSE);
+		u32 rslt = WSAWaitForMultipleEvents(tools::as_dword(numw + 1), www, FALSE, microsec < 0 ? WSA_INFINITE : ((microsec + 999) / 1000), FALSE);
 		if (WSA_WAIT_TIMEOUT == rslt)
 		{
-			readymask = 0;
+			numready = 0;
 			numw = 0;
-			return mask();
+			return m;
 		}
 
 		if (rslt == WSA_WAIT_EVENT_0 + numw)
 		{
 			// signal
 			WSAResetEvent(sig);
-			readymask = 0;
+			numready = 0;
 			numw = 0;
-			return mask();
+			return m;
 		}
 
 		if (rslt >= WSA_WAIT_EVENT_0 && (rslt-WSA_WAIT_EVENT_0) < numw)
 		{
 			signed_t i = (rslt - WSA_WAIT_EVENT_0);
 
-			mask m;
 			WSANETWORKEVENTS e;
 			for (; i < numw; ++i)
 			{
 				WSAEnumNetworkEvents(soks[i], www[i], &e);
 				if (0 != (e.lNetworkEvents & FD_CLOSE))
 				{
-					m.add_close(1ull << i);
+					m.add_close(i);
 				}
 				if (0 != (e.lNetworkEvents & FD_READ))
 				{
-					m.add_read(1ull << i);
+					m.add_read(i);
 					make_ready(pipes[i]->get_waitable(), READY_SYSTEM);
 				}
 				if (0 != (e.lNetworkEvents & FD_WRITE))
 				{
-					m.add_write(1ull << i);
+					m.add_write(i);
 				}
 			}
 
-			readymask = 0;
+			numready = 0;
 			numw = 0;
 			return m;
 		}
 
 #endif
 #ifdef _NIX
-		if (readymask != 0)
+		if (numready != 0)
 		{
 		    return checkall();
         }
 
 		if (numw == 0)
-			return mask();
+			m.clear(); // nothing registered; wait for signal only
 
 		if (evt[0] < 0)
 		{
@@ -1192,34 +2300,27 @@ namespace netkit
 		for (signed_t i = 0; i < numw; ++i)
         {
             WAITABLE w = pipes[i]->get_waitable();
-            if (w->bufferfull)
-            {
-                polls[i].events = POLLIN | POLLOUT;
-            } else {
-                polls[i].events = POLLIN;
-            }
+            polls[i].events = (w->muted ? 0 : POLLIN) | (w->bufferfull ? POLLOUT : 0);
         }
 
-        int er = poll(polls, numw+1, microsec >= 0 ? (microsec/1000) : -1);
+        int er = poll(polls, numw+1, microsec >= 0 ? ((microsec + 999) / 1000) : -1);
 		if (er < 0)
             return checkall();
 
-        mask m;
         for (signed_t i = 0; i < numw; ++i)
         {
-            ;
             if (0 != (polls[i].revents & (POLLHUP|POLLERR|POLLNVAL)))
             {
-                m.add_close(1ull << i);
+                m.add_close(i);
             }
             if (0 != (polls[i].revents & POLLIN))
             {
-                m.add_read(1ull << i);
+                m.add_read(i);
                 make_ready(pipes[i]->get_waitable(), READY_SYSTEM);
             }
             if (0 != (polls[i].revents & POLLOUT))
             {
-                m.add_write(1ull << i);
+                m.add_write(i);
             }
         }
 
@@ -1229,14 +2330,14 @@ namespace netkit
             ::recv(evt[0], temp, sizeof(temp), 0); // just clear buf of socketpair
         }
 
-        readymask = 0;
+        numready = 0;
         numw = 0;
         return m;
 #endif
 
-		readymask = 0;
+		numready = 0;
 		numw = 0;
-        return mask();
+        return m;
 	}
 
 	void pipe_waiter::signal()
@@ -1252,6 +2353,8 @@ namespace netkit
 #endif
 	}
 
+#endif
+
 	namespace {
 		struct udpss : thread_storage_data
 		{
@@ -9,13 +9,27 @@
 
 #ifdef _NIX
 inline void closesocket(int s) { ::close(s); };
+#define USE_EPOLL // pipe_waiter uses persistent epoll registrations instead of poll; comment out to fall back to poll
+#ifdef USE_EPOLL
+#define MAXIMUM_WAITABLES 8192 // epoll itself has no limit; it just limits number of bridges per thread
+#else
 #define MAXIMUM_WAITABLES 64
+#endif
+#ifdef USE_EPOLL
+#define USE_IO_URING // optional io_uring engine of pipe_waiter (io_uring=1 in settings); requires USE_EPOLL as fallback
+#ifndef LOG_TRAFFIC
+#define USE_SPLICE // bridges of two plain tcp pipes forward data with splice() (data doesn't enter user space)
+#endif
+#endif
 #define SOCKET int
 #define INVALID_SOCKET (-1)
 #define SOCKET_ERROR (-1)
 #endif
 
 struct thread_storage;
+#ifdef USE_EPOLL
+struct epoll_event;
+#endif
 
 namespace netkit
 {
@@ -382,6 +396,7 @@ namespace netkit
 	{
 		WR_TIMEOUT,
 		WR_READY4READ,
+		WR_READY4WRITE,
 		WR_CLOSED,
 	};
 
@@ -392,18 +407,49 @@ namespace netkit
 #define READY_SYSTEM 1	// ready by WSAEnumNetworkEvents/select
 #define READY_PIPE 2	// ready by parent pipe
 
+#ifdef USE_EPOLL
+#define POLLED_READ 1	// socket is in epoll set of owner waiter (EPOLLIN)
+#define POLLED_WRITE 2	// also EPOLLOUT
+#endif
+
+	class pipe_waiter;
+#ifdef USE_IO_URING
+	class uring;
+	struct uring_rec;
+#endif
 	struct waitable_data
 	{
 #ifdef _WIN32
 		WSAEVENT wsaevent = nullptr;
+#endif
+#ifdef USE_EPOLL
+		pipe_waiter* owner = nullptr; // waiter whose epoll set contains this socket
+		signed_t index = -1; // index this socket reported with by owner waiter
+#endif
+#ifdef USE_IO_URING
+		uring_rec* urec = nullptr; // socket is attached to io_uring of owner waiter
 #endif
 		SOCKET s = INVALID_SOCKET;
 		u8 ready = 0;
 		u8 bufferfull = 0; // _NIX
-		u8 reserved1, reserved2;
-		void operator=(SOCKET s_) { s = s_; }
+		u8 polled = 0; // USE_EPOLL: events socket registered with (POLLED_* bits)
+		u8 muted = 0; // reading paused: data has nowhere to go (see pipe_waiter::mute)
+		void operator=(SOCKET s_)
+		{
+			s = s_;
+#ifdef USE_EPOLL
+			owner = nullptr; // closed descriptor automatically removed from epoll set
+			polled = 0;
+#endif
+		}
 	};
+#if defined(USE_IO_URING)
+	static_assert(sizeof(waitable_data) == 32);
+#elif defined(USE_EPOLL)
+	static_assert(sizeof(waitable_data) == 24);
+#else
 	NIXONLY( static_assert(sizeof(waitable_data) == 8); )
+#endif
 	using WAITABLE = waitable_data*;
 	inline bool is_ready(WAITABLE w) { return w->ready != 0; }
 	inline void make_ready(WAITABLE w, signed_t mask) { w->ready |= mask; }
@@ -411,11 +457,49 @@ namespace netkit
 #define NULL_WAITABLE ((netkit::WAITABLE)nullptr)
 
 	wrslt wait(WAITABLE s, long microsec);
+	wrslt wait_write(WAITABLE s, long microsec); // until socket can take more data (blocking threads only; ready state is not changed)
+	void make_nonblocking(WAITABLE w); // socket of bridge must never block its worker
+
+	class waker // other threads make waiter report pipe through it (i.e. async work of pipe finished); outlives its waiter
+	{
+		friend class pipe_waiter;
+		struct state
+		{
+			pipe_waiter* waiter = nullptr; // nullptr after waiter is destroyed
+			std::vector<WAITABLE> woken;
+			std::vector<std::pair<WAITABLE, signed_t>> timed; // woken when chrono::us reaches second
+		};
+		spinlock::syncvar<state> st;
+
+	public:
+		void wake(WAITABLE w); // any thread; waiter reports read and write of w by next wait
+		void wake_at(WAITABLE w, signed_t deadline); // same, but not earlier than deadline (chrono::us); waiter doesn't sleep past it
+		void forget(WAITABLE w); // w is going to be closed
+	};
 
 	struct pipe;
 	class pipe_waiter
 	{
 		using ppipe = pipe*;
+		std::shared_ptr<waker> wkr; // see make_current
+		std::vector<WAITABLE> woken; // taken from wkr by wait
+		void collect_woken(long& microsec); // takes woken and due timed pipes of wkr; microsec is cut to nearest deadline
+		bool take_woken(long& microsec); // adds events of woken pipes to mask; returns true if there are such pipes
+#ifdef USE_EPOLL
+		// persistent mode: pipes stay in epoll set between waits (see attach)
+		int efd = -1; // epoll descriptor
+		int evt[2] = {INVALID_SOCKET, INVALID_SOCKET}; // socketpair
+		std::vector<WAITABLE> pendings; // attached pipes with buffered data; reported by next wait without waiting
+#ifdef USE_IO_URING
+		uring* ring = nullptr; // used instead of epoll if enabled and supported by kernel
+#endif
+		bool prepare();
+		int epoll_wait_us(::epoll_event* evs, int maxevs, long microsec);
+		static bool closed_attached(WAITABLE w) // socket was closed by its pipe (peer closed connection) but not detached; complex pipe (i.e. crypto pipe) can still have data for waiter it was attached to
+		{
+			return w->owner == nullptr && w->s == INVALID_SOCKET && w->index >= 0;
+		}
+#else
 		ppipe pipes[MAXIMUM_WAITABLES];
 #ifdef _WIN32
 		SOCKET soks[MAXIMUM_WAITABLES + 2];
@@ -427,88 +511,112 @@ namespace netkit
         int evt[2] = {INVALID_SOCKET, INVALID_SOCKET}; // socketpair
 #endif // _NIX
 		signed_t numw = 0;
-		u64 readymask = 0;
-
-		static_assert(MAXIMUM_WAITABLES <= 64);
+		signed_t numready = 0; // number of registered pipes ready without waiting (see is_ready)
+#endif
 
 	public:
 
-		class mask
+		class mask // events by registration index (index returned by reg)
 		{
-			u64 readm = 0;
-			u64 closem = 0;
-			u64 writem = 0;
-
-		public:
-			mask(u64 readmask = 0):readm(readmask)
+			enum : u8
 			{
-			}
+				E_READ = 1,
+				E_CLOSE = 2,
+				E_WRITE = 4,
+			};
 
-			bool have_read(u64 m)
+			std::vector<u8> evs;
+			std::vector<signed_t> touched; // indices with non-zero events (some of them can be already zero)
+			signed_t numset = 0;
+
+			bool test(signed_t i, u8 e)
 			{
-				if ((readm & m) != 0)
-				{
-					readm &= ~m;
-					return true;
-				}
-				return false;
+				if (i < 0 || i >= (signed_t)evs.size() || (evs[i] & e) == 0)
+					return false;
+				evs[i] &= ~e;
+				if (evs[i] == 0)
+					--numset;
+				return true;
 			}
-			bool have_closed(u64 m)
+			void set(signed_t i, u8 e)
 			{
-				if ((closem & m) != 0)
+				if (i >= (signed_t)evs.size())
+					evs.resize(i + 1);
+				if (evs[i] == 0)
 				{
-					closem &= ~m;
-					return true;
+					++numset;
+					touched.push_back(i);
 				}
-				return false;
+				evs[i] |= e;
 			}
-			bool have_write(u64 m)
+
+		public:
+
+			bool have_read(signed_t i) { return test(i, E_READ); }
+			bool have_closed(signed_t i) { return test(i, E_CLOSE); }
+			bool have_write(signed_t i) { return test(i, E_WRITE); }
+
+			void add_read(signed_t i) { set(i, E_READ); }
+			void add_close(signed_t i) { set(i, E_CLOSE); }
+			void add_write(signed_t i) { set(i, E_WRITE); }
+
+			void remove_read(signed_t i) { test(i, E_READ); }
+			void remove_close(signed_t i) { test(i, E_CLOSE); }
+			void remove_write(signed_t i) { test(i, E_WRITE); }
+
+			bool is_empty() const { return numset == 0; }
+
+			void clear()
 			{
-				if ((writem & m) != 0)
-				{
-					writem &= ~m;
-					return true;
-				}
-				return false;
+				for (signed_t i : touched)
+					evs[i] = 0;
+				touched.clear();
+				numset = 0;
 			}
 
-			void add_read(u64 m) { readm |= m; }
-			void add_close(u64 m) { closem |= m; }
-			void add_write(u64 m) { writem |= m; }
+			const std::vector<signed_t>& active() const // indices that got events (can contain duplicates)
+			{
+				return touched;
+			}
+		};
 
-			void remove_read(u64 m) { readm &= ~m; }
-			void remove_close(u64 m) { closem &= ~m; }
-			void remove_write(u64 m) { writem &= ~m; }
+	private:
+		mask m;
+	public:
 
-			bool is_empty() const { return readm == 0 && closem == 0 && writem == 0; }
-		};
+#if defined(_NIX) && !defined(USE_EPOLL)
+        mask& checkall();
+#endif
 
-#ifdef _NIX
-        mask checkall();
-#endif // _NIX
 
+		~pipe_waiter(); // out of line: uring is incomplete here
 
-		~pipe_waiter()
-		{
-#ifdef _WIN32
-			if (sig)
-				WSACloseEvent(sig);
+#ifdef USE_IO_URING
+		bool uses_ring() const { return ring != nullptr; }
+#else
+		bool uses_ring() const { return false; }
 #endif
-#ifdef _NIX
-            if (evt[0] >= 0)
-            {
-                ::close(evt[0]);
-                ::close(evt[1]);
-            }
-
-#endif // _NIX
-		}
 
-		u64 reg(pipe* p);
+#ifdef USE_EPOLL
+		bool attach(pipe* p, signed_t index); // register pipe once; its events will be reported with given index until detach or close
+		void detach(pipe* p);
+		void reindex(pipe* p, signed_t index);
+		void check_ready(pipe* p); // call after pipe processed: pipe with buffered data should be processed again without waiting
+		static void update_interest(WAITABLE w); // pipe calls this when its bufferfull changes
+		static u8 interest(WAITABLE w) { return (w->muted ? 0 : POLLED_READ) | (w->bufferfull ? POLLED_WRITE : 0); }
+		void mute(pipe* p, bool m); // pause/resume reading of pipe (e.g. while bridge partner can't accept data)
+
+		mask& wait(long microsec); // returned mask valid until next wait
+#else
+		signed_t reg(pipe* p); // returns registration index or -1 if pipe can't be waited
 		void unreg_last();
 
-		mask wait(long microsec); // after wait return, waiter is in empty state
+		mask& wait(long microsec); // after wait return, waiter is in empty state; returned mask valid until next reg
+#endif
 		void signal();
+
+		void make_current(); // thread of waiter: pipes it processes can get waker of this waiter (see current_waker)
+		static const std::shared_ptr<waker>& current_waker(); // waker of waiter of calling thread; empty if thread has no waiter
 	};
 
 	class endpoint
@@ -589,6 +697,7 @@ namespace netkit
 		}
 
 		ipap resolve_ip(size_t options);
+		bool resolve_all(std::vector<ipap>& ips, size_t options); // all ips of domain in connection attempt order (see order_for_connect); first one becomes resolved ip
 		const ipap& get_ip() const
 		{
 			ASSERT(state_ == EPS_RESLOVED);
@@ -701,11 +810,42 @@ namespace netkit
 		bool ready() const { return sock() != INVALID_SOCKET; }
 		virtual ~waitable_socket() { close(false); }
 
-		bool listen(const str::astr& name, const ipap& bind2);
+		bool listen(const str::astr& name, const ipap& bind2, bool reuseport = false); // reuseport - several sockets share bind address (linux)
 		tcp_pipe* tcp_accept(const str::astr& name);
 
 	};
 
+	template<typename T> class co_task;
+
+	struct shared_data : public ptr::sync_shared_object // memory of slices; upper pipe passes it to lower one by reference instead of copying it
+	{
+		buffer data;
+	};
+	using shared_data_ptr = ptr::shared_ptr<shared_data>;
+
+	// only send path: a pipe holds at most one pending slice (see tcp_pipe::outslice), because its only producer (crypto pipe)
+	// seals one contiguous buffer per send and takes a new one while lower pipe holds it; received data is still copied
+	// into rcvbuf or caller's buffer, since recv interface of all pipes gives data into caller's memory
+	struct slice // part of shared_data
+	{
+		shared_data_ptr owner;
+		signed_t offset = 0;
+		signed_t size = 0;
+
+		slice() {}
+		slice(shared_data* sd, signed_t offset, signed_t size) :owner(sd), offset(offset), size(size) {}
+
+		const u8* data() const { return owner->data.data() + offset; }
+		bool empty() const { return size == 0; }
+		void skip(signed_t sz)
+		{
+			offset += sz;
+			size -= sz;
+			if (size == 0)
+				owner = nullptr; // memory goes back to its pipe
+		}
+	};
+
 	struct pipe : public ptr::sync_shared_object
 	{
 		enum sendrslt
@@ -722,35 +862,51 @@ namespace netkit
 		pipe(tcp_pipe&&) = delete;
 
 		virtual sendrslt send(const u8* data, signed_t datasize) = 0;
+		virtual sendrslt send(slice&& s) { return s.empty() ? send(nullptr, 0) : send(s.data(), s.size); } // same, but pipe can keep unsent part of s instead of copying it
+		virtual sendrslt send(std::span<const std::span<const u8>> parts); // same, but several parts at once (vectored)
 		virtual signed_t recv(u8* data, signed_t maxdatasz) = 0;
 		virtual WAITABLE get_waitable() = 0;
 		virtual void close(bool flush_before_close) = 0;
 		virtual bool alive() = 0;
+		virtual signed_t queued() const { return 0; } // bytes taken by send but not yet passed to system
+		virtual bool recv_stalled() const { return false; } // nothing to take now and socket must not be read until async work of pipe is done (it wakes waiter up)
+
+		// awaitable versions for handshakes (see coro.h): suspend coroutine instead of blocking thread
+		co_task<signed_t> read_exact(u8* data, signed_t n); // returns n or -1 if pipe closed
+		co_task<bool> write(const u8* data, signed_t datasize); // returns false on fail; resumes when data is sent to socket
 	};
 
 	using pipe_ptr = ptr::shared_ptr<pipe>;
 
 	struct tcp_pipe : public pipe, public waitable_socket
 	{
+		static constexpr signed_t rcvbuf_size = 16384 * 3;
+		static constexpr signed_t max_iov = 16; // parts of one vectored send
+		static inline std::atomic<signed_t> numpipes = 0; // all threads; for memory report
+
 		ipap addr;
 		signed_t creationtime = 0;
+		bool eof = false; // peer closed connection, but rcvbuf still has data; pipe is closed when it is taken
 
-		tools::circular_buffer<16384*3> rcvbuf;
+		tools::circular_buffer<rcvbuf_size> rcvbuf; // storage only while received data is not taken
+		slice outslice; // unsent part of slice taken by send; goes before outbuf
 		tools::chunk_buffer<16384> outbuf;
 
-		tcp_pipe() { creationtime = chrono::ms(); }
-		tcp_pipe(SOCKET s, const ipap& addr) :addr(addr) { _socket = s; creationtime = chrono::ms(); }
+		tcp_pipe() { creationtime = chrono::ms(); ++numpipes; }
+		tcp_pipe(SOCKET s, const ipap& addr) :addr(addr) { _socket = s; creationtime = chrono::ms(); ++numpipes; }
 		tcp_pipe(const tcp_pipe&) = delete;
 		tcp_pipe(tcp_pipe&&) = delete;
 
 		/*virtual*/ ~tcp_pipe()
 		{
 			close(true);
+			--numpipes;
 		}
 
 		/*virtual*/ void close(bool flush_before_close) override
 		{
 			rcvbuf.clear();
+			eof = false;
 			waitable_socket::close(flush_before_close);
 		}
 
@@ -768,7 +924,7 @@ namespace netkit
 			set_address( ainf.resolve_ip(glb.cfg.ipstack | conf::gip_any) );
 		}
 
-		bool connect();
+		bool connect(); // blocking; see tcp_connector for non-blocking one
 
 		tcp_pipe& operator=(tcp_pipe&& p)
 		{
@@ -778,6 +934,7 @@ namespace netkit
 			_socket = p._socket; p._socket = INVALID_SOCKET;
 			addr = p.addr;
 			rcvbuf = std::move(p.rcvbuf);
+			eof = p.eof;
 			return *this;
 		}
 
@@ -787,7 +944,11 @@ namespace netkit
 
 
 		/*virtual*/ sendrslt send(const u8* data, signed_t datasize) override;
+		/*virtual*/ sendrslt send(slice&& s) override;
+		/*virtual*/ sendrslt send(std::span<const std::span<const u8>> parts) override;
 		/*virtual*/ signed_t recv(u8* data, signed_t maxdatasz) override;
+		/*virtual*/ signed_t queued() const override { return outslice.size + outbuf.datasize(); }
+		bool all_sent() const { return outslice.empty() && outbuf.is_empty(); }
 
 		enum read_result : u8
 		{
@@ -812,6 +973,8 @@ namespace netkit
 
 
 		bool rcv_all(); // receive all, but stops when buffer size reaches 64k
+		void set_bufferfull(bool full); // waiter has to report when pipe can send
+		sendrslt flush(); // sends unsent data (outslice and outbuf)
 		/*virtual*/ WAITABLE get_waitable() override;
 
 		/*
@@ -828,10 +991,86 @@ namespace netkit
 		*/
 	};
 
-	static_assert(sizeof(tcp_pipe) <= 65536);
+	static_assert(sizeof(tcp_pipe) <= 256); // idle connection must be cheap
+
+#define DEFAULT_CONNECT_TIMEOUT 10000 // ms; connect timeout of handler (if not set in config)
+
+	enum connect_result : u8
+	{
+		CR_OK,
+		CR_REFUSED, // target rejected connection
+		CR_TIMEOUT, // no answer within connect timeout (or kernel gave up)
+		CR_UNREACHABLE, // no route to host or network
+		CR_FAILED, // not resolved, no sockets, etc.
+	};
+	const char* connect_result_desc(connect_result r);
+
+	class tcp_connector // non-blocking connect to one of addresses; caller polls sockets of attempts (see add_polls)
+	{
+		// happy eyeballs (rfc 8305): attempts are started one by one every glb.cfg.connect_attempt_delay ms; first established wins
+		struct attempt
+		{
+			SOCKET s;
+			signed_t ipi; // index in ips
+			signed_t start; // ms since connect start
+		};
+
+		std::vector<ipap> ips;
+		std::vector<attempt> atts; // connecting now
+		signed_t next = 0; // index of next address to try
+		signed_t starttime;
+		signed_t nexttime = 0; // ms since connect start
+		signed_t timeout; // ms; 0 - until kernel gives up
+		SOCKET winner = INVALID_SOCKET;
+		signed_t winneri = -1;
+		connect_result res = CR_FAILED; // while connecting: failure of last failed attempt
+		bool finished = false;
+
+		signed_t elapsed() const;
+		void start_next(signed_t ct);
+		void failed(const attempt& a, int err);
+		void finish();
+
+	public:
+		tcp_connector(std::vector<ipap>&& ips, signed_t timeout);
+		~tcp_connector();
+
+		bool step(); // starts due attempts and checks timeout; returns false when connect finished (see result)
+		void add_polls(std::vector<pollfd>& pfds) const; // one entry per attempt in progress
+		void polled(const pollfd* pfds); // poll results of entries added by add_polls (same order)
+		signed_t wait_time() const; // ms until step has something to do besides poll events; -1 - nothing
+		connect_result result() const { return res; }
+		tcp_pipe* take(); // established connection (nullptr if failed)
+	};
+
+	int poll_sockets(pollfd* pfds, signed_t n, signed_t timeout_ms); // poll or WSAPoll
+
+#ifdef USE_SPLICE
+	class splicer // one direction of plain tcp bridge: socket -> kernel pipe -> socket
+	{
+		int p[2] = { -1, -1 };
+		signed_t buffered = 0; // bytes in kernel pipe; not yet accepted by target socket
+		bool eof = false; // source closed, but kernel pipe still has data
+
+		splicer() {}
+	public:
+		~splicer();
+
+		static bool allowed(tcp_pipe* tp); // tcp pipe can be spliced at all
+		static splicer* create(tcp_pipe* from, tcp_pipe* to); // nullptr if not now (pipes have buffered data)
+
+		bool is_empty() const { return buffered == 0; }
+		signed_t queued() const { return buffered; }
+
+		signed_t transfer(tcp_pipe* from, tcp_pipe* to); // returns number of received bytes or -1 if connection closed
+		pipe::sendrslt flush(tcp_pipe* to); // send buffered bytes; sets bufferfull of target (like tcp_pipe::send)
+	};
+#endif
 
 
 	bool dnsresolve(const str::astr& host, ipap& addr, bool log_it);
+	bool dnsresolve(const str::astr& host, std::vector<ipap>& addrs, bool log_it); // all addresses of host, ordered by order_for_connect
+	void order_for_connect(std::vector<ipap>& addrs); // removes not allowed family (ipstack); interleaves families, preferred family first
 
 
 
@@ -1032,6 +1271,8 @@ namespace netkit
 
 } // namespace netkit
 
+#include "coro.h"
+
 template <> struct std::hash<netkit::ipap>
 {
     std::size_t operator()(const netkit::ipap& k) const
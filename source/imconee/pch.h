@@ -38,6 +38,7 @@
 #include <sys/stat.h>
 #include <thread>
 #include <poll.h>
+#include <sys/uio.h>
 
 #pragma GCC diagnostic ignored "-Wswitch"
 
@@ -52,6 +53,10 @@
 #include <vector>
 #include <map>
 #include <mutex>
+#include <condition_variable>
+#include <coroutine>
+#include <exception>
+#include <utility>
 #include <shared_mutex>
 #include <functional>
 #include <charconv>
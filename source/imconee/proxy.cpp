@@ -66,6 +66,8 @@ proxy::proxy(loader& ldr, const str::astr& name, const asts& bb, bool addr_requi
 		}
 	} else
 		addr.preparse(a);
+
+	conn_timeout = bb.get_int(ASTR("connect-timeout"), conn_timeout);
 }
 
 str::astr proxy::desc() const
@@ -73,6 +75,31 @@ str::astr proxy::desc() const
 	return name + "@" + addr.desc();
 }
 
+void proxy::connect_done(netkit::connect_result r) const
+{
+	switch (r)
+	{
+	case netkit::CR_OK:
+		++cstats.ok;
+		return;
+	case netkit::CR_REFUSED:
+		++cstats.refused;
+		break;
+	case netkit::CR_TIMEOUT:
+		++cstats.timeout;
+		break;
+	case netkit::CR_UNREACHABLE:
+		++cstats.unreachable;
+		break;
+	default:
+		++cstats.failed;
+		break;
+	}
+
+	LOG_W("connect to proxy [%s] %s (connects: ok %i, refused %i, timed out %i, unreachable %i, failed %i)", str::printable(name), netkit::connect_result_desc(r),
+		cstats.ok.load(), cstats.refused.load(), cstats.timeout.load(), cstats.unreachable.load(), cstats.failed.load());
+}
+
 proxy_socks4::proxy_socks4(loader& ldr, const str::astr& name, const asts& bb):proxy(ldr, name, bb)
 {
 	userid = bb.get_string(ASTR("userid"));
@@ -104,35 +131,36 @@ namespace {
 #define _alloca alloca
 #endif
 
-netkit::pipe_ptr proxy_socks4::prepare(netkit::pipe_ptr pipe_to_proxy, netkit::endpoint& addr2) const
+netkit::co_task<netkit::pipe_ptr> proxy_socks4::prepare(netkit::pipe_ptr pipe_to_proxy, netkit::endpoint& addr2) const
 {
 	addr2.resolve_ip(conf::gip_only4);
 	if (addr2.state() != netkit::EPS_RESLOVED || addr2.port() == 0)
 	{
-		return netkit::pipe_ptr();
+		co_return netkit::pipe_ptr();
 	}
 
+	u8 packet[sizeof(connect_packet_socks4) + 256]; // no _alloca: coroutine frame outlives stack of its resumer
 	signed_t dsz = sizeof(connect_packet_socks4) + 1 + userid.length();
-	connect_packet_socks4* pd = (connect_packet_socks4 *)_alloca(dsz);
+	connect_packet_socks4* pd = (connect_packet_socks4 *)packet;
 	pd->vn = 4; pd->cd = 1;
 	pd->destport = netkit::to_ne((u16)addr2.port());
 	pd->destip = addr2.get_ip();
 	memcpy(pd + 1, userid.c_str(), userid.length());
-	((u8*)pd)[dsz - 1] = 0;
+	packet[dsz - 1] = 0;
 
-	if (pipe_to_proxy->send((u8*)pd, dsz) == netkit::pipe::SEND_FAIL)
+	if (!co_await pipe_to_proxy->write(packet, dsz))
 	{
-		return netkit::pipe_ptr();
+		co_return netkit::pipe_ptr();
 	}
 
 	connect_answr_socks4 answ;
-	signed_t rb = pipe_to_proxy->recv((u8*)&answ, -(signed_t)sizeof(connect_answr_socks4));
+	signed_t rb = co_await pipe_to_proxy->read_exact((u8*)&answ, sizeof(connect_answr_socks4));
 
 	if (rb != sizeof(connect_answr_socks4) || answ.vn != 0 || answ.cd != 90)
-		return netkit::pipe_ptr();
+		co_return netkit::pipe_ptr();
 
 
-	return pipe_to_proxy;
+	co_return pipe_to_proxy;
 }
 
 proxy_socks5::proxy_socks5(loader& ldr, const str::astr& name, const asts& bb) :proxy(ldr, name, bb)
@@ -164,35 +192,35 @@ proxy_socks5::proxy_socks5(loader& ldr, const str::astr& name, const asts& bb) :
 
 }
 
-bool proxy_socks5::initial_setup(u8* packet, netkit::pipe* p2p) const
+netkit::co_task<bool> proxy_socks5::initial_setup(u8* packet, netkit::pipe* p2p) const
 {
 	packet[0] = 5;
 	packet[1] = 1;
 	packet[2] = authpacket.empty() ? 0 : 2;
 
-	if (p2p->send(packet, 3) == netkit::pipe::SEND_FAIL)
-		return false;
+	if (!co_await p2p->write(packet, 3))
+		co_return false;
 
-	signed_t rb = p2p->recv(packet, -2);
+	signed_t rb = co_await p2p->read_exact(packet, 2);
 
 	if (rb != 2 || packet[0] != 5 || packet[1] != packet[2])
-		return false;
+		co_return false;
 
 	if (!authpacket.empty())
 	{
-		if (p2p->send(authpacket.data(), authpacket.size()) == netkit::pipe::SEND_FAIL)
-			return false;
+		if (!co_await p2p->write(authpacket.data(), authpacket.size()))
+			co_return false;
 
-		signed_t rb1 = p2p->recv(packet, -2);
+		signed_t rb1 = co_await p2p->read_exact(packet, 2);
 		if (rb1 != 2 || packet[1] != 0)
-			return false;
+			co_return false;
 	}
-	return true;
+	co_return true;
 }
 
-bool proxy_socks5::recv_rep(u8* packet, netkit::pipe* p2p, netkit::endpoint* ep, const str::astr_view *addr2domain) const
+netkit::co_task<bool> proxy_socks5::recv_rep(u8* packet, netkit::pipe* p2p, netkit::endpoint* ep, const str::astr_view *addr2domain) const
 {
-	signed_t rb = p2p->recv(packet, -2);
+	signed_t rb = co_await p2p->read_exact(packet, 2);
 
 	if (rb != 2 || packet[0] != 5 || packet[1] != 0)
 	{
@@ -227,44 +255,49 @@ bool proxy_socks5::recv_rep(u8* packet, netkit::pipe* p2p, netkit::endpoint* ep,
             LOG_N("proxy [%s] fail: %s", str::printable(name), proxyfail(packet[1]));
 
 		}
-		return false;
+		co_return false;
 	}
 
 
-	rb = p2p->recv(packet, -2); // read next 2 bytes
+	rb = co_await p2p->read_exact(packet, 2); // read next 2 bytes
 
 	if (rb != 2)
-		return false;
+		co_return false;
 
 	switch (packet[1])
 	{
 	case 1:
-		rb = p2p->recv(packet, -6); // read ip4 and port
+		rb = co_await p2p->read_exact(packet, 6); // read ip4 and port
 		if (rb != 6)
-			return false;
+			co_return false;
 
 		if (ep)
 			ep->read(packet, 6);
 
 		break;
 	case 3:
-		rb = p2p->recv(packet, -1); // read domain len
+	{
+		rb = co_await p2p->read_exact(packet, 1); // read domain len
 		if (rb != 1)
-			return false;
+			co_return false;
 
-		rb = packet[0] + 2;
-		rb = p2p->recv(packet+1, rb); // read domain and port
-		if (rb != rb)
-			return false;
+		signed_t dl = packet[0] + 2;
+		rb = co_await p2p->read_exact(packet + 1, dl); // read domain and port
+		if (rb != dl)
+			co_return false;
 
-		ep->set_domain( str::astr_view((const char *)packet + 1, packet[0]));
-		ep->set_port(((u16)packet[packet[0]+1] << 8) | packet[packet[0] + 2]);
+		if (ep)
+		{
+			ep->set_domain(str::astr_view((const char*)packet + 1, packet[0]));
+			ep->set_port(((u16)packet[packet[0] + 1] << 8) | packet[packet[0] + 2]);
+		}
 
 		break;
+	}
 	case 4:
-		rb = p2p->recv(packet, -18); // read ip6 and port
+		rb = co_await p2p->read_exact(packet, 18); // read ip6 and port
 		if (rb != 18)
-			return false;
+			co_return false;
 
 		if (ep)
 			ep->read(packet, 18);
@@ -272,20 +305,20 @@ bool proxy_socks5::recv_rep(u8* packet, netkit::pipe* p2p, netkit::endpoint* ep,
 		break;
 
 	default:
-		return false;
+		co_return false;
 	}
 
-	return true;
+	co_return true;
 }
 
-netkit::pipe_ptr proxy_socks5::prepare(netkit::pipe_ptr pipe_to_proxy, netkit::endpoint& addr2) const
+netkit::co_task<netkit::pipe_ptr> proxy_socks5::prepare(netkit::pipe_ptr pipe_to_proxy, netkit::endpoint& addr2) const
 {
 	if (addr2.state() == netkit::EPS_EMPTY || addr2.port() == 0)
-		return netkit::pipe_ptr();
+		co_return netkit::pipe_ptr();
 
 	u8 packet[512];
-	if (!initial_setup(packet, pipe_to_proxy.get()))
-		return netkit::pipe_ptr();
+	if (!co_await initial_setup(packet, pipe_to_proxy.get()))
+		co_return netkit::pipe_ptr();
 
 	netkit::pgen pg(packet, 512);
 
@@ -294,13 +327,13 @@ netkit::pipe_ptr proxy_socks5::prepare(netkit::pipe_ptr pipe_to_proxy, netkit::e
     pg.push8(0);
 
 	push_atyp(pg, addr2);
-    if (pipe_to_proxy->send(packet, pg.ptr) == netkit::pipe::SEND_FAIL)
-        return netkit::pipe_ptr();
+    if (!co_await pipe_to_proxy->write(packet, pg.ptr))
+        co_return netkit::pipe_ptr();
 
-	if (!recv_rep(packet, pipe_to_proxy.get(), nullptr, makeptr(str::view(addr2.domain()))))
-		return netkit::pipe_ptr();
+	if (!co_await recv_rep(packet, pipe_to_proxy.get(), nullptr, makeptr(str::view(addr2.domain()))))
+		co_return netkit::pipe_ptr();
 
-	return pipe_to_proxy;
+	co_return pipe_to_proxy;
 }
 
 class udp_via_socks5 : public netkit::udp_pipe
@@ -417,7 +450,9 @@ bool proxy_socks5::prepare_udp_assoc(netkit::endpoint& udp_assoc_ep, netkit::pip
 	LOG_I("udp assoc prepare to %s", addr.desc().c_str());
 #endif
 	netkit::endpoint addrr(addr);
-	netkit::pipe* pip = conn::connect(addrr);
+	netkit::connect_result cr;
+	netkit::pipe* pip = conn::connect(addrr, connect_timeout(DEFAULT_CONNECT_TIMEOUT), &cr);
+	connect_done(cr);
 	if (!pip)
 	{
 	not_success:
@@ -427,7 +462,7 @@ bool proxy_socks5::prepare_udp_assoc(netkit::endpoint& udp_assoc_ep, netkit::pip
 	}
 	netkit::pipe_ptr p2p(pip);
 	u8 packet[512];
-	if (!initial_setup(packet, pip))
+	if (!netkit::co_run(initial_setup(packet, pip)))
 		goto not_success;
 
 	netkit::pgen pg(packet, 10);
@@ -442,7 +477,7 @@ bool proxy_socks5::prepare_udp_assoc(netkit::endpoint& udp_assoc_ep, netkit::pip
 	if (p2p->send(packet, pg.sz) == netkit::pipe::SEND_FAIL)
 		goto not_success;
 
-	if (!recv_rep(packet, pip, &udp_assoc_ep, log_fails ? makeptr(ASTR("udp")) : nullptr))
+	if (!netkit::co_run(recv_rep(packet, pip, &udp_assoc_ep, log_fails ? makeptr(ASTR("udp")) : nullptr)))
 		goto not_success;
 
 	if (udp_assoc_ep.get_ip().is_wildcard() && udp_assoc_ep.domain().empty())
@@ -2,9 +2,20 @@
 
 class proxy
 {
+	struct connect_stats // outcomes of connects to this proxy
+	{
+		std::atomic<signed_t> ok = 0;
+		std::atomic<signed_t> refused = 0;
+		std::atomic<signed_t> timeout = 0;
+		std::atomic<signed_t> unreachable = 0;
+		std::atomic<signed_t> failed = 0;
+	};
+	mutable connect_stats cstats;
+
 protected:
 	str::astr name;
 	netkit::endpoint addr;
+	signed_t conn_timeout = 0; // ms; 0 - connect timeout of handler
 
 public:
 	proxy(loader& ldr, const str::astr& name, const asts& bb, bool addr_required = true);
@@ -18,8 +29,9 @@ public:
 	* function will force the proxy to establish a connection to addr2
 	* returned pipe is ready-to-communicate pipe with remote host at addr2
 	* addr2 can be modified (resolved)
+	* coroutine: waits of negotiation don't block bridge worker (see netkit::co_task)
 	*/
-	virtual netkit::pipe_ptr prepare(netkit::pipe_ptr pipe_to_proxy, netkit::endpoint& addr2 ) const = 0;
+	virtual netkit::co_task<netkit::pipe_ptr> prepare(netkit::pipe_ptr pipe_to_proxy, netkit::endpoint& addr2 ) const = 0;
 	/*
 	* udp communication via proxy
 	* caller must provide low-level udp transport for sending custom udp packets
@@ -32,6 +44,8 @@ public:
 	const str::astr& get_name() const { return name; }
 	str::astr desc() const;
 	const netkit::endpoint& get_addr() const { return addr; }
+	signed_t connect_timeout(signed_t handler_timeout) const { return conn_timeout > 0 ? conn_timeout : handler_timeout; }
+	void connect_done(netkit::connect_result r) const; // count outcome of connect to proxy; failures are logged
 };
 
 
@@ -42,19 +56,19 @@ public:
 	proxy_socks4(loader& ldr, const str::astr& name, const asts& bb);
 	/*virtual*/ ~proxy_socks4() {}
 
-	/*virtual*/ netkit::pipe_ptr prepare(netkit::pipe_ptr pipe_to_proxy, netkit::endpoint& addr) const override;
+	/*virtual*/ netkit::co_task<netkit::pipe_ptr> prepare(netkit::pipe_ptr pipe_to_proxy, netkit::endpoint& addr) const override;
 };
 
 class proxy_socks5 : public proxy
 {
 	buffer authpacket;
-	bool initial_setup(u8* packet, netkit::pipe* p2p) const;
-	bool recv_rep(u8* packet, netkit::pipe* p2p, netkit::endpoint*ep, const str::astr_view *addr2domain) const; // addr2domain not null means logging
+	netkit::co_task<bool> initial_setup(u8* packet, netkit::pipe* p2p) const;
+	netkit::co_task<bool> recv_rep(u8* packet, netkit::pipe* p2p, netkit::endpoint*ep, const str::astr_view *addr2domain) const; // addr2domain not null means logging
 public:
 	proxy_socks5(loader& ldr, const str::astr& name, const asts& bb);
 	/*virtual*/ ~proxy_socks5() {}
 
-	/*virtual*/ netkit::pipe_ptr prepare(netkit::pipe_ptr pipe_to_proxy, netkit::endpoint& addr) const override; // tcp tunnel
+	/*virtual*/ netkit::co_task<netkit::pipe_ptr> prepare(netkit::pipe_ptr pipe_to_proxy, netkit::endpoint& addr) const override; // tcp tunnel
 	/*virtual*/ std::unique_ptr<netkit::udp_pipe> prepare(netkit::udp_pipe* /*transport*/) const override; //udp tunnel
 	/*virtual*/ bool support(netkit::socket_type) const { return true; }
 
@@ -82,12 +82,12 @@ proxy_shadowsocks::proxy_shadowsocks(loader& ldr, const str::astr& name, const a
 	*/
 }
 
-netkit::pipe_ptr proxy_shadowsocks::prepare(netkit::pipe_ptr pipe_2_proxy, netkit::endpoint& addr2) const
+netkit::co_task<netkit::pipe_ptr> proxy_shadowsocks::prepare(netkit::pipe_ptr pipe_2_proxy, netkit::endpoint& addr2) const
 {
 	if (addr2.state() == netkit::EPS_EMPTY || addr2.port() == 0)
-		return netkit::pipe_ptr();
+		co_return netkit::pipe_ptr();
 
-	netkit::pipe_ptr p_enc(new ss::core::crypto_pipe(pipe_2_proxy, std::move(core.cb()), core.masterKey, core.cp));
+	netkit::pipe_ptr p_enc(new ss::core::crypto_pipe(pipe_2_proxy, std::move(core.cb()), core.masterKey, core.cp, core.coalesce));
 	
 	// just send connect request (shadowsocks 2012 protocol spec)
 	// no need to wait answer: stream mode just after request
@@ -98,9 +98,9 @@ netkit::pipe_ptr proxy_shadowsocks::prepare(netkit::pipe_ptr pipe_2_proxy, netki
 
 	proxy_socks5::push_atyp(pg, addr2);
 
-    if (p_enc->send(packet, pg.ptr) == netkit::pipe::SEND_FAIL)
-        return netkit::pipe_ptr();
+    if (!co_await p_enc->write(packet, pg.ptr))
+        co_return netkit::pipe_ptr();
 
-	return p_enc;
+	co_return p_enc;
 }
 
@@ -31,4 +31,37 @@ void randomgen::force_reseed()
 
 	ASSERT(sfrng.is_seeded());
 
-}
\ No newline at end of file
+}
+
+randompool& randompool::get()
+{
+	static thread_local randompool p;
+	return p;
+}
+
+randompool::~randompool()
+{
+	Botan::secure_scrub_memory(pool.data(), pool.size());
+}
+
+void randompool::refill()
+{
+	rng.randomize(pool.data(), pool.size()); // drbg reseeds itself every reseed_interval requests
+	left = pool.size();
+}
+
+void randompool::fill(std::span<u8> out)
+{
+	for (size_t from = 0; from < out.size();)
+	{
+		if (left == 0)
+			refill();
+
+		size_t n = math::minv(left, out.size() - from);
+		u8* src = pool.data() + pool.size() - left;
+		memcpy(out.data() + from, src, n);
+		Botan::secure_scrub_memory(src, n); // handed out bytes must not stay in memory
+		left -= n;
+		from += n;
+	}
+}
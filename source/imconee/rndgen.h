@@ -39,3 +39,23 @@ class randomgen : public Botan::RandomNumberGenerator {
         void fill_bytes_with_input(std::span<uint8_t> out, std::span<const uint8_t> in) override;
 
 };
+
+class randompool // per-thread buffer of randomgen output; hands out salts and nonces without drbg setup and getrandom per connection
+{
+    static constexpr size_t pool_size = 4096;
+    static constexpr size_t reseed_interval = 64; // refills between reseeds from system rng
+
+    randomgen rng;
+    std::array<u8, pool_size> pool;
+    size_t left = 0; // unused bytes at the end of pool
+
+    randompool() :rng(reseed_interval) {}
+    void refill();
+
+public:
+    ~randompool();
+
+    static randompool& get(); // pool of current thread
+
+    void fill(std::span<u8> out);
+};
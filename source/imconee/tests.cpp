@@ -1,5 +1,10 @@
 #include "pch.h"
 #ifdef _DEBUG
+#include "botan/internal/poly1305.h"
+#include "botan/internal/cpuid.h"
+#include "botan/internal/aes_gcm.h"
+#include "botan/internal/gcm.h"
+#include "botan/internal/aes.h"
 
 HANDLE sig;
 volatile std::atomic<int> cntt = 0;
@@ -108,8 +113,293 @@ void fifo_test()
 }
 
 
+void poly1305_test()
+{
+	if (true) return;
+
+	// key and message generators match ones used to get expected tags by independent bigint implementation
+	auto mkkey = [](u8* k, bool ff) { for (int i = 0; i < 32; ++i) k[i] = ff ? 0xff : (u8)(i * 13 + 7); };
+	auto mkmsg = [](std::vector<u8>& m, size_t n, bool ff) { m.resize(n); for (size_t i = 0; i < n; ++i) m[i] = ff ? 0xff : (u8)(i * i * 7 + i * 3 + 1); };
+
+	struct vec { size_t len; bool ff; const char* tag; } vecs[] = {
+		{ 1000, false, "29c207c2f63fb46c9e6f661ac38ca07c" },
+		{ 4096, false, "a524d56eb582a79c444f24cac4d6fe3e" },
+		{ 16383, false, "e8da3a67e7bc04a212e58e2a097a7c7d" },
+		{ 65541, false, "b24f3db9ec1d0a12c4cbcb0a330f194d" },
+		{ 4099, true, "d1816ee5e6e47c88d9369edae1ace434" }, // max r limbs: carries
+	};
+
+	auto tag2hex = [](const u8* t, char* hex) { for (int i = 0; i < 16; ++i) sprintf(hex + i * 2, "%02x", t[i]); };
+
+	Botan::Poly1305 poly;
+	std::vector<u8> m, bench;
+	u8 key[32], tag[16], reftag[16];
+	char hex[33];
+
+	// rfc 8439, 2.5.2
+	const u8 rfckey[32] = { 0x85, 0xd6, 0xbe, 0x78, 0x57, 0x55, 0x6d, 0x33, 0x7f, 0x44, 0x52, 0xfe, 0x42, 0xd5, 0x06, 0xa8,
+							0x01, 0x03, 0x80, 0x8a, 0xfb, 0x0d, 0xb2, 0xfd, 0x4a, 0xbf, 0xf6, 0xaf, 0x41, 0x49, 0xf5, 0x1b };
+	const char* rfcmsg = "Cryptographic Forum Research Group";
+
+	mkmsg(bench, 1024 * 1024, false);
+
+	// scalar, avx2, avx512 ifma: each pass disables best remaining path
+	for (int pass = 0; pass < 3; ++pass)
+	{
+		str::astr prov = poly.provider();
 
+		poly.set_key(std::span<const u8>(rfckey, 32));
+		poly.update((const u8*)rfcmsg, strlen(rfcmsg));
+		poly.final(tag);
+		tag2hex(tag, hex);
+		if (strcmp(hex, "a8061dc1305136c6c22b8baf0c0127a9") != 0)
+			Print(FOREGROUND_RED, "poly1305 %s: rfc vector failed\n", prov.c_str());
 
+		for (const vec& v : vecs)
+		{
+			mkkey(key, v.ff);
+			mkmsg(m, v.len, v.ff);
+			poly.set_key(std::span<const u8>(key, 32));
+			poly.update(m.data(), m.size());
+			poly.final(tag);
+			tag2hex(tag, hex);
+			if (strcmp(hex, v.tag) != 0)
+				Print(FOREGROUND_RED, "poly1305 %s: vector %i failed\n", prov.c_str(), (int)v.len);
+		}
+
+		// same message in random pieces must give same tag (unaligned tails between wide steps)
+		srand(pass + 1);
+		for (int i = 0; i < 200; ++i)
+		{
+			mkkey(key, false);
+			key[0] = (u8)i;
+			mkmsg(m, rand() % 5000, false);
+			poly.set_key(std::span<const u8>(key, 32));
+			poly.update(m.data(), m.size());
+			poly.final(reftag);
 
+			poly.set_key(std::span<const u8>(key, 32));
+			for (size_t from = 0; from < m.size();)
+			{
+				size_t sz = std::min(m.size() - from, (size_t)(rand() % 1100));
+				poly.update(m.data() + from, sz);
+				from += sz;
+			}
+			poly.final(tag);
+			if (memcmp(tag, reftag, 16) != 0)
+				Print(FOREGROUND_RED, "poly1305 %s: split %i failed\n", prov.c_str(), i);
+		}
+
+		signed_t t0 = chrono::ms();
+		for (int i = 0; i < 256; ++i)
+		{
+			poly.set_key(std::span<const u8>(key, 32));
+			poly.update(bench.data(), bench.size());
+			poly.final(tag);
+		}
+		signed_t t = chrono::ms() - t0;
+		Print("poly1305 %s: %i MB/s\n", prov.c_str(), (int)(256 * 1000 / (t > 0 ? t : 1)));
+
+		if (pass == 0)
+			Botan::CPUID::clear_cpuid_bit(Botan::CPUID::CPUID_AVX512_BIT);
+		else
+			Botan::CPUID::clear_cpuid_bit(Botan::CPUID::CPUID_AVX2_BIT);
+	}
+	Botan::CPUID::initialize();
+
+	Print();
+	__debugbreak();
+}
+
+
+void aesgcm_test()
+{
+	if (true) return;
+
+	auto unhex = [](std::vector<u8>& out, const char* hex) { out.clear(); for (; hex[0] && hex[1]; hex += 2) { unsigned b; sscanf(hex, "%2x", &b); out.push_back((u8)b); } };
+	auto mkmsg = [](std::vector<u8>& m, size_t n, u8 seed) { m.resize(n); for (size_t i = 0; i < n; ++i) m[i] = (u8)(i * i * 7 + i * 3 + seed); };
+	auto botan_gcm = [](size_t keylen, bool enc) -> std::unique_ptr<Botan::Cipher_Mode> {
+		std::unique_ptr<Botan::BlockCipher> bc;
+		if (keylen == 16) bc = std::make_unique<Botan::AES_128>();
+		else if (keylen == 24) bc = std::make_unique<Botan::AES_192>();
+		else bc = std::make_unique<Botan::AES_256>();
+		if (enc) return std::make_unique<Botan::GCM_Encryption>(std::move(bc), 16);
+		return std::make_unique<Botan::GCM_Decryption>(std::move(bc), 16);
+	};
+	auto stitched = [](size_t keylen, bool enc) -> std::unique_ptr<Botan::Cipher_Mode> {
+		if (enc) return std::make_unique<Botan::AES_GCM_Encryption>(keylen);
+		return std::make_unique<Botan::AES_GCM_Decryption>(keylen);
+	};
+
+	// gcm spec test cases 3, 4, 10, 16; ciphertext || tag
+	const char* nist_p = "d9313225f88406e5a55909c5aff5269a86a7a9531534f7da2e4c303d8a318a721c3c0c95956809532fcf0e2449a6b525b16aedf5aa0de657ba637b391aafd255";
+	struct vec { const char* key; size_t plen; const char* ad; const char* ct; } vecs[] = {
+		{ "feffe9928665731c6d6a8f9467308308", 64, "",
+			"42831ec2217774244b7221b784d0d49ce3aa212f2c02a4e035c17e2329aca12e21d514b25466931c7d8f6a5aac84aa051ba30b396a0aac973d58e091473f5985" "4d5c2af327cd64a62cf35abd2ba6fab4" },
+		{ "feffe9928665731c6d6a8f9467308308", 60, "feedfacedeadbeeffeedfacedeadbeefabaddad2",
+			"42831ec2217774244b7221b784d0d49ce3aa212f2c02a4e035c17e2329aca12e21d514b25466931c7d8f6a5aac84aa051ba30b396a0aac973d58e091" "5bc94fbc3221a5db94fae95ae7121a47" },
+		{ "feffe9928665731c6d6a8f9467308308feffe9928665731c", 60, "feedfacedeadbeeffeedfacedeadbeefabaddad2",
+			"3980ca0b3c00e841eb06fac4872a2757859e1ceaa6efd984628593b40ca1e19c7d773d00c144c525ac619d18c84a3f4718e2448b2fe324d9ccda2710" "2519498e80f1478f37ba55bd6d27618c" },
+		{ "feffe9928665731c6d6a8f9467308308feffe9928665731c6d6a8f9467308308", 60, "feedfacedeadbeeffeedfacedeadbeefabaddad2",
+			"522dc1f099567d07f47f37a32a84427d643a8cdcbfe5c0c97598a2bd2555d1aa8cb08e48590dbb3da7b08b1056828838c5f61e6393ba7a0abcc9f662" "76fc6ece0f4e1768cddf8853bb2d551b" },
+	};
+
+	std::vector<u8> key, ad, ct, nonce, m, ref;
+	Botan::secure_vector<u8> buf;
+
+	// vaes, aes-ni; botan gcm is the reference for random cross checks
+	for (int pass = 0; pass < 2; ++pass)
+	{
+		str::astr prov = stitched(16, true)->provider();
+		unhex(nonce, "cafebabefacedbaddecaf888");
+
+		for (const vec& v : vecs)
+		{
+			unhex(key, v.key);
+			unhex(ad, v.ad);
+			unhex(ct, v.ct);
+
+			for (int impl = 0; impl < 2; ++impl)
+			{
+				auto e = impl ? botan_gcm(key.size(), true) : stitched(key.size(), true);
+				auto d = impl ? botan_gcm(key.size(), false) : stitched(key.size(), false);
+				const char* name = impl ? "botan" : prov.c_str();
+
+				unhex(m, nist_p);
+				m.resize(v.plen);
+				e->set_key(key);
+				static_cast<Botan::AEAD_Mode*>(e.get())->set_associated_data(ad);
+				e->start(nonce);
+				buf.assign(m.begin(), m.end());
+				e->finish(buf);
+				if (buf.size() != ct.size() || memcmp(buf.data(), ct.data(), ct.size()) != 0)
+					Print(FOREGROUND_RED, "aes-gcm %s: vector %i failed\n", name, (int)(&v - vecs));
+
+				d->set_key(key);
+				static_cast<Botan::AEAD_Mode*>(d.get())->set_associated_data(ad);
+				d->start(nonce);
+				buf.assign(ct.begin(), ct.end());
+				d->finish(buf);
+				if (buf.size() != m.size() || memcmp(buf.data(), m.data(), m.size()) != 0)
+					Print(FOREGROUND_RED, "aes-gcm %s: vector %i decryption failed\n", name, (int)(&v - vecs));
+			}
+		}
+
+		// random lengths and random splits against botan gcm; damaged tag must be rejected
+		srand(pass + 1);
+		for (int i = 0; i < 300; ++i)
+		{
+			size_t keylen = 16 + 8 * (i % 3);
+			mkmsg(key, keylen, (u8)i);
+			mkmsg(m, rand() % 3000, (u8)(i * 3));
+			nonce[0] = (u8)i;
+
+			auto re = botan_gcm(keylen, true);
+			re->set_key(key);
+			re->start(nonce);
+			buf.assign(m.begin(), m.end());
+			re->finish(buf);
+			ref.assign(buf.begin(), buf.end());
+
+			auto e = stitched(keylen, true);
+			e->set_key(key);
+			e->start(nonce);
+			buf.assign(m.begin(), m.end());
+			size_t from = 0;
+			for (size_t sz; (sz = (rand() % 700) & ~15) < m.size() - from;)
+			{
+				e->process(buf.data() + from, sz);
+				from += sz;
+			}
+			e->finish(buf, from);
+			if (buf.size() != ref.size() || memcmp(buf.data(), ref.data(), ref.size()) != 0)
+				Print(FOREGROUND_RED, "aes-gcm %s: random %i failed\n", prov.c_str(), i);
+
+			auto d = stitched(keylen, false);
+			d->set_key(key);
+			d->start(nonce);
+			buf.assign(ref.begin(), ref.end());
+			if (i & 1)
+				buf[rand() % buf.size()] ^= 1;
+			bool ok = true;
+			try { d->finish(buf); }
+			catch (const Botan::Invalid_Authentication_Tag&) { ok = false; }
+			if (ok != !(i & 1) || (ok && (buf.size() != m.size() || memcmp(buf.data(), m.data(), m.size()) != 0)))
+				Print(FOREGROUND_RED, "aes-gcm %s: random %i decryption failed\n", prov.c_str(), i);
+		}
+
+		for (int impl = 0; impl < 2; ++impl)
+		{
+			auto e = impl ? botan_gcm(32, true) : stitched(32, true);
+			mkmsg(key, 32, 1);
+			e->set_key(key);
+			buf.resize(1024 * 1024);
+			signed_t t0 = chrono::ms();
+			for (int i = 0; i < 256; ++i)
+			{
+				e->start(nonce);
+				e->process(buf.data(), buf.size());
+			}
+			signed_t t = chrono::ms() - t0;
+			Print("aes-256-gcm %s: %i MB/s\n", impl ? "botan" : prov.c_str(), (int)(256 * 1000 / (t > 0 ? t : 1)));
+		}
+
+		Botan::CPUID::clear_cpuid_bit(Botan::CPUID::CPUID_AVX512_AES_BIT);
+	}
+	Botan::CPUID::initialize();
+
+	Print();
+	__debugbreak();
+}
+
+
+
+
+
+#ifdef USE_IO_URING
+#include "uring.h"
+
+void uring_test()
+{
+	if (true) return;
+
+	// socket paused by io_uring (reader is slow) and closed by other thread must give its buffers back
+	int evt[2], sp[2];
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, evt) < 0 || socketpair(AF_UNIX, SOCK_STREAM, 0, sp) < 0)
+		__debugbreak();
+	netkit::uring* u = netkit::uring::create(evt[0], evt[1]);
+	if (!u)
+		return; // kernel doesn't support it
+	signed_t allbufs = u->free_buffers();
+
+	netkit::waitable_data w;
+	w = sp[0];
+	netkit::make_nonblocking(&w);
+	if (!u->attach(&w))
+		__debugbreak();
+
+	u8 data[16384] = {};
+	for (int i = 0; i < 16; ++i)
+		::send(sp[1], data, sizeof(data), MSG_DONTWAIT);
+	for (int i = 0; i < 20; ++i)
+		u->enter(10000);
+	if (u->free_buffers() == allbufs)
+		__debugbreak(); // nothing received
+
+	std::thread th([&w]() { netkit::uring::forget(&w); });
+	th.join();
+	::close(sp[0]);
+	for (int i = 0; i < 20 && u->free_buffers() != allbufs; ++i)
+		u->enter(10000);
+	if (u->free_buffers() != allbufs)
+		__debugbreak(); // leaked
+
+	delete u;
+	::close(sp[1]);
+	::close(evt[0]);
+	::close(evt[1]);
+	__debugbreak();
+}
+#endif
 
 #endif
\ No newline at end of file
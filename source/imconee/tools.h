@@ -179,6 +179,21 @@ namespace chrono
 		return (signed_t)timeGetTime();
 	}
 
+	inline signed_t us() // microseconds; for short intervals only
+	{
+#ifdef _WIN32
+		static const LARGE_INTEGER f = []() { LARGE_INTEGER x; QueryPerformanceFrequency(&x); return x; }();
+		LARGE_INTEGER c;
+		QueryPerformanceCounter(&c);
+		return (signed_t)(c.QuadPart / f.QuadPart * 1000000 + c.QuadPart % f.QuadPart * 1000000 / f.QuadPart);
+#endif
+#ifdef _NIX
+		struct timespec t;
+		clock_gettime(CLOCK_MONOTONIC, &t);
+		return (signed_t)t.tv_sec * 1000000 + t.tv_nsec / 1000;
+#endif
+	}
+
 }
 
 
@@ -736,28 +751,132 @@ namespace str
 
 namespace tools
 {
+	template<signed_t size> class block_pool // blocks of buffers that hold data only for a while; freed blocks are kept per thread, excess goes to shared spill list
+	{
+		static constexpr signed_t high = (1024 * 1024) / size < 8 ? 8 : (1024 * 1024) / size; // per thread (~1MB); above it thread spills down to low
+		static constexpr signed_t low = high / 4; // also number of blocks thread takes back from spill list at once
+		static constexpr signed_t spill_max = high * 4; // shared; rest goes back to heap
+
+		struct spill_list : spinlock::syncvar<std::vector<u8*>>
+		{
+			std::atomic<signed_t> count = 0; // to not lock empty list
+			~spill_list()
+			{
+				auto s = lock_write();
+				pooled -= s().size();
+				count = 0;
+				for (u8* b : s())
+					delete[] b;
+				s().clear();
+			}
+		};
+		static inline spill_list spilled;
+
+		struct spare_blocks
+		{
+			std::vector<u8*> blocks;
+			~spare_blocks()
+			{
+				spill(0); // thread exits; let others use its blocks
+			}
+			void spill(signed_t keep)
+			{
+				auto s = spilled.lock_write();
+				for (; (signed_t)blocks.size() > keep; blocks.pop_back())
+				{
+					if ((signed_t)s().size() < spill_max)
+					{
+						s().push_back(blocks.back());
+						spilled.count.fetch_add(1, std::memory_order_relaxed);
+						continue;
+					}
+					--pooled;
+					delete[] blocks.back();
+				}
+			}
+			void refill()
+			{
+				if (spilled.count.load(std::memory_order_relaxed) == 0)
+					return;
+				auto s = spilled.lock_write();
+				for (signed_t n = 0; n < low && !s().empty(); ++n)
+				{
+					blocks.push_back(s().back());
+					s().pop_back();
+					spilled.count.fetch_sub(1, std::memory_order_relaxed);
+				}
+			}
+		};
+		static inline thread_local spare_blocks spare;
+
+	public:
+		static inline std::atomic<signed_t> used = 0; // blocks taken by buffers, all threads
+		static inline std::atomic<signed_t> pooled = 0; // spare blocks, all threads and spill list
+		static inline std::atomic<signed_t> hits = 0, misses = 0; // get() served by pool / by heap
+
+		static constexpr signed_t block_size = size;
+		static signed_t held_bytes() { return pooled * size; }
+		static signed_t hit_rate() // percent
+		{
+			signed_t h = hits, m = misses;
+			return h + m > 0 ? h * 100 / (h + m) : 100;
+		}
+
+		static u8* get()
+		{
+			used.fetch_add(1, std::memory_order_relaxed);
+			if (spare.blocks.empty())
+				spare.refill();
+			if (spare.blocks.empty())
+			{
+				misses.fetch_add(1, std::memory_order_relaxed);
+				return new u8[size];
+			}
+			hits.fetch_add(1, std::memory_order_relaxed);
+			pooled.fetch_sub(1, std::memory_order_relaxed);
+			u8* b = spare.blocks.back();
+			spare.blocks.pop_back();
+			return b;
+		}
+		static void put(u8* b) // any thread
+		{
+			used.fetch_sub(1, std::memory_order_relaxed);
+			pooled.fetch_add(1, std::memory_order_relaxed);
+			spare.blocks.push_back(b);
+			if ((signed_t)spare.blocks.size() > high)
+				spare.spill(low);
+		}
+	};
+
 	template<signed_t size> class chunk_buffer
 	{
 	public:
 		enum {
 			SIZE = size
 		};
+		using pool = block_pool<SIZE + sizeof(void*)>; // chunks of all buffers of this size, so bursty senders don't churn heap
+
 	private:
 		struct chunk
 		{
 			u8 data[SIZE];
 			std::unique_ptr<chunk> next;
+
+			static void* operator new(size_t sz) { ASSERT(sz == pool::block_size); return pool::get(); }
+			static void operator delete(void* p) { pool::put((u8*)p); }
 		};
 
 		std::unique_ptr<chunk> first;
 		chunk* last = nullptr;
 		signed_t first_skip = 0;
 		signed_t last_size = 0;
+		signed_t total = 0; // bytes of data; kept, so size checks don't walk chunks
 
 	public:
 
 		void assign(std::span<const u8> data)
 		{
+			total = data.size();
 			if (data.size() == 0)
 			{
 				first.reset();
@@ -803,6 +922,7 @@ namespace tools
 
 		void append(std::span<const u8> data)
 		{
+			total += data.size();
 			if (!first)
 			{
 				first.reset(new chunk());
@@ -835,6 +955,7 @@ namespace tools
 
 		void skip(signed_t sv)
 		{
+			total -= sv;
 			first_skip += sv;
 			for (;;)
 			{
@@ -893,6 +1014,7 @@ namespace tools
 				}
 
 			}
+			total = 0;
 			return total_peeked;
 		}
 
@@ -902,48 +1024,65 @@ namespace tools
 			return first == nullptr || (first.get() == last && last_size == 0);
 		}
 
-		bool enough(signed_t sz) const // is buffer contain at least sz bytes
+		signed_t get_chunks(std::span<const u8>* out, signed_t maxn) const // data of first chunks, for vectored send; returns number of them
 		{
-			signed_t csz = -first_skip;
-			for (chunk* ch = first.get(); ch; ch = ch->next.get())
+			signed_t n = 0;
+			for (chunk* ch = first.get(); ch && n < maxn; ch = ch->next.get())
 			{
-				signed_t fcsh = ch == last ? last_size : SIZE;
-				csz += fcsh;
-				if (csz >= sz)
-					return true;
+				signed_t from = ch == first.get() ? first_skip : 0;
+				signed_t to = ch == last ? last_size : SIZE;
+				if (to > from)
+					out[n++] = std::span<const u8>(ch->data + from, to - from);
 			}
-			return csz >= sz;
+			return n;
+		}
+
+		signed_t datasize() const
+		{
+			return total;
+		}
+
+		bool enough(signed_t sz) const // is buffer contain at least sz bytes
+		{
+			return total >= sz;
 		}
 
 		bool enough_for(signed_t sz) const // is sz bytes enough to fit current buffer data
 		{
-			signed_t csz = -first_skip;
-			for (chunk* ch = first.get(); ch; ch = ch->next.get())
-			{
-				signed_t fcsh = ch == last ? last_size : SIZE;
-				csz += fcsh;
-				if (csz > sz)
-					return false;
-			}
-			return csz <= sz;
+			return total <= sz;
 		}
 
 	};
 
-	template<signed_t size> class circular_buffer
+	template<signed_t size> class circular_buffer // storage is taken from block_pool only while buffer has data
 	{
-		u8 data[(size + 15) & (~15)];
+		u8* data = nullptr;
 		signed_t start = 0, end = 0;
+
+		void release()
+		{
+			if (data)
+			{
+				block_pool<size>::put(data);
+				data = nullptr;
+			}
+		}
 	public:
 		circular_buffer() {}
+		~circular_buffer()
+		{
+			release();
+		}
 		circular_buffer(circular_buffer&& x)
 		{
-			end = x.peek(data, size);
+			*this = std::move(x);
 		}
 		void operator=(circular_buffer&& x)
 		{
-			start = 0;
-			end = x.peek(data, size);
+			release();
+			data = x.data; x.data = nullptr;
+			start = x.start; x.start = 0;
+			end = x.end; x.end = 0;
 		}
 
 		bool is_full() const
@@ -951,10 +1090,11 @@ namespace tools
 			return (start == 0 && end == size) || (end + 1 == start);
 		}
 
-		void clear()
+		void clear() // also returns storage to pool
 		{
 			start = 0;
 			end = 0;
+			release();
 		}
 		signed_t datasize() const { return (start <= end) ? (end - start) : ((size - start) + end); }
 		signed_t get_free_size() const
@@ -971,8 +1111,31 @@ namespace tools
 
 		using tank = std::span<u8>;
 
+		signed_t get_free(tank* out) // both free parts, for vectored recv; returns number of them (0..2)
+		{
+			if (data == nullptr)
+				data = block_pool<size>::get();
+			signed_t n = 0;
+			if (start <= end)
+			{
+				signed_t sz1 = size - end;
+				signed_t sz2 = start - 1; if (sz2 < 0) sz2 = 0;
+				if (sz1 > 0)
+					out[n++] = tank(data + end, sz1);
+				if (sz2 > 0)
+					out[n++] = tank(data, sz2);
+				return n;
+			}
+			signed_t sz = start - end - 1;
+			if (sz > 0)
+				out[n++] = tank(data + end, sz);
+			return n;
+		}
+
 		tank get_1st_free()
 		{
+			if (data == nullptr)
+				data = block_pool<size>::get();
 			if (start <= end)
 			{
 				signed_t sz1 = size - end;
@@ -1013,6 +1176,8 @@ namespace tools
 
 		signed_t peek(u8* output, signed_t outsize)
 		{
+			if (start == end)
+				return 0;
 			if (start <= end)
 			{
 				// continuous block
@@ -1043,6 +1208,8 @@ namespace tools
 				start += outsize;
 				if (start == size)
 					start = 0;
+				if (start == end)
+					clear();
 				return outsize;
 			}
 			memcpy(output, data + start, sz1);
@@ -1056,7 +1223,7 @@ namespace tools
 			}
 
 			memcpy(output + sz1, data, sz2);
-			start = sz2;
+			clear(); // all taken
 			return sz1 + sz2;
 
 		}
@@ -1116,6 +1283,150 @@ namespace tools
 		}
 	};
 
+	template<typename T> class timing_wheel // hierarchical: 4 levels of 64 lists; arm and cancel are O(1); time is counted in ticks
+	{
+	public:
+		class node // member of T; expired node is passed to expire callback as its host
+		{
+			friend class timing_wheel;
+			node* prev = nullptr;
+			node* next = nullptr;
+			u64 expire = 0;
+
+			void unlink()
+			{
+				prev->next = next;
+				next->prev = prev;
+				prev = nullptr;
+				next = nullptr;
+			}
+
+		public:
+			T* const host;
+
+			node(T* host = nullptr) :host(host) {}
+			node(const node&) = delete;
+			~node() { cancel(); }
+
+			node& operator=(node&& n) // take place of n in wheel (host of T moved to other T); host is not changed
+			{
+				cancel();
+				if (n.armed())
+				{
+					prev = n.prev;
+					next = n.next;
+					prev->next = this;
+					next->prev = this;
+					expire = n.expire;
+					n.prev = nullptr;
+					n.next = nullptr;
+				}
+				return *this;
+			}
+
+			bool armed() const { return prev != nullptr; }
+			void cancel()
+			{
+				if (prev)
+					unlink();
+			}
+		};
+
+	private:
+		enum : signed_t
+		{
+			LEVEL_BITS = 6,
+			LEVEL_SIZE = 1 << LEVEL_BITS,
+			LEVELS = 4,
+		};
+
+		std::array<node, LEVEL_SIZE* LEVELS> lists; // circular lists; list head is not a timer
+		u64 now = 0;
+
+		void link(node* n)
+		{
+			if ((n->expire >> (LEVEL_BITS * LEVELS)) != (now >> (LEVEL_BITS * LEVELS)))
+				n->expire = now | ((u64(1) << (LEVEL_BITS * LEVELS)) - 1); // too far; expires early at end of range (host re-arms)
+
+			// level where expire and now differ only by bits of this level; so list is reached by cascade before expiration
+			signed_t l = 0;
+			for (; (n->expire >> (LEVEL_BITS * (l + 1))) != (now >> (LEVEL_BITS * (l + 1))); ++l);
+
+			node* h = &lists[l * LEVEL_SIZE + ((n->expire >> (LEVEL_BITS * l)) & (LEVEL_SIZE - 1))];
+			n->prev = h->prev;
+			n->next = h;
+			h->prev->next = n;
+			h->prev = n;
+		}
+
+		void cascade(signed_t l)
+		{
+			node* h = &lists[l * LEVEL_SIZE + ((now >> (LEVEL_BITS * l)) & (LEVEL_SIZE - 1))];
+			for (; h->next != h;)
+			{
+				node* n = h->next;
+				n->unlink();
+				link(n); // now goes to lower level
+			}
+		}
+
+	public:
+		timing_wheel()
+		{
+			for (node& h : lists)
+				h.prev = h.next = &h;
+		}
+		timing_wheel(const timing_wheel&) = delete;
+		~timing_wheel()
+		{
+			for (node& h : lists)
+				for (; h.next != &h;)
+					h.next->unlink();
+			for (node& h : lists)
+				h.prev = h.next = nullptr;
+		}
+
+		u64 ticks() const { return now; }
+
+		void arm(node& n, u64 expire) // re-arm if already armed
+		{
+			n.cancel();
+			n.expire = expire > now ? expire : now + 1; // list of now is already processed
+			link(&n);
+		}
+
+		signed_t idle_ticks() const // ticks until next expiration or cascade; so caller can sleep
+		{
+			for (signed_t i = 1; i < LEVEL_SIZE; ++i)
+			{
+				u64 t = now + i;
+				if ((t & (LEVEL_SIZE - 1)) == 0 || lists[t & (LEVEL_SIZE - 1)].next != &lists[t & (LEVEL_SIZE - 1)])
+					return i;
+			}
+			return LEVEL_SIZE;
+		}
+
+		template<typename EXP> void advance(u64 target, EXP expired) // expired(T*) can arm or cancel any node
+		{
+			for (; now < target;)
+			{
+				++now;
+				signed_t l = 1;
+				for (; l < LEVELS && (now & ((u64(1) << (LEVEL_BITS * l)) - 1)) == 0; ++l);
+				for (--l; l > 0; --l)
+					cascade(l);
+
+				node* h = &lists[now & (LEVEL_SIZE - 1)];
+				for (; h->next != h;)
+				{
+					node* n = h->next;
+					n->unlink();
+					expired(n->host);
+				}
+			}
+		}
+	};
+
 	template<typename EL> void remove_fast(std::vector<EL>& arr, signed_t eli)
 	{
 		if (eli < (signed_t)arr.size() - 1)
@@ -0,0 +1,615 @@
+#include "pch.h"
+
+#ifdef USE_IO_URING
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include "uring.h"
+
+#ifndef IORING_FEAT_REG_REG_RING
+#define IORING_FEAT_REG_REG_RING (1U << 13) // 6.3+; also means multishot recv and provided buffer rings are supported
+#endif
+
+namespace netkit
+{
+	namespace
+	{
+		int sys_setup(unsigned entries, io_uring_params* p)
+		{
+			return (int)syscall(__NR_io_uring_setup, entries, p);
+		}
+		int sys_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags, const void* arg, size_t argsz)
+		{
+			return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, arg, argsz);
+		}
+		int sys_register(int fd, unsigned op, const void* arg, unsigned nr)
+		{
+			return (int)syscall(__NR_io_uring_register, fd, op, arg, nr);
+		}
+
+		enum : u64
+		{
+			TAG_RECV = 0,
+			TAG_POLL = 1,
+			TAG_SIGNAL = 2, // no record
+			TAG_IGNORE = 3, // no record
+			TAG_MASK = 3,
+		};
+
+		enum : u8
+		{
+			F_RECV = 1,		// multishot recv armed
+			F_POLL = 2,		// POLLOUT poll armed
+			F_PAUSED = 4,	// recv cancelled due too many unread buffers
+			F_EOF = 8,		// connection closed or failed
+			F_WRITABLE = 16,
+			F_TOUCHED = 32, // in touched list
+			F_REARM = 64,	// in rearm list
+		};
+	}
+
+	struct uring_rec
+	{
+		uring* ring;
+		std::atomic<WAITABLE> w; // nullptr when socket closed (forget clears it from any thread); record released with last completion
+		i32 head = -1, tail = -1; // received buffers
+		u32 headoff = 0; // already fetched bytes of head buffer
+		u32 slot;
+		u16 numbufs = 0;
+		u8 flags = 0;
+
+		uring_rec(uring* ring, u32 slot) :ring(ring), w(nullptr), slot(slot) {}
+
+		uring_rec* next_forgotten = nullptr;
+		std::atomic<bool> forgotten = false; // in forgotten list of ring; owner must not release record until takes it from there
+
+		WAITABLE sock() const { return w.load(std::memory_order_acquire); }
+	};
+
+	/*static*/ uring* uring::create(int sigfd, int sigwr)
+	{
+		io_uring_params p = {};
+		p.flags = IORING_SETUP_CQSIZE;
+		p.cq_entries = 4096; // multishot requests produce many completions
+		int fd = sys_setup(256, &p);
+		if (fd < 0)
+			return nullptr;
+
+		const u32 required = IORING_FEAT_SINGLE_MMAP | IORING_FEAT_NODROP | IORING_FEAT_EXT_ARG | IORING_FEAT_REG_REG_RING;
+		if ((p.features & required) != required)
+		{
+			::close(fd);
+			return nullptr;
+		}
+
+		std::unique_ptr<uring> u(new uring());
+		u->fd = fd;
+		u->sigfd = sigfd;
+		u->sigwr = sigwr;
+		u->tid = spinlock::tid_self();
+
+		u->ringsz = math::maxv(p.sq_off.array + p.sq_entries * sizeof(uint32_t), p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe));
+		u->ringmem = mmap(nullptr, u->ringsz, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+		if (u->ringmem == MAP_FAILED)
+		{
+			u->ringmem = nullptr;
+			return nullptr;
+		}
+		u->sqesz = p.sq_entries * sizeof(io_uring_sqe);
+		u->sqes = (io_uring_sqe*)mmap(nullptr, u->sqesz, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+		if (u->sqes == MAP_FAILED)
+		{
+			u->sqes = nullptr;
+			return nullptr;
+		}
+
+		u8* rm = (u8*)u->ringmem;
+		u->sq_head = (uint32_t*)(rm + p.sq_off.head);
+		u->sq_tail = (uint32_t*)(rm + p.sq_off.tail);
+		u->sq_array = (uint32_t*)(rm + p.sq_off.array);
+		u->sq_mask = *(uint32_t*)(rm + p.sq_off.ring_mask);
+		u->sq_entries = p.sq_entries;
+		u->sqtail = *u->sq_tail;
+		u->cq_head = (uint32_t*)(rm + p.cq_off.head);
+		u->cq_tail = (uint32_t*)(rm + p.cq_off.tail);
+		u->cq_mask = *(uint32_t*)(rm + p.cq_off.ring_mask);
+		u->cqes = (io_uring_cqe*)(rm + p.cq_off.cqes);
+
+		// provided buffers: kernel picks free buffer for each received chunk
+		u->br = (io_uring_buf_ring*)mmap(nullptr, NUM_BUFFERS * sizeof(io_uring_buf), PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+		if (u->br == MAP_FAILED)
+		{
+			u->br = nullptr;
+			return nullptr;
+		}
+		u->bufs = (u8*)mmap(nullptr, NUM_BUFFERS * BUFFER_SIZE, PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+		if (u->bufs == MAP_FAILED)
+		{
+			u->bufs = nullptr;
+			return nullptr;
+		}
+
+		io_uring_buf_reg reg = {};
+		reg.ring_addr = (u64)u->br;
+		reg.ring_entries = NUM_BUFFERS;
+		reg.bgid = 0;
+		if (sys_register(fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0)
+			return nullptr;
+
+		for (u32 i = 0; i < NUM_BUFFERS; ++i)
+			u->recycle(tools::as_word(i));
+
+		u->arm_signal();
+		return u.release();
+	}
+
+	uring::uring()
+	{
+	}
+
+	uring::~uring()
+	{
+		for (auto& r : recs)
+		{
+			if (!r)
+				continue;
+			if (WAITABLE w = r->w.exchange(nullptr, std::memory_order_acq_rel))
+			{
+				w->urec = nullptr;
+				w->owner = nullptr;
+			}
+		}
+
+		if (fd >= 0)
+			::close(fd); // all pending requests are cancelled here
+		if (sqes)
+			munmap(sqes, sqesz);
+		if (ringmem)
+			munmap(ringmem, ringsz);
+		if (bufs)
+			munmap(bufs, NUM_BUFFERS * BUFFER_SIZE);
+		if (br)
+			munmap(br, NUM_BUFFERS * sizeof(io_uring_buf));
+	}
+
+	io_uring_sqe* uring::get_sqe()
+	{
+		if (sqtail - __atomic_load_n(sq_head, __ATOMIC_ACQUIRE) >= sq_entries)
+		{
+			// submission queue is full; submit now
+			__atomic_store_n(sq_tail, sqtail, __ATOMIC_RELEASE);
+			sys_enter(fd, sq_entries, 0, 0, nullptr, 0);
+			if (sqtail - __atomic_load_n(sq_head, __ATOMIC_ACQUIRE) >= sq_entries)
+				return nullptr;
+		}
+
+		uint32_t i = sqtail & sq_mask;
+		io_uring_sqe* sqe = sqes + i;
+		memset(sqe, 0, sizeof(io_uring_sqe));
+		sq_array[i] = i;
+		++sqtail;
+		return sqe;
+	}
+
+	void uring::recycle(u16 bid)
+	{
+		// not br->bufs: in C++ __DECLARE_FLEX_ARRAY places it after empty struct, i.e. at wrong offset
+		io_uring_buf* b = (io_uring_buf*)br + (br_tail & (NUM_BUFFERS - 1));
+		// field by field: tail of ring shares memory with resv field of 1st entry
+		b->addr = (u64)(bufs + bid * BUFFER_SIZE);
+		b->len = BUFFER_SIZE;
+		b->bid = bid;
+		++br_tail;
+		__atomic_store_n(&br->tail, br_tail, __ATOMIC_RELEASE);
+		++freebufs;
+	}
+
+	void uring::enqueue(uring_rec* r, u16 bid, u32 len)
+	{
+		buflen[bid] = len;
+		bufnext[bid] = -1;
+		if (r->tail >= 0)
+			bufnext[r->tail] = bid;
+		else
+			r->head = bid;
+		r->tail = bid;
+		++r->numbufs;
+
+		if (r->numbufs >= MAX_QUEUED && (r->flags & (F_RECV | F_PAUSED)) == F_RECV)
+		{
+			// reader is slower than socket; let the data wait in kernel's socket buffer
+			r->flags |= F_PAUSED;
+			cancel(r);
+		}
+	}
+
+	void uring::drop_queue(uring_rec* r)
+	{
+		for (i32 bid = r->head; bid >= 0;)
+		{
+			i32 next = bufnext[bid];
+			recycle(tools::as_word(bid));
+			bid = next;
+		}
+		r->head = r->tail = -1;
+		r->headoff = 0;
+		r->numbufs = 0;
+	}
+
+	void uring::touch(uring_rec* r)
+	{
+		if (0 == (r->flags & F_TOUCHED))
+		{
+			r->flags |= F_TOUCHED;
+			touched.push_back(r);
+		}
+	}
+
+	void uring::release_if_dead(uring_rec* r)
+	{
+		if (r->sock() != nullptr || 0 != (r->flags & (F_RECV | F_POLL | F_TOUCHED | F_REARM)) || r->forgotten.load(std::memory_order_acquire))
+			return;
+
+		drop_queue(r);
+		freerecs.push_back(r->slot);
+		recs[r->slot].reset();
+	}
+
+	void uring::arm_recv(uring_rec* r)
+	{
+		if (freebufs <= 0)
+		{
+			if (0 == (r->flags & F_REARM))
+			{
+				r->flags |= F_REARM;
+				rearm.push_back(r);
+			}
+			return;
+		}
+
+		io_uring_sqe* sqe = get_sqe();
+		if (!sqe)
+			return;
+		sqe->opcode = IORING_OP_RECV;
+		sqe->fd = r->sock()->s;
+		sqe->ioprio = IORING_RECV_MULTISHOT;
+		sqe->flags = IOSQE_BUFFER_SELECT;
+		sqe->buf_group = 0;
+		sqe->user_data = (u64)r | TAG_RECV;
+		r->flags |= F_RECV;
+	}
+
+	void uring::arm_signal()
+	{
+		if (io_uring_sqe* sqe = get_sqe())
+		{
+			sqe->opcode = IORING_OP_POLL_ADD;
+			sqe->fd = sigfd;
+			sqe->len = IORING_POLL_ADD_MULTI;
+			sqe->poll32_events = POLLIN;
+			sqe->user_data = TAG_SIGNAL;
+		}
+	}
+
+	void uring::cancel(uring_rec* r)
+	{
+		if (io_uring_sqe* sqe = get_sqe())
+		{
+			sqe->opcode = IORING_OP_ASYNC_CANCEL;
+			sqe->fd = -1;
+			sqe->addr = (u64)r | TAG_RECV;
+			sqe->user_data = TAG_IGNORE;
+		}
+	}
+
+	bool uring::attach(WAITABLE w)
+	{
+		if (w->urec != nullptr)
+			return w->urec->ring == this;
+
+		u32 slot;
+		if (freerecs.empty())
+		{
+			slot = (u32)recs.size();
+			recs.emplace_back();
+		}
+		else
+		{
+			slot = freerecs.back();
+			freerecs.pop_back();
+		}
+		recs[slot].reset(new uring_rec(this, slot));
+		uring_rec* r = recs[slot].get();
+
+		r->w.store(w, std::memory_order_release);
+		w->urec = r;
+		arm_recv(r);
+		if (w->bufferfull)
+			want_write(w);
+		return true;
+	}
+
+	void uring::detach(WAITABLE w)
+	{
+		uring_rec* r = w->urec;
+		if (r == nullptr || r->ring != this)
+			return;
+
+		w->urec = nullptr;
+		r->w.store(nullptr, std::memory_order_release);
+		if (r->flags & F_RECV)
+			cancel(r);
+		if (r->flags & F_POLL)
+		{
+			if (io_uring_sqe* sqe = get_sqe())
+			{
+				sqe->opcode = IORING_OP_POLL_REMOVE;
+				sqe->fd = -1;
+				sqe->addr = (u64)r | TAG_POLL;
+				sqe->user_data = TAG_IGNORE;
+			}
+		}
+		drop_queue(r);
+		release_if_dead(r);
+	}
+
+	/*static*/ void uring::forget(WAITABLE w)
+	{
+		uring_rec* r = w->urec;
+		w->urec = nullptr;
+		::shutdown(w->s, SHUT_RDWR); // wakes up pending requests, so kernel will release the socket
+
+		uring* u = r->ring;
+		if (u->tid == spinlock::tid_self())
+		{
+			r->w.store(nullptr, std::memory_order_release);
+			u->drop_queue(r);
+			u->release_if_dead(r);
+			return;
+		}
+
+		// owner thread can be reaping completions of this record right now; it sees nullptr and stops touching the socket;
+		// paused or closed record gets no more completions, so owner takes it from forgotten list to release its buffers
+		r->forgotten.store(true, std::memory_order_relaxed);
+		r->w.store(nullptr, std::memory_order_release);
+		r->next_forgotten = u->forgotten.load(std::memory_order_relaxed);
+		while (!u->forgotten.compare_exchange_weak(r->next_forgotten, r, std::memory_order_release, std::memory_order_relaxed));
+		u8 fakedata = 1;
+		::send(u->sigwr, &fakedata, 1, MSG_DONTWAIT);
+	}
+
+	void uring::release_forgotten()
+	{
+		for (uring_rec* r = forgotten.exchange(nullptr, std::memory_order_acquire); r;)
+		{
+			uring_rec* next = r->next_forgotten;
+			r->forgotten.store(false, std::memory_order_relaxed);
+			drop_queue(r);
+			release_if_dead(r);
+			r = next;
+		}
+	}
+
+	/*static*/ void uring::want_write(WAITABLE w)
+	{
+		uring_rec* r = w->urec;
+		if (r->flags & F_POLL)
+			return;
+
+		if (io_uring_sqe* sqe = r->ring->get_sqe())
+		{
+			sqe->opcode = IORING_OP_POLL_ADD;
+			sqe->fd = w->s;
+			sqe->poll32_events = POLLOUT;
+			sqe->user_data = (u64)r | TAG_POLL;
+			r->flags |= F_POLL;
+		}
+	}
+
+	/*static*/ signed_t uring::fetch(WAITABLE w, std::span<u8> tank)
+	{
+		uring_rec* r = w->urec;
+		uring* u = r->ring;
+
+		signed_t copied = 0;
+		for (; r->head >= 0 && copied < (signed_t)tank.size();)
+		{
+			i32 bid = r->head;
+			signed_t n = math::minv((signed_t)(u->buflen[bid] - r->headoff), (signed_t)tank.size() - copied);
+			memcpy(tank.data() + copied, u->bufs + bid * BUFFER_SIZE + r->headoff, n);
+			copied += n;
+			r->headoff += (u32)n;
+			if (r->headoff == u->buflen[bid])
+			{
+				r->head = u->bufnext[bid];
+				if (r->head < 0)
+					r->tail = -1;
+				r->headoff = 0;
+				--r->numbufs;
+				u->recycle(tools::as_word(bid));
+			}
+		}
+
+		if (r->head < 0)
+		{
+			clear_ready(w, READY_SYSTEM);
+			if (copied == 0 && (r->flags & F_EOF))
+				return -1;
+		}
+
+		if ((r->flags & (F_PAUSED | F_RECV | F_EOF)) == F_PAUSED && r->numbufs < MAX_QUEUED / 2)
+		{
+			r->flags &= ~F_PAUSED;
+			u->arm_recv(r);
+		}
+
+		return copied;
+	}
+
+	/*static*/ wrslt uring::wait(WAITABLE w, long microsec)
+	{
+		uring_rec* r = w->urec;
+		for (int pass = 0;; ++pass)
+		{
+			if (r->head >= 0)
+			{
+				make_ready(w, READY_SYSTEM);
+				return WR_READY4READ;
+			}
+			if (r->flags & F_EOF)
+				return WR_CLOSED;
+			if (pass > 0)
+				return WR_TIMEOUT;
+
+			if ((r->flags & (F_PAUSED | F_RECV)) == F_PAUSED)
+			{
+				r->flags &= ~F_PAUSED;
+				r->ring->arm_recv(r);
+			}
+			r->ring->enter(microsec);
+		}
+	}
+
+	void uring::complete(const io_uring_cqe& c)
+	{
+		u64 tag = c.user_data & TAG_MASK;
+		uring_rec* r = (uring_rec*)(c.user_data & ~TAG_MASK);
+
+		switch (tag)
+		{
+		case TAG_IGNORE:
+			return;
+		case TAG_SIGNAL:
+			{
+				u8 temp[64];
+				::recv(sigfd, temp, sizeof(temp), MSG_DONTWAIT); // just clear buf of socketpair
+				if (0 == (c.flags & IORING_CQE_F_MORE))
+					arm_signal();
+			}
+			return;
+		case TAG_POLL:
+			r->flags &= ~F_POLL;
+			if (r->sock() && c.res > 0)
+			{
+				r->flags |= F_WRITABLE;
+				touch(r);
+			}
+			release_if_dead(r);
+			return;
+		}
+
+		// TAG_RECV
+		WAITABLE w = r->sock();
+		if (c.flags & IORING_CQE_F_BUFFER)
+		{
+			u16 bid = tools::as_word(c.flags >> IORING_CQE_BUFFER_SHIFT);
+			--freebufs;
+			if (c.res > 0 && w)
+				enqueue(r, bid, c.res);
+			else
+				recycle(bid);
+		}
+
+		if (0 == (c.flags & IORING_CQE_F_MORE))
+		{
+			r->flags &= ~F_RECV;
+			if (w)
+			{
+				if (c.res == 0)
+					r->flags |= F_EOF; // graceful close
+				else if (c.res == -ENOBUFS || c.res > 0 || c.res == -ECANCELED)
+				{
+					// recv may end by ENOBUFS before pausing cancel completes, so check the queue anyway;
+					// otherwise unread socket could take all buffers of ring
+					if (r->numbufs < ((r->flags & F_PAUSED) ? MAX_QUEUED / 2 : MAX_QUEUED))
+					{
+						r->flags &= ~F_PAUSED;
+						arm_recv(r);
+					}
+					else
+						r->flags |= F_PAUSED; // fetch resumes receiving
+				}
+				else
+					r->flags |= F_EOF; // error
+			}
+		}
+
+		if (w && (c.res > 0 || (r->flags & F_EOF)))
+		{
+			make_ready(w, READY_SYSTEM);
+			touch(r);
+		}
+
+		release_if_dead(r);
+	}
+
+	void uring::reap()
+	{
+		uint32_t head = *cq_head;
+		uint32_t tail = __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE);
+		for (; head != tail; ++head)
+			complete(cqes[head & cq_mask]);
+		__atomic_store_n(cq_head, head, __ATOMIC_RELEASE);
+	}
+
+	void uring::enter(long microsec)
+	{
+		if (forgotten.load(std::memory_order_relaxed) != nullptr)
+			release_forgotten();
+
+		if (!rearm.empty() && freebufs > 0)
+		{
+			std::vector<uring_rec*> rr;
+			rr.swap(rearm);
+			for (uring_rec* r : rr)
+			{
+				r->flags &= ~F_REARM;
+				if (r->sock() && 0 == (r->flags & (F_RECV | F_PAUSED | F_EOF)))
+					arm_recv(r);
+				release_if_dead(r);
+			}
+		}
+
+		__atomic_store_n(sq_tail, sqtail, __ATOMIC_RELEASE);
+		uint32_t to_submit = sqtail - __atomic_load_n(sq_head, __ATOMIC_ACQUIRE);
+
+		// events reaped by nested wait (recv of complex pipe) are not yet collected, so don't sleep
+		bool have_cqes = !touched.empty() || *cq_head != __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE);
+
+		__kernel_timespec ts = {};
+		io_uring_getevents_arg arg = {};
+		if (microsec > 0)
+		{
+			ts.tv_sec = microsec / 1000000;
+			ts.tv_nsec = (microsec % 1000000) * 1000;
+			arg.ts = (u64)&ts;
+		}
+
+		// the only syscall per tick: submits all requests queued while processing and waits for completions
+		sys_enter(fd, to_submit, (microsec == 0 || have_cqes) ? 0 : 1, IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG, &arg, sizeof(arg));
+
+		reap();
+	}
+
+	void uring::collect(pipe_waiter::mask& m)
+	{
+		for (uring_rec* r : touched)
+		{
+			r->flags &= ~F_TOUCHED;
+			if (WAITABLE w = r->sock())
+			{
+				if (r->head >= 0 || (r->flags & F_EOF))
+					m.add_read(w->index);
+				if (r->flags & F_WRITABLE)
+				{
+					r->flags &= ~F_WRITABLE;
+					m.add_write(w->index);
+				}
+			}
+			release_if_dead(r);
+		}
+		touched.clear();
+	}
+}
+
+#endif
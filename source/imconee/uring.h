@@ -0,0 +1,91 @@
+#pragma once
+
+#ifdef USE_IO_URING
+
+struct io_uring_cqe;
+struct io_uring_sqe;
+struct io_uring_buf_ring;
+
+namespace netkit
+{
+	struct uring_rec; // attached socket
+
+	class uring // io_uring engine of pipe_waiter; must be used only by thread of owner waiter (except forget)
+	{
+		enum : u32
+		{
+			NUM_BUFFERS = 128, // provided buffers (must be power of 2)
+			BUFFER_SIZE = 16384,
+			MAX_QUEUED = 4, // receiving paused if socket holds so many unread buffers
+		};
+
+		// ring fields are shared with kernel, so exact width types (u32 is long here)
+		int fd = -1;
+		int sigfd = -1;
+		int sigwr = -1; // other end of sigfd; wakes owner up
+		u32 tid = 0;
+
+		void* ringmem = nullptr;
+		size_t ringsz = 0;
+		io_uring_sqe* sqes = nullptr;
+		size_t sqesz = 0;
+
+		uint32_t* sq_head = nullptr;
+		uint32_t* sq_tail = nullptr;
+		uint32_t* sq_array = nullptr;
+		uint32_t sq_mask = 0;
+		uint32_t sq_entries = 0;
+		uint32_t sqtail = 0; // local tail; published by submit
+
+		uint32_t* cq_head = nullptr;
+		uint32_t* cq_tail = nullptr;
+		uint32_t cq_mask = 0;
+		io_uring_cqe* cqes = nullptr;
+
+		io_uring_buf_ring* br = nullptr;
+		u8* bufs = nullptr;
+		u16 br_tail = 0;
+		signed_t freebufs = 0;
+		u32 buflen[NUM_BUFFERS];
+		i32 bufnext[NUM_BUFFERS];
+
+		std::vector<std::unique_ptr<uring_rec>> recs;
+		std::vector<u32> freerecs;
+		std::vector<uring_rec*> touched; // got events since last collect
+		std::vector<uring_rec*> rearm; // multishot recv must be rearmed as soon as buffers available
+		std::atomic<uring_rec*> forgotten = nullptr; // records of sockets closed by other threads (see forget); owner releases them
+
+		uring();
+
+		io_uring_sqe* get_sqe();
+		void recycle(u16 bid);
+		void enqueue(uring_rec* r, u16 bid, u32 len);
+		void drop_queue(uring_rec* r);
+		void touch(uring_rec* r);
+		void release_if_dead(uring_rec* r);
+		void arm_recv(uring_rec* r);
+		void arm_signal();
+		void cancel(uring_rec* r);
+		void complete(const io_uring_cqe& c);
+		void reap();
+		void release_forgotten();
+
+	public:
+		static uring* create(int sigfd, int sigwr); // returns nullptr if io_uring is not available
+		~uring();
+
+		bool attach(WAITABLE w);
+		void detach(WAITABLE w); // cancel receiving; unread data dropped
+		void collect(pipe_waiter::mask& m); // move events into waiter mask
+		void enter(long microsec); // submit all queued requests and wait completions (0 - don't wait, <0 - infinite)
+
+		static void want_write(WAITABLE w);
+		static signed_t fetch(WAITABLE w, std::span<u8> tank); // copy received data; returns -1 if socket closed
+		static wrslt wait(WAITABLE w, long microsec);
+		static void forget(WAITABLE w); // socket is closing; any thread
+
+		signed_t free_buffers() const { return freebufs; } // provided buffers not held by records
+	};
+}
+
+#endif